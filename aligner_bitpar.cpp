@@ -0,0 +1,132 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <limits>
+#include "aligner_bitpar.h"
+
+using namespace std;
+
+/**
+ * Bit i of word w of reference mask m's vector is set iff read character
+ * 64*w + i matches any character in m.  A read N matches everything.  The
+ * mismatch penalty that matters is the one at the non-N read position with
+ * the lowest quality-adjusted penalty.
+ */
+void BitParallelFilter::init(
+	const BTDnaString& rd, // read sequence
+	const BTString& qu,    // read qualities
+	size_t rdi,            // offset of first read char to align
+	size_t rdf,            // offset of last read char to align (excl)
+	const Scoring& sc)     // scoring scheme
+{
+	assert_gt(rdf, rdi);
+	len_ = rdf - rdi;
+	nwords_ = (len_ + 63) / 64;
+	peq_.resizeNoCopy(nwords_ * 16);
+	peq_.fillZero();
+	mmpen_ = std::numeric_limits<int>::max();
+	gapext_ = min(sc.readGapExtend(), sc.refGapExtend());
+	gapconst_ = min(sc.rdGapConst, sc.rfGapConst);
+	for(size_t i = 0; i < len_; i++) {
+		int c = rd[rdi + i];
+		uint64_t bit = ((uint64_t)1) << (i & 63);
+		size_t w = i >> 6;
+		for(int m = 0; m < 16; m++) {
+			if(c > 3 || (m & (1 << c)) != 0) {
+				peq_[m * nwords_ + w] |= bit;
+			}
+		}
+		if(c <= 3) {
+			mmpen_ = min(mmpen_, sc.mm(qu[rdi + i] - 33));
+		}
+	}
+}
+
+/**
+ * Compute the edit distance matrix column by column, one word of each
+ * column at a time, keeping only its vertical deltas.  Row 0 is all zeros
+ * (the alignment may start anywhere) and the bottom row is tracked as a
+ * running score.  Stop as soon as the bottom row reaches kmax, or as soon
+ * as it's too far above kmax to get there in the columns that are left.
+ */
+bool BitParallelFilter::within(
+	const char *rf,        // reference characters
+	size_t rflen,          // # reference characters
+	size_t kmax)           // max # edits
+{
+	assert(inited());
+	if(len_ <= kmax) {
+		return true;
+	}
+	pv_.resizeNoCopy(nwords_);
+	mv_.resizeNoCopy(nwords_);
+	for(size_t w = 0; w < nwords_; w++) {
+		pv_[w] = ~((uint64_t)0);
+		mv_[w] = 0;
+	}
+	const size_t last = nwords_ - 1;
+	const size_t lastBit = (len_ - 1) & 63;
+	const uint64_t hibit = ((uint64_t)1) << 63;
+	size_t score = len_;
+	for(size_t j = 0; j < rflen; j++) {
+		int refm = rf[j];
+		int hin = 0; // horizontal delta entering the top row of the word
+		for(size_t w = 0; w < nwords_; w++) {
+			uint64_t eq = (refm > 15) ? ~((uint64_t)0) : peq_[refm * nwords_ + w];
+			uint64_t pv = pv_[w];
+			uint64_t mv = mv_[w];
+			uint64_t xv = eq | mv;
+			if(hin < 0) {
+				eq |= 1;
+			}
+			uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+			uint64_t ph = mv | ~(xh | pv);
+			uint64_t mh = pv & xh;
+			int hout;
+			if(w == last) {
+				hout = (int)((ph >> lastBit) & 1) - (int)((mh >> lastBit) & 1);
+			} else {
+				hout = (int)((ph & hibit) >> 63) - (int)((mh & hibit) >> 63);
+			}
+			ph <<= 1;
+			mh <<= 1;
+			if(hin < 0) {
+				mh |= 1;
+			} else if(hin > 0) {
+				ph |= 1;
+			}
+			pv_[w] = mh | ~(xv | ph);
+			mv_[w] = ph & xv;
+			hin = hout;
+		}
+		if(hin > 0) {
+			score++;
+		} else if(hin < 0) {
+			score--;
+		}
+		if(score <= kmax) {
+			return true;
+		}
+		if(score - kmax > rflen - j - 1) {
+			return false;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,127 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * aligner_bitpar.h
+ *
+ * BitParallelFilter decides whether a read can be aligned end to end
+ * somewhere within a stretch of reference with at most k edits, using
+ * Myers' bit-vector algorithm (in Hyyro's multi-word formulation) to compute
+ * the bottom row of the unit-cost edit distance matrix 64 rows at a time.
+ *
+ * Read and reference Ns match anything, so the edit distance it computes is
+ * a lower bound on the number of mismatches and gap positions in any
+ * alignment SwAligner could find in the same stretch.  SwAligner uses this
+ * to skip end-to-end fills that can't reach the minimum score; see
+ * SwAligner::align().
+ */
+
+#ifndef ALIGNER_BITPAR_H_
+#define ALIGNER_BITPAR_H_
+
+#include <stdint.h>
+#include <algorithm>
+#include "ds.h"
+#include "sstring.h"
+#include "scoring.h"
+#include "mem_ids.h"
+
+class BitParallelFilter {
+
+public:
+
+	BitParallelFilter() :
+		len_(0),
+		nwords_(0),
+		mmpen_(0),
+		gapext_(0),
+		gapconst_(0),
+		peq_(DP_CAT),
+		pv_(DP_CAT),
+		mv_(DP_CAT) { }
+
+	/**
+	 * Set up the match bit vectors for read characters [rdi, rdf) and
+	 * find the smallest penalties a mismatch or gap can incur against them.
+	 */
+	void init(
+		const BTDnaString& rd, // read sequence
+		const BTString& qu,    // read qualities
+		size_t rdi,            // offset of first read char to align
+		size_t rdf,            // offset of last read char to align (excl)
+		const Scoring& sc);    // scoring scheme
+
+	/**
+	 * Return true iff init() has been called since the last reset().
+	 */
+	bool inited() const { return len_ > 0; }
+
+	/**
+	 * Forget the read.
+	 */
+	void reset() { len_ = 0; }
+
+	/**
+	 * Return the largest # of edits an alignment scoring at least minsc
+	 * could have.  An alignment with k edits, b of them gap positions,
+	 * costs at least mmpen_ * (k - b) + gapext_ * b, plus gapconst_ if
+	 * b > 0, which is smallest either with no gaps or with nothing but one
+	 * gap.
+	 */
+	size_t maxEdits(int64_t minsc) const {
+		assert(inited());
+		assert(usable());
+		assert_leq(minsc, 0);
+		size_t kmax = (size_t)(-minsc / mmpen_);
+		if(-minsc >= gapconst_) {
+			kmax = std::max(kmax, (size_t)((-minsc - gapconst_) / gapext_));
+		}
+		return kmax;
+	}
+
+	/**
+	 * Return false iff the read can't be aligned end to end to any
+	 * substring of rf[0, rflen) with kmax or fewer edits.  Reference
+	 * characters are masks, as SwAligner keeps them: bit c is set iff the
+	 * character matches c, and 16 is N.
+	 */
+	bool within(
+		const char *rf,        // reference characters
+		size_t rflen,          // # reference characters
+		size_t kmax);          // max # edits
+
+	/**
+	 * Return false iff penalties are such that the filter can't be used,
+	 * i.e. some edit costs nothing.
+	 */
+	bool usable() const { return mmpen_ > 0 && gapext_ > 0; }
+
+protected:
+
+	size_t           len_;      // # read characters
+	size_t           nwords_;   // # 64-bit words per bit vector
+	int              mmpen_;    // smallest mismatch penalty at a non-N position
+	int              gapext_;   // smallest per-position gap penalty
+	int              gapconst_; // smallest constant term of a gap penalty
+	EList<uint64_t>  peq_;      // match vectors, nwords_ per reference mask
+	EList<uint64_t>  pv_;       // vertical +1 deltas of the current column
+	EList<uint64_t>  mv_;       // vertical -1 deltas of the current column
+};
+
+#endif /*ndef ALIGNER_BITPAR_H_*/
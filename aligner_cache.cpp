@@ -18,6 +18,8 @@
  */
 
 #include "aligner_cache.h"
+#include <algorithm>
+#include <new>
 #include "tinythread.h"
 
 #ifndef NDEBUG
@@ -104,6 +106,112 @@ bool AlignmentCache::addOnTheFly(
 	return true; 
 }
 
+/**
+ * Give about an eighth of the budget to the hash table, rounded down to a
+ * power of two # of slots, and the rest to the arena.
+ */
+SharedSeedCache::SharedSeedCache(uint64_t bytes) :
+	slots_(NULL),
+	mask_(0),
+	arena_(NULL),
+	arenasz_(0),
+	arenacur_(0),
+	full_(false)
+{
+	size_t nslots = 1;
+	while(nslots * 2 * sizeof(uint64_t) * 8 <= bytes) {
+		nslots *= 2;
+	}
+	mask_ = nslots - 1;
+	uint64_t arenasz = (bytes > nslots * sizeof(uint64_t)) ?
+		(bytes - nslots * sizeof(uint64_t)) : 0;
+	// Slots address the arena in 32 bits' worth of 8-byte words
+	arenasz = std::min<uint64_t>(arenasz, (uint64_t)0xfffffffe * sizeof(uint64_t));
+	arenasz_ = (size_t)(arenasz & ~((uint64_t)sizeof(uint64_t) - 1));
+	slots_ = new uint64_t[nslots]();
+	arena_ = new uint8_t[arenasz_];
+	gMemTally.add(CA_CAT, nslots * sizeof(uint64_t) + arenasz_);
+}
+
+SharedSeedCache::~SharedSeedCache() {
+	delete[] const_cast<uint64_t*>(slots_);
+	delete[] arena_;
+	gMemTally.del(CA_CAT, (mask_ + 1) * sizeof(uint64_t) + arenasz_);
+}
+
+bool SharedSeedCache::query(
+	const QKey& qk,
+	const Range*& ranges,
+	size_t& nranges) const
+{
+	assert(qk.cacheable());
+	const uint64_t h = hash(qk);
+	size_t i = (size_t)(h & mask_);
+	for(size_t p = 0; p < MAX_PROBES; p++, i = (i + 1) & mask_) {
+		uint64_t slot = slots_[i];
+		if(slot == 0) {
+			return false;
+		}
+		if((slot >> 32) == (h >> 32)) {
+			const Entry *e = entry(slot);
+			if(e->key == qk) {
+				ranges = reinterpret_cast<const Range*>(e + 1);
+				nranges = (size_t)e->nranges;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+/**
+ * Write the entry into a fresh piece of the arena first, then publish it by
+ * swapping its offset into an empty slot.  The swap is a full barrier, so a
+ * reader that sees the slot sees the whole entry.  If another thread
+ * publishes the same key first, our copy is simply abandoned.
+ */
+bool SharedSeedCache::add(
+	const QKey& qk,
+	const EList<Range>& ranges)
+{
+	assert(qk.cacheable());
+	const Range *tmpr = NULL;
+	size_t tmpn = 0;
+	if(full_ || query(qk, tmpr, tmpn)) {
+		return false;
+	}
+	size_t sz = sizeof(Entry) + ranges.size() * sizeof(Range);
+	sz = (sz + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+	size_t off = __sync_fetch_and_add(&arenacur_, sz);
+	if(off + sz > arenasz_) {
+		full_ = true;
+		return false;
+	}
+	Entry *e = new(arena_ + off) Entry;
+	e->key = qk;
+	e->nranges = ranges.size();
+	Range *r = reinterpret_cast<Range*>(e + 1);
+	for(size_t j = 0; j < ranges.size(); j++) {
+		new(r + j) Range(ranges[j]);
+	}
+	const uint64_t h = hash(qk);
+	const uint64_t word = (h & 0xffffffff00000000llu) | (off / sizeof(uint64_t) + 1);
+	size_t i = (size_t)(h & mask_);
+	for(size_t p = 0; p < MAX_PROBES; p++, i = (i + 1) & mask_) {
+		uint64_t slot = slots_[i];
+		if(slot == 0) {
+			if(__sync_bool_compare_and_swap(&slots_[i], 0, word)) {
+				return true;
+			}
+			slot = slots_[i];
+		}
+		if((slot >> 32) == (h >> 32) && entry(slot)->key == qk) {
+			return false; // another thread got there first
+		}
+	}
+	return false;
+}
+
 #ifdef ALIGNER_CACHE_MAIN
 
 #include <iostream>
@@ -620,9 +620,109 @@ protected:
 	uint32_t version_; // cache version
 };
 
+/**
+ * Across-read seed cache shared by all threads.  Maps a seed sequence (QKey)
+ * to the SA ranges that the seed search found for it: the reference
+ * substring and the BWT and BWT' ranges for each.  The seed search depends
+ * only on the seed sequence and on the seed policy, which is the same for
+ * every read, so a hit here can stand in for the search.
+ *
+ * The map is an open-addressing hash table whose slots are filled with a
+ * compare-and-swap and never change afterwards, and whose entries are carved
+ * out of one arena and never freed or modified once published.  Lookups
+ * therefore take no locks and never see a half-written entry.  Once the
+ * arena (or the probe sequence for a key) is full, further adds are
+ * dropped; nothing is evicted, so no entry is reclaimed while a reader
+ * might hold it.  The whole cache, table and arena, fits in the byte budget
+ * given to the constructor.
+ */
+class SharedSeedCache {
+
+public:
+
+	/**
+	 * One SA range found for a seed.
+	 */
+	struct Range {
+		SAKey      key;  // reference substring
+		TIndexOffU topf; // top in BWT
+		TIndexOffU botf; // bot in BWT
+		TIndexOffU topb; // top in BWT'
+		TIndexOffU botb; // bot in BWT'
+	};
+
+	explicit SharedSeedCache(uint64_t bytes);
+
+	~SharedSeedCache();
+
+	/**
+	 * Look up the seed sequence 'qk'.  If it's present, set 'ranges' to
+	 * point to its ranges and 'nranges' to their number, and return true.
+	 * The ranges stay valid for the life of the cache.
+	 */
+	bool query(
+		const QKey& qk,
+		const Range*& ranges,
+		size_t& nranges) const;
+
+	/**
+	 * Add the ranges found for seed sequence 'qk', unless it's already
+	 * present or the cache is full.  Returns true iff it was added.
+	 */
+	bool add(
+		const QKey& qk,
+		const EList<Range>& ranges);
+
+	/**
+	 * Return true iff adds have started failing for lack of arena space.
+	 */
+	bool full() const { return full_; }
+
+protected:
+
+	/**
+	 * Header of an entry in the arena, followed by its ranges.
+	 */
+	struct Entry {
+		QKey     key;     // seed sequence
+		uint64_t nranges; // # ranges that follow
+	};
+
+	/**
+	 * Return the entry a non-empty slot refers to.
+	 */
+	const Entry* entry(uint64_t slot) const {
+		return reinterpret_cast<const Entry*>(
+			arena_ + ((slot & 0xffffffff) - 1) * sizeof(uint64_t));
+	}
+
+	/**
+	 * Hash a seed sequence; the low bits pick the first slot to probe and
+	 * the high 32 bits are kept in the slot to skip most key compares.
+	 */
+	static uint64_t hash(const QKey& qk) {
+		uint64_t h = qk.seq ^ ((uint64_t)qk.len << 57) ^ qk.len;
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdllu;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53llu;
+		h ^= h >> 33;
+		return h;
+	}
+
+	static const size_t MAX_PROBES = 32; // give up after this many slots
+
+	volatile uint64_t *slots_;  // hash table: tag << 32 | (arena word offset + 1)
+	size_t            mask_;    // # slots - 1
+	uint8_t          *arena_;   // entries
+	size_t            arenasz_; // arena size in bytes
+	volatile size_t   arenacur_;// bytes of arena handed out so far
+	volatile bool     full_;    // an add failed for lack of arena space
+};
+
 /**
  * Interface used to query and update a pair of caches: one thread-
- * local and unsynchronized, another shared and synchronized.  One or
+ * local and unsynchronized, another shared among threads.  One or
  * both can be NULL.
  */
 class AlignmentCacheIface {
@@ -632,15 +732,18 @@ public:
 	AlignmentCacheIface(
 		AlignmentCache *current,
 		AlignmentCache *local,
-		AlignmentCache *shared) :
+		SharedSeedCache *shared) :
 		qk_(),
 		qv_(NULL),
 		cacheable_(false),
+		fromShared_(false),
 		rangen_(0),
 		eltsn_(0),
 		current_(current),
 		local_(local),
-		shared_(shared)
+		shared_(shared),
+		satups_(CA_CAT),
+		ranges_(CA_CAT)
 	{
 		assert(current_ != NULL);
 	}
@@ -748,6 +851,38 @@ public:
 		return 0; // Need to search for it
 	}
 	ASSERT_ONLY(BTDnaString tmpdnastr_);
+
+	/**
+	 * Called after beginAlign() returns 0.  If the shared cache has the
+	 * results of searching for the same sequence, add them to the
+	 * current-read cache as though the search had just found them.
+	 *
+	 * Returns:
+	 *  -1 if out of memory
+	 *  0 if the sequence isn't in the shared cache
+	 *  1 if the results were copied; the caller can go straight to
+	 *    finishAlign()
+	 */
+	int copyFromShared() {
+		assert(aligning());
+		const SharedSeedCache::Range *ranges = NULL;
+		size_t nranges = 0;
+		if(shared_ == NULL || !qk_.cacheable() ||
+		   !shared_->query(qk_, ranges, nranges))
+		{
+			return 0;
+		}
+		for(size_t i = 0; i < nranges; i++) {
+			const SharedSeedCache::Range& r = ranges[i];
+			if(!current_->addOnTheFly(*qv_, r.key, r.topf, r.botf, r.topb, r.botb)) {
+				return -1;
+			}
+			rangen_++;
+			eltsn_ += (r.botf - r.topf);
+		}
+		fromShared_ = true;
+		return 1;
+	}
 	
 	/**
 	 * Called when is finished aligning a read (and so is finished
@@ -765,6 +900,9 @@ public:
 		// Copy this pointer because we're about to reset the qv_ field
 		// to NULL
 		QVal* qv = qv_;
+		if(shared_ != NULL && qk_.cacheable() && !fromShared_) {
+			publishShared();
+		}
 		// Commit the contents of the current-read cache to the next
 		// cache up in the hierarchy.
 		// If qk is cacheable, then it must be in the cache
@@ -813,12 +951,12 @@ public:
 	}
 	
 	/**
-	 * Clears both the local and shared caches.
+	 * Clears the current-read and local caches.  The shared cache is never
+	 * cleared.
 	 */
 	void clear() {
 		if(current_ != NULL) current_->clear();
 		if(local_   != NULL) local_->clear();
-		if(shared_  != NULL) shared_->clear();
 	}
 	
 	/**
@@ -900,21 +1038,47 @@ protected:
 	 */
 	void resetRead() {
 		cacheable_ = false;
+		fromShared_ = false;
 		rangen_ = eltsn_ = 0;
 		qv_ = NULL;
 	}
 
+	/**
+	 * Add the results of the search that just finished to the shared
+	 * cache, so other reads (on any thread) can skip that search.
+	 */
+	void publishShared() {
+		size_t nrange = 0, nelt = 0;
+		satups_.clear();
+		current_->queryQval(*qv_, satups_, nrange, nelt);
+		ranges_.resize(satups_.size());
+		for(size_t i = 0; i < satups_.size(); i++) {
+			const SATuple& sat = satups_[i];
+			SharedSeedCache::Range& r = ranges_[i];
+			r.key  = sat.key;
+			r.topf = sat.topf;
+			r.botf = (TIndexOffU)(sat.topf + sat.size());
+			r.topb = sat.topb;
+			r.botb = (TIndexOffU)(sat.topb + sat.size());
+		}
+		shared_->add(qk_, ranges_);
+	}
+
 	QKey qk_;  // key representation for current read substring
 	QVal *qv_; // pointer to value representation for current read substring
 	QVal qvbuf_; // buffer for when key is uncacheable but we need a qv
 	bool cacheable_; // true iff the read substring currently being aligned is cacheable
+	bool fromShared_; // true iff the results came from the shared cache
 	
 	size_t rangen_; // number of ranges since last alignment job began
 	size_t eltsn_;  // number of elements since last alignment job began
 
-	AlignmentCache *current_; // cache dedicated to the current read
-	AlignmentCache *local_;   // local, unsynchronized cache
-	AlignmentCache *shared_;  // shared, synchronized cache
+	AlignmentCache  *current_; // cache dedicated to the current read
+	AlignmentCache  *local_;   // local, unsynchronized cache
+	SharedSeedCache *shared_;  // cache shared by all threads
+
+	EList<SATuple>                 satups_; // results being published
+	EList<SharedSeedCache::Range>  ranges_; // results being published
 };
 
 #endif /*ALIGNER_CACHE_H_*/
@@ -798,6 +798,41 @@ void StackedAln::writeCigar(
 	}
 }
 
+/**
+ * Append the CIGAR in BAM's binary encoding to the given string: one
+ * little-endian 32-bit word per operation, holding the run length shifted
+ * left by 4 bits OR'ed with the operation's index in "MIDNSHP=X".  Return
+ * the number of operations written and set 'reflen' to the number of
+ * reference characters spanned.
+ */
+size_t StackedAln::writeBamCigar(BTString& o, size_t& reflen) const {
+	static const char *ops = "MIDNSHP=X";
+	const EList<char>& op = cigOp_;
+	const EList<size_t>& run = cigRun_;
+	assert_eq(op.size(), run.size());
+	size_t nops = 0;
+	reflen = 0;
+	for(size_t i = 0; i < op.size(); i++) {
+		size_t r = run[i];
+		if(r == 0) {
+			continue;
+		}
+		const char *p = strchr(ops, op[i]);
+		assert(p != NULL);
+		uint32_t w = (uint32_t)(r << 4) | (uint32_t)(p - ops);
+		for(int j = 0; j < 4; j++) {
+			o.append((char)(w >> (8 * j)));
+		}
+		if(op[i] == 'M' || op[i] == 'D' || op[i] == 'N' ||
+		   op[i] == '=' || op[i] == 'X')
+		{
+			reflen += r;
+		}
+		nops++;
+	}
+	return nops;
+}
+
 /**
  * Write an MD:Z representation of the alignment to the given string and/or
  * char buffer.
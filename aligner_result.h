@@ -716,6 +716,13 @@ public:
 	 * char buffer.
 	 */
 	void writeCigar(BTString* o, char* oc) const;
+
+	/**
+	 * Append the CIGAR in BAM's binary encoding to the given string.
+	 * Return the number of operations written and set 'reflen' to the
+	 * number of reference characters spanned.
+	 */
+	size_t writeBamCigar(BTString& o, size_t& reflen) const;
 	
 	/**
 	 * Write an MD:Z representation of the alignment to the given string and/or
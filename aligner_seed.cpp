@@ -489,12 +489,29 @@ void SeedAligner::searchAllSeeds(
 	ca_ = &cache;
 	bwops_ = bwedits_ = 0;
 	uint64_t possearches = 0, seedsearches = 0, intrahits = 0, interhits = 0, ooms = 0;
+	// Each seed's search is a chain of dependent cache misses.  Get the
+	// ftab entries for all of them on their way now, and fetch each seed's
+	// first sides while the seed before it is being searched.
+	for(int i = 0; i < (int)sr.numOffs(); i++) {
+		for(int fwi = 0; fwi < 2; fwi++) {
+			bool fw = (fwi == 0);
+			prefetchSeeds(sr.instantiatedSeeds(fw, i), sr.seqs(fw)[i], false);
+		}
+	}
+	if(sr.numOffs() > 0) {
+		prefetchSeeds(sr.instantiatedSeeds(true, 0), sr.seqs(true)[0], true);
+	}
 	// For each instantiated seed
 	for(int i = 0; i < (int)sr.numOffs(); i++) {
 		size_t off = sr.idx2off(i);
 		for(int fwi = 0; fwi < 2; fwi++) {
 			bool fw = (fwi == 0);
 			assert(sr.repOk(&cache.current()));
+			int nexti = fw ? i : i+1;
+			if(nexti < (int)sr.numOffs()) {
+				prefetchSeeds(
+					sr.instantiatedSeeds(!fw, nexti), sr.seqs(!fw)[nexti], true);
+			}
 			EList<InstantiatedSeed>& iss = sr.instantiatedSeeds(fw, i);
 			if(iss.empty()) {
 				// Cache hit in an across-read cache
@@ -515,6 +532,15 @@ void SeedAligner::searchAllSeeds(
 				continue;
 			}
 			bool abort = false;
+			if(ret == 0) {
+				// Another read, maybe on another thread, may already have
+				// searched for this seed
+				ret = cache.copyFromShared();
+				if(ret == -1) {
+					ooms++;
+					continue;
+				}
+			}
 			if(ret == 0) {
 				// Not already in cache
 				assert(cache.aligning());
@@ -541,8 +567,14 @@ void SeedAligner::searchAllSeeds(
 			} else {
 				// Already in cache
 				assert_eq(1, ret);
+				if(cache.aligning()) {
+					// Copied from the shared cache
+					qv = cache.finishAlign();
+					interhits++;
+				} else {
+					intrahits++;
+				}
 				assert(qv.valid());
-				intrahits++;
 			}
 			assert(abort || !cache.aligning());
 			if(qv.valid()) {
@@ -575,6 +607,60 @@ void SeedAligner::searchAllSeeds(
 	met.bweds += bwedits_;
 }
 
+/**
+ * Mirror the ftab jump that begins searchSeedBi(), without searching.
+ */
+void SeedAligner::prefetchSeeds(
+	const EList<InstantiatedSeed>& iss, // instantiated seeds
+	const BTDnaString& seq,             // seed sequence
+	bool sides)                         // sides rather than ftab entries
+{
+	const int ftabLen = ebwtFw_->eh().ftabChars();
+	for(size_t j = 0; j < iss.size(); j++) {
+		const InstantiatedSeed& s = iss[j];
+		if(ftabLen <= 1 || ftabLen > s.maxjump ||
+		   (int)s.steps.size() <= ftabLen)
+		{
+			continue;
+		}
+		int off = s.steps[0];
+		if(off < 0) {
+			off = -off - ftabLen;
+		} else {
+			off--;
+		}
+		// The first step after the jump goes left to right using BWT', or
+		// right to left using BWT
+		bool ltr = s.steps[ftabLen] > 0;
+		if(ltr && ebwtBw_ == NULL) {
+			continue;
+		}
+		if(!sides) {
+			ebwtFw_->prefetchFtab(seq, off, false);
+			if(ebwtBw_ != NULL) {
+				ebwtBw_->prefetchFtab(seq, off, false);
+			}
+			continue;
+		}
+		TIndexOffU top = 0, bot = 0;
+		if(!ebwtFw_->ftabLoHi(seq, off, false, top, bot) || bot <= top) {
+			continue;
+		}
+		const Ebwt& ebwt = ltr ? *ebwtBw_ : *ebwtFw_;
+		if(ltr) {
+			TIndexOffU topb = ebwtBw_->ftabHi(seq, off);
+			bot = topb + (bot - top);
+			top = topb;
+		}
+		SideLocus tloc, bloc;
+		INIT_LOCS(top, bot, tloc, bloc, ebwt);
+		tloc.prefetch(ebwt.ebwt(), ebwt.eh().sideSz());
+		if(bloc.valid()) {
+			bloc.prefetch(ebwt.ebwt(), ebwt.eh().sideSz());
+		}
+	}
+}
+
 bool SeedAligner::sanityPartial(
 	const Ebwt*        ebwtFw, // BWT index
 	const Ebwt*        ebwtBw, // BWT' index
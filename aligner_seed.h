@@ -850,7 +850,9 @@ public:
 		if(tmpMedian_.empty()) {
 			return 0.0f;
 		}
-		median.sort();
+		// Equal counts are interchangeable, so an unstable sort (which
+		// needs no scratch buffer) gives the same answer
+		std::sort(median.ptr(), median.ptr() + median.size());
 		float med1 = (float)median[tmpMedian_.size() >> 1];
 		float med2 = med1;
 		if((median.size() & 1) == 0) {
@@ -1568,6 +1570,17 @@ protected:
 		uint16_t len,          // length of hit
 		DoublyLinkedList<Edit> *prevEdit);  // previous edit
 	
+	/**
+	 * Start fetching what searchSeedBi() will touch first when it searches
+	 * the given instantiated seeds of 'seq': the ftab entries if 'sides' is
+	 * false, or the sides of the first LF step after the ftab jump if it's
+	 * true, which requires the ftab entries.
+	 */
+	void prefetchSeeds(
+		const EList<InstantiatedSeed>& iss, // instantiated seeds
+		const BTDnaString& seq,             // seed sequence
+		bool sides);                        // sides rather than ftab entries
+
 	/**
 	 * Given an instantiated seed (in s_ and other fields), search
 	 */
@@ -28,6 +28,8 @@
 #include "scoring.h"
 #include "mask.h"
 
+bool SwAligner::editFilter_ = false;
+
 /**
  * Initialize with a new read.
  */
@@ -52,6 +54,8 @@ void SwAligner::initRead(
 	nceil_   = nceil;      // max # Ns allowed in ref portion of aln
 	readSse16_ = false;    // true -> sse16 from now on for this read
 	initedRead_ = true;
+	bpfw_.reset();         // edit distance filters are built on demand
+	bprc_.reset();
 #ifndef NO_SSE
 	sseU8fwBuilt_  = false;  // built fw query profile, 8-bit score
 	sseU8rcBuilt_  = false;  // built rc query profile, 8-bit score
@@ -491,12 +495,58 @@ int SwAligner::ungappedAlign(
 	return 1;
 }
 
+// The edit filter costs a fraction of a fill, so it only pays when it
+// rejects a fair share of the fills it screens.  After screening
+// EF_PROBE_FILLS fills, an aligner that rejected fewer than 1 in
+// EF_MIN_REJECT of them lets the next EF_SKIP_FILLS fills through
+// unscreened, then probes again.
+static const uint32_t EF_PROBE_FILLS = 256;
+static const uint32_t EF_MIN_REJECT  = 8;
+static const uint32_t EF_SKIP_FILLS  = 8192;
+
+/**
+ * Each mismatch or gap position costs at least some minimum penalty, so an
+ * end-to-end alignment scoring minsc_ or better has at most
+ * -minsc_ / (that penalty) edits.  If the read can't be fit anywhere in the
+ * rectangle with that many, the fill can't find a valid alignment.
+ */
+bool SwAligner::editFilterRejects() {
+	if(!editFilter_ || !sc_->monotone || minsc_ > 0) {
+		return false;
+	}
+	if(efSkip_ > 0) {
+		efSkip_--;
+		return false;
+	}
+	BitParallelFilter& bp = fw_ ? bpfw_ : bprc_;
+	if(!bp.inited()) {
+		bp.init(*rd_, *qu_, rdi_, rdf_, *sc_);
+	}
+	if(!bp.usable()) {
+		return false;
+	}
+	bool rejected = !bp.within(
+		rf_ + rfi_, (size_t)(rff_ - rfi_), bp.maxEdits(minsc_));
+	efScreened_++;
+	if(rejected) {
+		efRejected_++;
+	}
+	if(efScreened_ == EF_PROBE_FILLS) {
+		if(efRejected_ * EF_MIN_REJECT < EF_PROBE_FILLS) {
+			efSkip_ = EF_SKIP_FILLS;
+		}
+		efScreened_ = efRejected_ = 0;
+	}
+	return rejected;
+}
+
 /**
  * Align read 'rd' to reference using read & reference information given
  * last time init() was called.
  */
 bool SwAligner::align(
-	TAlScore& best)    // best alignment score observed in DP matrix
+	TAlScore& best,    // best alignment score observed in DP matrix
+	Arena* arena)      // scratch memory for the read, or NULL
 {
 	assert(initedRef() && initedRead());
 	assert_eq(STATE_INITED, state_);
@@ -511,6 +561,16 @@ bool SwAligner::align(
 	size_t rdlen = rdf_ - rdi_;
 	bool checkpointed = rdlen >= cperMinlen_;
 	bool gathered = false; // Did gathering happen along with alignment?
+	bool rejected = editFilterRejects();
+#ifdef NDEBUG
+	if(rejected) {
+		cural_ = 0;
+		if(dpLog_ != NULL) {
+			(*dpLog_) << ",0,0";
+		}
+		return false;
+	}
+#endif
 	if(sc_->monotone) {
 		// End-to-end
 		if(enable8_ && !readSse16_ && minsc_ >= -254) {
@@ -675,6 +735,8 @@ bool SwAligner::align(
 	}
 #endif
 	assert(repOk());
+	// In debug mode we filled the rectangle anyway; check the filter
+	assert(!rejected || best == MIN_I64 || best < minsc_);
 	cural_ = 0;
 	if(best == MIN_I64 || best < minsc_) {
 		if(dpLog_ != NULL) {
@@ -718,7 +780,7 @@ bool SwAligner::align(
 		}
 	}
 	if(!btncand_.empty()) {
-		btncand_.sort();
+		btncand_.sort(arena);
 	}
 	if(dpLog_ != NULL) {
 		(*dpLog_) << ",1," << best;
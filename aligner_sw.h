@@ -83,6 +83,7 @@
 #include "dp_framer.h"
 #include "aligner_swsse.h"
 #include "aligner_bt.h"
+#include "aligner_bitpar.h"
 
 #define QUAL2(d, f) sc_->mm((int)(*rd_)[rdi_ + d], \
 							(int)  rf_ [rfi_ + f], \
@@ -209,6 +210,9 @@ public:
 		sseU8rc_(DP_CAT),
 		sseI16fw_(DP_CAT),
 		sseI16rc_(DP_CAT),
+		efScreened_(0),
+		efRejected_(0),
+		efSkip_(0),
 		state_(STATE_UNINIT),
 		initedRead_(false),
 		readSse16_(false),
@@ -321,9 +325,10 @@ public:
 
 	/**
 	 * Align read 'rd' to reference using read & reference information given
-	 * last time init() was called.  Uses dynamic programming.
+	 * last time init() was called.  Uses dynamic programming.  Scratch
+	 * memory for sorting backtrace candidates comes from 'arena' if given.
 	 */
-	bool align(TAlScore& best);
+	bool align(TAlScore& best, Arena* arena = NULL);
 	
 	/**
 	 * Populate the given SwResult with information about the "next best"
@@ -432,6 +437,12 @@ public:
 		return dpRows() * (rff_ - rfi_);
 	}
 
+	/**
+	 * Turn on or off the bit-parallel edit distance filter that lets
+	 * align() skip hopeless end-to-end fills.  Call once at startup.
+	 */
+	static void initEditFilter(bool enable) { editFilter_ = enable; }
+
 protected:
 	
 	/**
@@ -442,6 +453,13 @@ protected:
 		return rdf_ - rdi_;
 	}
 
+	/**
+	 * Return true iff the edit distance filter shows that no end-to-end
+	 * alignment in the current rectangle can score minsc_ or better.  Stops
+	 * screening for a while when it rarely rejects anything.
+	 */
+	bool editFilterRejects();
+
 	/**
 	 * Align nucleotides from read 'rd' to the reference string 'rf' using
 	 * vector instructions.  Return the score of the best alignment found, or
@@ -609,6 +627,11 @@ protected:
 	bool                sseU8rcBuilt_;   // built rc query profile, 8-bit score
 	bool                sseI16fwBuilt_;  // built fw query profile, 16-bit score
 	bool                sseI16rcBuilt_;  // built rc query profile, 16-bit score
+	BitParallelFilter   bpfw_;           // edit distance filter for fw read
+	BitParallelFilter   bprc_;           // edit distance filter for rc read
+	uint32_t            efScreened_;     // fills the edit filter screened lately
+	uint32_t            efRejected_;     // ... and how many it rejected
+	uint32_t            efSkip_;         // # fills to let through unscreened
 
 	SSEMetrics			sseU8ExtendMet_;
 	SSEMetrics			sseU8MateMet_;
@@ -638,6 +661,8 @@ protected:
 	bool                 cperEf_;      // store E and F in addition to H?
 	bool                 cperTri_;     // checkpoint for triangular mini-fills?
 	
+	static bool         editFilter_;   // skip fills the edit filter rejects?
+
 	size_t              colstop_;      // bailed on DP loop after this many cols
 	size_t              lastsolcol_;   // last DP col with valid cell
 	size_t              cural_;        // index of next alignment to be given
@@ -503,6 +503,7 @@ void SwDriver::prioritizeSATups(
 	RandomSource& rnd,           // pseudo-random generator
 	WalkMetrics& wlm,            // group walk left metrics
 	PerReadMetrics& prm,         // per-read metrics
+	Arena& arena,                // scratch memory for the read
 	size_t& nelt_out,            // out: # elements total
 	bool all)                    // report all hits?
 {
@@ -606,7 +607,7 @@ void SwDriver::prioritizeSATups(
 	assert_leq(nsmall, nrange);
 	nelt_out = nelt; // return the total number of elements
 	assert_eq(nrange, satpos.size());
-	satpos.sort();
+	satpos.sort(&arena);
 	if(keepWhole) {
 		gws_.ensure(nrange);
 		rands_.ensure(nrange);
@@ -868,6 +869,7 @@ int SwDriver::extendSeeds(
 					rnd,           // pseudo-random generator
 					wlm,           // group walk left metrics
 					prm,           // per-read metrics
+					msink->arena(), // scratch memory for the read
 					nelt,          // out: # elements total
 					all);          // report all hits?
 				assert_eq(gws_.size(), rands_.size());
@@ -1134,7 +1136,7 @@ int SwDriver::extendSeeds(
 					// Now fill the dynamic programming matrix and return true iff
 					// there is at least one valid alignment
 					TAlScore bestCell = std::numeric_limits<TAlScore>::min();
-					found = swa.align(bestCell);
+					found = swa.align(bestCell, &msink->arena());
 					swmSeed.tallyGappedDp(readGaps, refGaps);
 					prm.nExDps++;
 					if(!found) {
@@ -1553,6 +1555,7 @@ int SwDriver::extendSeedsPaired(
 					rnd,           // pseudo-random generator
 					wlm,           // group walk left metrics
 					prm,           // per-read metrics
+					msink->arena(), // scratch memory for the read
 					nelt,          // out: # elements total
 					all);          // report all hits?
 				assert_eq(gws_.size(), rands_.size());
@@ -1826,7 +1829,7 @@ int SwDriver::extendSeedsPaired(
 					// Now fill the dynamic programming matrix and return true iff
 					// there is at least one valid alignment
 					TAlScore bestCell = std::numeric_limits<TAlScore>::min();
-					found = swa.align(bestCell);
+					found = swa.align(bestCell, &msink->arena());
 					swmSeed.tallyGappedDp(readGaps, refGaps);
 					prm.nExDps++;
 					prm.nDpFail++;    // failed until proven successful
@@ -2071,7 +2074,7 @@ int SwDriver::extendSeedsPaired(
 							// Now fill the dynamic programming matrix, return true
 							// iff there is at least one valid alignment
 							TAlScore bestCell = std::numeric_limits<TAlScore>::min();
-							foundMate = oswa.align(bestCell);
+							foundMate = oswa.align(bestCell, &msink->arena());
 							prm.nMateDps++;
 							swmMate.tallyGappedDp(oreadGaps, orefGaps);
 							if(!foundMate) {
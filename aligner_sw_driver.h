@@ -485,6 +485,7 @@ protected:
 		RandomSource& rnd,           // pseudo-random generator
 		WalkMetrics& wlm,            // group walk left metrics
 		PerReadMetrics& prm,         // per-read metrics
+		Arena& arena,                // scratch memory for the read
 		size_t& nelt_out,            // out: # elements total
 		bool all);                   // report all hits?
 
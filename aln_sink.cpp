@@ -527,6 +527,118 @@ void AlnSink::printAlSumm(
 	cerr << " overall alignment rate" << endl;
 }
 
+/**
+ * Qualities matter only through the mismatch penalty, N penalty and match
+ * bonus they imply, so give each distinct combination of those a bucket.
+ */
+DupReadCache::DupReadCache(size_t nslots, const Scoring& sc) : hash_(0) {
+	assert_gt(nslots, 0);
+	ents_.resize(nslots);
+	for(size_t i = 0; i < nslots; i++) {
+		ents_[i].valid = false;
+	}
+	int nbuck = 0;
+	for(int c = 0; c < 256; c++) {
+		int q = max(c - 33, 0);
+		qbuck_[c] = (char)nbuck;
+		if(!sc.qualitiesMatter()) {
+			continue;
+		}
+		for(int d = 0; d < c; d++) {
+			int qd = max(d - 33, 0);
+			if(sc.mmpens[qd] == sc.mmpens[q] &&
+			   sc.npens[qd] == sc.npens[q] &&
+			   sc.matchBonuses[qd] == sc.matchBonuses[q])
+			{
+				qbuck_[c] = qbuck_[d];
+				break;
+			}
+		}
+		if(qbuck_[c] == (char)nbuck) {
+			nbuck++;
+		}
+	}
+}
+
+/**
+ * Mate's length, then its sequence, then its quality buckets, then its
+ * filter flag.
+ */
+void DupReadCache::appendKey(const Read& rd) {
+	const size_t len = rd.patFw.length();
+	for(size_t i = 0; i < sizeof(uint32_t); i++) {
+		key_.append((char)(len >> (i * 8)));
+	}
+	for(size_t i = 0; i < len; i++) {
+		key_.append((char)rd.patFw[i]);
+	}
+	for(size_t i = 0; i < len; i++) {
+		key_.append(qbuck_[(unsigned char)rd.qual[i]]);
+	}
+	key_.append(rd.filter);
+}
+
+bool DupReadCache::find(
+	const Read* rd1,           // mate #1
+	const Read* rd2,           // mate #2
+	const EList<AlnRes>*& rs1, // paired alignments for mate #1
+	const EList<AlnRes>*& rs2, // paired alignments for mate #2
+	const EList<AlnRes>*& rs1u,// unpaired alignments for mate #1
+	const EList<AlnRes>*& rs2u,// unpaired alignments for mate #2
+	const EList<char>*& order, // order in which alignments were reported
+	bool& exhaust1,            // mate 1 exhausted?
+	bool& exhaust2)            // mate 2 exhausted?
+{
+	key_.clear();
+	key_.append(rd1 != NULL ? '1' : '-');
+	key_.append(rd2 != NULL ? '2' : '-');
+	if(rd1 != NULL) appendKey(*rd1);
+	if(rd2 != NULL) appendKey(*rd2);
+	// FNV-1a
+	hash_ = 14695981039346656037llu;
+	for(size_t i = 0; i < key_.length(); i++) {
+		hash_ ^= (unsigned char)key_[i];
+		hash_ *= 1099511628211llu;
+	}
+	const Entry& e = ents_[(size_t)(hash_ % ents_.size())];
+	if(!e.valid || e.hash != hash_ || e.key.length() != key_.length() ||
+	   memcmp(e.key.buf(), key_.buf(), key_.length()) != 0)
+	{
+		return false;
+	}
+	rs1 = &e.rs1;
+	rs2 = &e.rs2;
+	rs1u = &e.rs1u;
+	rs2u = &e.rs2u;
+	order = &e.order;
+	exhaust1 = e.exhaust1;
+	exhaust2 = e.exhaust2;
+	return true;
+}
+
+void DupReadCache::add(
+	const EList<AlnRes>& rs1,
+	const EList<AlnRes>& rs2,
+	const EList<AlnRes>& rs1u,
+	const EList<AlnRes>& rs2u,
+	const EList<char>& order,
+	bool exhaust1,
+	bool exhaust2)
+{
+	assert(!key_.empty());
+	Entry& e = ents_[(size_t)(hash_ % ents_.size())];
+	e.valid = true;
+	e.hash = hash_;
+	e.key = key_;
+	e.rs1 = rs1;
+	e.rs2 = rs2;
+	e.rs1u = rs1u;
+	e.rs2u = rs2u;
+	e.order = order;
+	e.exhaust1 = exhaust1;
+	e.exhaust2 = exhaust2;
+}
+
 /**
  * Return true iff the read in rd1/rd2 matches the last read handled, which
  * should still be in rd1_/rd2_.
@@ -613,6 +725,31 @@ int AlnSinkWrap::nextRead(
 	st_.nextRead(readIsPair()); // reset state
 	assert(empty());
 	assert(!maxed());
+	replayed_ = false;
+	order_.clear();
+	if(dcache_ != NULL) {
+		const EList<AlnRes> *rs1 = NULL, *rs2 = NULL, *rs1u = NULL, *rs2u = NULL;
+		const EList<char> *order = NULL;
+		if(dcache_->find(
+			rd1, rd2, rs1, rs2, rs1u, rs2u, order, cexhaust1_, cexhaust2_))
+		{
+			// Seen this read recently; report the same alignments in the
+			// same order so that st_ ends up where it did then
+			size_t ip = 0, i1 = 0, i2 = 0;
+			for(size_t i = 0; i < order->size(); i++) {
+				if((*order)[i] == 'c') {
+					report(0, &(*rs1)[ip], &(*rs2)[ip]);
+					ip++;
+				} else if((*order)[i] == '1') {
+					report(0, &(*rs1u)[i1++], NULL);
+				} else {
+					report(0, NULL, &(*rs2u)[i2++]);
+				}
+			}
+			replayed_ = true;
+			return -1;
+		}
+	}
 	// Start from the first stage
 	return 0;
 }
@@ -660,9 +797,20 @@ void AlnSinkWrap::finishRead(
 	bool suppressSeedSummary,       // = true
 	bool suppressAlignments)        // = false
 {
+	// Scratch memory from aligning the read is no longer needed
+	arena_.reset();
 	obuf_.clear();
 	OutputQueueMark qqm(g_.outq(), obuf_, rdid_, threadid_);
 	assert(init_);
+	if(dcache_ != NULL) {
+		if(replayed_) {
+			exhaust1 = cexhaust1_;
+			exhaust2 = cexhaust2_;
+		} else if(!suppressAlignments) {
+			// Remember alignments before reporting rearranges them
+			dcache_->add(rs1_, rs2_, rs1u_, rs2u_, order_, exhaust1, exhaust2);
+		}
+	}
 	if(!suppressSeedSummary) {
 		if(sr1 != NULL) {
 			assert(rd1_ != NULL);
@@ -709,6 +857,12 @@ void AlnSinkWrap::finishRead(
 		} else {
 			met.nunpaired++;
 		}
+		if(g_.readOutFiles() != NULL) {
+			copyToReadFiles(
+				true,
+				nconcord > 0,
+				rd1_ != NULL ? nunpair1 > 0 : nunpair2 > 0);
+		}
 		// Report concordant paired-end alignments if possible
 		if(nconcord > 0) {
 			AlnSetSumm concordSumm(
@@ -1214,11 +1368,112 @@ void AlnSinkWrap::finishRead(
 				sc,      // scoring scheme
 				true);   // get lock?
 		}
+	} else if(g_.readOutFiles() != NULL) {
+		copyToReadFiles(false, false, false);
 	} // if(suppress alignments)
 	init_ = false;
 	return;
 }
 
+/**
+ * Called by the aligner for a read it won't align at all (e.g. one left
+ * out by --sample).  If output is being reordered, hand empty records for
+ * the read to the output queues so that later reads aren't held up
+ * waiting for it.
+ */
+void AlnSinkWrap::skipRead(TReadId rdid) {
+	if(!g_.outq().reorder()) {
+		return;
+	}
+	obuf_.clear();
+	{
+		OutputQueueMark qqm(g_.outq(), obuf_, rdid, threadid_);
+	}
+	ReadOutFiles *rdout = g_.readOutFiles();
+	if(rdout != NULL && rdout->reorder()) {
+		for(int i = 0; i < RDOUT_NFILES; i++) {
+			if(rdout->active(i)) {
+				rdbuf_[i].clear();
+				rdout->finishRead(i, rdbuf_[i], rdid, threadid_);
+			}
+		}
+	}
+}
+
+/**
+ * Copy the current read into the --un/--al/--un-conc/--al-conc files
+ * according to whether it aligned.  Records accumulate in per-thread
+ * buffers that are appended to the shared files in large chunks.  If the
+ * files must be kept in input order, each read's records are instead
+ * handed to the files' OutputQueues right away, including empty records
+ * for files the read doesn't go to.
+ */
+void AlnSinkWrap::copyToReadFiles(bool report, bool concord, bool aligned) {
+	ReadOutFiles *rdout = g_.readOutFiles();
+	assert(rdout != NULL);
+	if(report) {
+		if(readIsPair()) {
+			appendOrig(concord ? RDOUT_AL_CONC1 : RDOUT_UN_CONC1, *rd1_);
+			appendOrig(concord ? RDOUT_AL_CONC2 : RDOUT_UN_CONC2, *rd2_);
+		} else {
+			appendOrig(aligned ? RDOUT_AL : RDOUT_UN, rd1_ != NULL ? *rd1_ : *rd2_);
+		}
+	}
+	for(int i = 0; i < RDOUT_NFILES; i++) {
+		if(!rdout->active(i)) {
+			continue;
+		}
+		if(rdout->reorder()) {
+			rdout->finishRead(i, rdbuf_[i], rdid_, threadid_);
+			rdbuf_[i].clear();
+		} else if(rdbuf_[i].length() >= RDOUT_FLUSH_SZ) {
+			rdout->write(i, rdbuf_[i]);
+			rdbuf_[i].clear();
+		}
+	}
+}
+
+/**
+ * Open file 'which' with the given name, compressing its contents in the
+ * given format.
+ */
+void ReadOutFiles::open(int which, const string& fn, int fmt) {
+	assert_lt(which, RDOUT_NFILES);
+	assert(files_[which] == NULL);
+	names_[which] = fn;
+	files_[which] = new OutFileBuf(names_[which].c_str());
+	files_[which]->setCompression(fmt);
+	if(reorder_) {
+		queues_[which] = new OutputQueue(
+			*files_[which],
+			true,         // reorder
+			nthreads_,
+			nthreads_ > 1, // thread safe
+			rdid_,
+			false,         // no BGZF
+			batchsz_);
+	}
+}
+
+/**
+ * Flush any records still waiting to be put in order, then close all the
+ * files.
+ */
+void ReadOutFiles::close() {
+	for(int i = 0; i < RDOUT_NFILES; i++) {
+		if(queues_[i] != NULL) {
+			queues_[i]->flush(true);
+			delete queues_[i];
+			queues_[i] = NULL;
+		}
+		if(files_[i] != NULL) {
+			files_[i]->close();
+			delete files_[i];
+			files_[i] = NULL;
+		}
+	}
+}
+
 /**
  * Called by the aligner when a new unpaired or paired alignment is
  * discovered in the given stage.  This function checks whether the
@@ -1243,6 +1498,9 @@ bool AlnSinkWrap::report(
 	bool one = (rs1 != NULL);
 	const AlnRes* rsa = one ? rs1 : rs2;
 	const AlnRes* rsb = one ? rs2 : rs1;
+	if(dcache_ != NULL) {
+		order_.push_back(paired ? 'c' : (one ? '1' : '2'));
+	}
 	if(paired) {
 		assert(readIsPair());
 		st_.foundConcordant();
@@ -1355,7 +1613,8 @@ size_t AlnSinkWrap::selectByScore(
 		}
 		buf[i].second = i; // original offset
 	}
-	buf.sort(); buf.reverse(); // sort in descending order by score
+	buf.sort(&arena_);
+	buf.reverse(); // sort in descending order by score
 	
 	// Randomize streaks of alignments that are equal by score
 	size_t streak = 0;
@@ -1660,6 +1919,46 @@ void AlnSink::appendSeedSummary(
 	o.append('\n');
 }
 
+/**
+ * Return the SAM FLAG field for an alignment of a mate, or for a mate that
+ * failed to align if rs is NULL.
+ */
+int AlnSinkSam::samFlag(
+	const AlnFlags& flags,
+	const AlnRes* rs,
+	const AlnRes* rso)
+{
+	int fl = 0;
+	if(flags.partOfPair()) {
+		fl |= SAM_FLAG_PAIRED;
+		if(flags.alignedConcordant()) {
+			fl |= SAM_FLAG_MAPPED_PAIRED;
+ 		}
+		if(!flags.mateAligned()) {
+			// Other fragment is unmapped
+			fl |= SAM_FLAG_MATE_UNMAPPED;
+		}
+		fl |= (flags.readMate1() ?
+			SAM_FLAG_FIRST_IN_PAIR : SAM_FLAG_SECOND_IN_PAIR);
+		if(flags.mateAligned() && rso != NULL) {
+			if(!rso->fw()) {
+				fl |= SAM_FLAG_MATE_STRAND;
+			}
+		}
+	}
+	if(!flags.isPrimary()) {
+		fl |= SAM_FLAG_NOT_PRIMARY;
+	}
+	if(rs != NULL && !rs->fw()) {
+		fl |= SAM_FLAG_QUERY_STRAND;
+	}
+	if(rs == NULL) {
+		// Failed to align
+		fl |= SAM_FLAG_UNMAPPED;
+	}
+	return fl;
+}
+
 /**
  * Append a single hit to the given output stream in Bowtie's
  * verbose-mode format.
@@ -1695,34 +1994,7 @@ void AlnSinkSam::appendMate(
 	samc_.printReadName(o, rd.name, flags.partOfPair());
 	o.append('\t');
 	// FLAG
-	int fl = 0;
-	if(flags.partOfPair()) {
-		fl |= SAM_FLAG_PAIRED;
-		if(flags.alignedConcordant()) {
-			fl |= SAM_FLAG_MAPPED_PAIRED;
- 		}
-		if(!flags.mateAligned()) {
-			// Other fragment is unmapped
-			fl |= SAM_FLAG_MATE_UNMAPPED;
-		}
-		fl |= (flags.readMate1() ?
-			SAM_FLAG_FIRST_IN_PAIR : SAM_FLAG_SECOND_IN_PAIR);
-		if(flags.mateAligned() && rso != NULL) {
-			if(!rso->fw()) {
-				fl |= SAM_FLAG_MATE_STRAND;
-			}
-		}
-	}
-	if(!flags.isPrimary()) {
-		fl |= SAM_FLAG_NOT_PRIMARY;
-	}
-	if(rs != NULL && !rs->fw()) {
-		fl |= SAM_FLAG_QUERY_STRAND;
-	}
-	if(rs == NULL) {
-		// Failed to align
-		fl |= SAM_FLAG_UNMAPPED;
-	}
+	int fl = samFlag(flags, rs, rso);
 	itoa10<int>(fl, buf);
 	o.append(buf);
 	o.append('\t');
@@ -1892,6 +2164,275 @@ void AlnSinkSam::appendMate(
 	o.append('\n');
 }
 
+/**
+ * Return the BAM bin for a feature spanning [beg, end), following the
+ * UCSC binning scheme given in the SAM specification.
+ */
+static inline int bamReg2Bin(int64_t beg, int64_t end) {
+	--end;
+	if(beg >> 14 == end >> 14) return ((1 << 15) - 1) / 7 + (int)(beg >> 14);
+	if(beg >> 17 == end >> 17) return ((1 << 12) - 1) / 7 + (int)(beg >> 17);
+	if(beg >> 20 == end >> 20) return ((1 <<  9) - 1) / 7 + (int)(beg >> 20);
+	if(beg >> 23 == end >> 23) return ((1 <<  6) - 1) / 7 + (int)(beg >> 23);
+	if(beg >> 26 == end >> 26) return ((1 <<  3) - 1) / 7 + (int)(beg >> 26);
+	return 0;
+}
+
+/**
+ * Append a single BAM record for one mate.  Every field is chosen exactly
+ * as AlnSinkSam::appendMate chooses it for SAM, but written in BAM's
+ * binary layout.
+ */
+void AlnSinkBam::appendMate(
+	BTString&     o,           // append to this string
+	StackedAln&   staln,       // store stacked alignment struct here
+	const Read&   rd,
+	const Read*   rdo,
+	const TReadId rdid,
+	AlnRes* rs,
+	AlnRes* rso,
+	const AlnSetSumm& summ,
+	const SeedAlSumm& ssm,
+	const SeedAlSumm& ssmo,
+	const AlnFlags& flags,
+	const PerReadMetrics& prm,
+	const Mapq& mapqCalc,
+	const Scoring& sc)
+{
+	// Seq codes for A, C, G, T and N in BAM's "=ACMGRSVTWYHKDBN" alphabet
+	static const char bamNuc[] = { 1, 2, 4, 8, 15 };
+	if(rs == NULL && samc_.omitUnalignedReads()) {
+		return;
+	}
+	char mapqInps[1024];
+	if(rs != NULL) {
+		staln.reset();
+		rs->initStacked(rd, staln);
+		staln.leftAlign(false /* not past MMs */);
+	}
+	// The fixed-length part is filled in once the variable-length parts
+	// are written and we know their lengths
+	const size_t start = o.length();
+	o.resize(start + 36);
+	// QNAME
+	samc_.printReadName(o, rd.name, flags.partOfPair());
+	if(o.length() - start - 36 > 254) {
+		o.resize(start + 36 + 254);
+	}
+	o.append('\0');
+	size_t lname = o.length() - start - 36;
+	// RNAME and POS; an unaligned mate takes its opposite's if aligned
+	int32_t refid = -1, pos = -1;
+	if(rs != NULL) {
+		refid = (int32_t)rs->refid();
+		pos = (int32_t)rs->refoff();
+	} else if(summ.orefid() != -1) {
+		assert(flags.partOfPair());
+		refid = (int32_t)summ.orefid();
+		pos = (int32_t)summ.orefoff();
+	}
+	// MAPQ
+	mapqInps[0] = '\0';
+	int mapq = 0;
+	if(rs != NULL) {
+		mapq = (int)mapqCalc.mapq(
+			summ, flags, rd.mate < 2, rd.length(),
+			rdo == NULL ? 0 : rdo->length(), mapqInps);
+	}
+	// CIGAR
+	size_t ncigar = 0, reflen = 0;
+	if(rs != NULL) {
+		staln.buildCigar(false);
+		ncigar = staln.writeBamCigar(o, reflen);
+	}
+	// RNEXT and PNEXT
+	int32_t nrefid = -1, npos = -1;
+	if(rs != NULL && flags.partOfPair()) {
+		nrefid = (int32_t)(rso != NULL ? rso->refid() : rs->refid());
+		npos = (int32_t)(rso != NULL ? rso->refoff() : rs->refoff());
+	} else if(summ.orefid() != -1) {
+		nrefid = refid;
+		npos = (int32_t)summ.orefoff();
+	}
+	// ISIZE
+	int32_t isize = 0;
+	if(rs != NULL && rs->isFraglenSet()) {
+		isize = (int32_t)rs->fragmentLength();
+	}
+	// SEQ and QUAL
+	size_t lseq = 0;
+	if(flags.isPrimary() || !samc_.omitSecondarySeqQual()) {
+		lseq = rd.patFw.length();
+	}
+	if(lseq > 0) {
+		bool fw = (rs == NULL || rs->fw());
+		const BTDnaString& seq = fw ? rd.patFw : rd.patRc;
+		for(size_t i = 0; i < lseq; i += 2) {
+			int c = bamNuc[(int)seq[i]] << 4;
+			if(i + 1 < lseq) {
+				c |= bamNuc[(int)seq[i+1]];
+			}
+			o.append((char)c);
+		}
+		if(rd.qual.length() == 0) {
+			for(size_t i = 0; i < lseq; i++) {
+				o.append((char)0xff);
+			}
+		} else {
+			const BTString& qual = fw ? rd.qual : rd.qualRev;
+			for(size_t i = 0; i < lseq; i++) {
+				o.append((char)(qual[i] - 33));
+			}
+		}
+	}
+	//
+	// Optional fields
+	//
+	BTString opts;
+	if(rs != NULL) {
+		samc_.printAlignedOptFlags(
+			opts,        // output buffer
+			true,        // first opt flag printed is first overall?
+			rd,          // read
+			rdo,         // opposite read
+			*rs,         // individual alignment result
+			staln,       // stacked alignment
+			flags,       // alignment flags
+			summ,        // summary of alignments for this read
+			ssm,         // seed alignment summary
+			prm,         // per-read metrics
+			sc,          // scoring scheme
+			mapqInps);   // inputs to MAPQ calculation
+	} else {
+		samc_.printEmptyOptFlags(
+			opts,        // output buffer
+			true,        // first opt flag printed is first overall?
+			rd,          // read
+			flags,       // alignment flags
+			summ,        // summary of alignments for this read
+			ssm,         // seed alignment summary
+			prm,         // per-read metrics
+			sc);         // scoring scheme
+	}
+	SamConfig::samOptFlagsToBam(o, opts);
+	// Now fill in the fixed-length part
+	int bin = bamReg2Bin(pos, rs != NULL ? pos + (int64_t)reflen : pos + 1);
+	if(pos < 0) {
+		bin = 4680; // reg2bin(-1, 0)
+	}
+	BTString fixed;
+	bamAppend32(fixed, (uint32_t)(o.length() - start - 4)); // block_size
+	bamAppend32(fixed, (uint32_t)refid);
+	bamAppend32(fixed, (uint32_t)pos);
+	fixed.append((char)lname);
+	fixed.append((char)mapq);
+	bamAppend16(fixed, (uint16_t)bin);
+	bamAppend16(fixed, (uint16_t)ncigar);
+	bamAppend16(fixed, (uint16_t)samFlag(flags, rs, rso));
+	bamAppend32(fixed, (uint32_t)lseq);
+	bamAppend32(fixed, (uint32_t)nrefid);
+	bamAppend32(fixed, (uint32_t)npos);
+	bamAppend32(fixed, (uint32_t)isize);
+	assert_eq(36, fixed.length());
+	memcpy(o.wbuf() + start, fixed.buf(), 36);
+}
+
+/**
+ * Collect the fields of a single per-mate record.  The fields are the
+ * ones AlnSinkSam::appendMate prints, except that SEQ, QUAL and QNAME are
+ * left to the caller, who has the read already.
+ */
+void AlnSinkRecords::appendMate(
+	BTString&     o,           // unused
+	StackedAln&   staln,       // store stacked alignment struct here
+	const Read&   rd,
+	const Read*   rdo,
+	const TReadId rdid,
+	AlnRes* rs,
+	AlnRes* rso,
+	const AlnSetSumm& summ,
+	const SeedAlSumm& ssm,
+	const SeedAlSumm& ssmo,
+	const AlnFlags& flags,
+	const PerReadMetrics& prm,
+	const Mapq& mapqCalc,
+	const Scoring& sc)
+{
+	if(rs == NULL && samc_.omitUnalignedReads()) {
+		return;
+	}
+	char mapqInps[1024];
+	AlnRecord rec;
+	rec.rdid = rdid;
+	rec.mate = flags.partOfPair() ? rd.mate : 0;
+	rec.flag = samFlag(flags, rs, rso);
+	// RNAME and POS; an unaligned mate takes its opposite's if aligned
+	rec.refid = rec.pos = -1;
+	if(rs != NULL) {
+		rec.refid = rs->refid();
+		rec.pos = rs->refoff();
+	} else if(summ.orefid() != -1) {
+		assert(flags.partOfPair());
+		rec.refid = summ.orefid();
+		rec.pos = summ.orefoff();
+	}
+	// MAPQ and CIGAR
+	mapqInps[0] = '\0';
+	rec.mapq = 0;
+	if(rs != NULL) {
+		rec.mapq = (int)mapqCalc.mapq(
+			summ, flags, rd.mate < 2, rd.length(),
+			rdo == NULL ? 0 : rdo->length(), mapqInps);
+		staln.reset();
+		rs->initStacked(rd, staln);
+		staln.leftAlign(false /* not past MMs */);
+		staln.buildCigar(false);
+		staln.writeCigar(&rec.cigar, NULL);
+	}
+	// RNEXT and PNEXT
+	rec.nrefid = rec.npos = -1;
+	if(rs != NULL && flags.partOfPair()) {
+		rec.nrefid = (rso != NULL ? rso->refid() : rs->refid());
+		rec.npos = (rso != NULL ? rso->refoff() : rs->refoff());
+	} else if(summ.orefid() != -1) {
+		rec.nrefid = rec.refid;
+		rec.npos = summ.orefoff();
+	}
+	// ISIZE
+	rec.isize = 0;
+	if(rs != NULL && rs->isFraglenSet()) {
+		rec.isize = rs->fragmentLength();
+	}
+	// Optional fields
+	if(rs != NULL) {
+		samc_.printAlignedOptFlags(
+			rec.opts,    // output buffer
+			true,        // first opt flag printed is first overall?
+			rd,          // read
+			rdo,         // opposite read
+			*rs,         // individual alignment result
+			staln,       // stacked alignment
+			flags,       // alignment flags
+			summ,        // summary of alignments for this read
+			ssm,         // seed alignment summary
+			prm,         // per-read metrics
+			sc,          // scoring scheme
+			mapqInps);   // inputs to MAPQ calculation
+	} else {
+		samc_.printEmptyOptFlags(
+			rec.opts,    // output buffer
+			true,        // first opt flag printed is first overall?
+			rd,          // read
+			flags,       // alignment flags
+			summ,        // summary of alignments for this read
+			ssm,         // seed alignment summary
+			prm,         // per-read metrics
+			sc);         // scoring scheme
+	}
+	ThreadSafe ts(&mutex_m);
+	recs_.push_back(rec);
+}
+
 #ifdef ALN_SINK_MAIN
 
 #include <iostream>
@@ -33,7 +33,9 @@
 class SeedResults;
 
 enum {
-	OUTPUT_SAM = 1
+	OUTPUT_SAM = 1,
+	OUTPUT_BAM,
+	OUTPUT_RECORDS // in memory, for bt2_align()
 };
 
 /**
@@ -578,6 +580,120 @@ protected:
 	bool done_;          // done with all alignments
 };
 
+/**
+ * Files that reads can be sorted into according to whether they aligned:
+ * --un, --al, --un-conc and --al-conc.  Paired reads have one file per
+ * mate.
+ */
+enum {
+	RDOUT_UN = 0,   // unpaired reads that failed to align
+	RDOUT_AL,       // unpaired reads that aligned
+	RDOUT_UN_CONC1, // mate 1s of pairs that failed to align concordantly
+	RDOUT_UN_CONC2, // mate 2s of pairs that failed to align concordantly
+	RDOUT_AL_CONC1, // mate 1s of pairs that aligned concordantly
+	RDOUT_AL_CONC2, // mate 2s of pairs that aligned concordantly
+	RDOUT_NFILES
+};
+
+/**
+ * The files that input reads are copied into according to whether they
+ * aligned.  All threads share one OutFileBuf per file.  Ordinarily, each
+ * thread collects records in a buffer of its own and appends the whole
+ * buffer at once under a per-file lock.  When output must follow input
+ * order, each file instead gets an OutputQueue and records are handed
+ * over one read at a time.
+ */
+class ReadOutFiles {
+
+public:
+
+	ReadOutFiles(
+		bool reorder,     // keep records in input order?
+		size_t nthreads,  // # threads writing records
+		TReadId rdid,     // id of first read
+		size_t batchsz) : // # reads a thread claims at once
+		reorder_(reorder),
+		nthreads_(nthreads),
+		rdid_(rdid),
+		batchsz_(batchsz)
+	{
+		for(int i = 0; i < RDOUT_NFILES; i++) {
+			files_[i] = NULL;
+			queues_[i] = NULL;
+		}
+	}
+
+	~ReadOutFiles() { close(); }
+
+	/**
+	 * Open file 'which' with the given name, compressing its contents in
+	 * the given format.
+	 */
+	void open(int which, const std::string& fn, int fmt);
+
+	/**
+	 * Flush and close all open files.
+	 */
+	void close();
+
+	/**
+	 * Return true iff file 'which' is open.
+	 */
+	bool active(int which) const {
+		return files_[which] != NULL;
+	}
+
+	/**
+	 * Return true iff any file is open.
+	 */
+	bool any() const {
+		for(int i = 0; i < RDOUT_NFILES; i++) {
+			if(files_[i] != NULL) return true;
+		}
+		return false;
+	}
+
+	/**
+	 * Return true iff records must be handed over one read at a time with
+	 * finishRead() so that they can be put back in input order.
+	 */
+	bool reorder() const {
+		return reorder_;
+	}
+
+	/**
+	 * Append a buffer of records, in no particular order, to file 'which'.
+	 */
+	void write(int which, const BTString& recs) {
+		assert(active(which));
+		assert(!reorder_);
+		ThreadSafe ts(&locks_[which], nthreads_ > 1);
+		files_[which]->writeString(recs);
+	}
+
+	/**
+	 * Hand over the record, possibly empty, that read 'rdid' contributes
+	 * to file 'which'.
+	 */
+	void finishRead(int which, const BTString& rec, TReadId rdid, size_t threadId) {
+		assert(active(which));
+		assert(reorder_);
+		queues_[which]->beginRead(rdid, threadId);
+		queues_[which]->finishRead(rec, rdid, threadId);
+	}
+
+private:
+
+	bool         reorder_;
+	size_t       nthreads_;
+	TReadId      rdid_;
+	size_t       batchsz_;
+	std::string  names_[RDOUT_NFILES];  // file names
+	OutFileBuf  *files_[RDOUT_NFILES];  // open files, or NULL
+	OutputQueue *queues_[RDOUT_NFILES]; // reordering queues, if reorder_
+	MUTEX_T      locks_[RDOUT_NFILES];  // serialize appends to files_
+};
+
 /**
  * Global hit sink for hits from the MultiSeed aligner.  Encapsulates
  * all aspects of the MultiSeed aligner hitsink that are global to all
@@ -598,10 +714,12 @@ public:
 	explicit AlnSink(
 		OutputQueue& oq,
 		const StrList& refnames,
-		bool quiet) :
+		bool quiet,
+		ReadOutFiles* rdout = NULL) :
 		oq_(oq),
 		refnames_(refnames),
-		quiet_(quiet)
+		quiet_(quiet),
+		rdout_(rdout)
 	{ }
 
 	/**
@@ -865,15 +983,97 @@ public:
 		return oq_;
 	}
 
+	/**
+	 * Return the files reads are copied into according to whether they
+	 * aligned, or NULL if there are none.
+	 */
+	ReadOutFiles* readOutFiles() {
+		return rdout_;
+	}
+
 protected:
 
 	OutputQueue&       oq_;           // output queue
 	int                numWrappers_;  // # threads owning a wrapper for this HitSink
 	const StrList&     refnames_;     // reference names
 	bool               quiet_;        // true -> don't print alignment stats at the end
+	ReadOutFiles*      rdout_;        // --un/--al/--un-conc/--al-conc files
 	ReportingMetrics   met_;          // global repository of reporting metrics
 };
 
+/**
+ * Remembers the alignments reported for recently aligned reads/pairs so that
+ * when an exact duplicate comes along, AlnSinkWrap can replay them instead of
+ * the aligner searching all over again.  Reads are keyed by sequence, by
+ * qualities (mapped to the penalties and bonuses they imply, so qualities
+ * that score alike key alike) and by upstream filter flag, for both mates.
+ *
+ * Each thread's AlnSinkWrap has its own cache, so there's no locking.  The
+ * cache is direct-mapped: a read's key hashes to one slot, and storing a new
+ * read there evicts whatever was there before.
+ */
+class DupReadCache {
+
+public:
+
+	DupReadCache(
+		size_t nslots,         // # reads/pairs to remember
+		const Scoring& sc);    // scoring scheme
+
+	/**
+	 * Build the key for the given read/pair and, if there's an entry for
+	 * it, point the arguments at the entry's contents and return true.
+	 * The key is kept for a subsequent call to add().
+	 */
+	bool find(
+		const Read* rd1,           // mate #1
+		const Read* rd2,           // mate #2
+		const EList<AlnRes>*& rs1, // paired alignments for mate #1
+		const EList<AlnRes>*& rs2, // paired alignments for mate #2
+		const EList<AlnRes>*& rs1u,// unpaired alignments for mate #1
+		const EList<AlnRes>*& rs2u,// unpaired alignments for mate #2
+		const EList<char>*& order, // order in which alignments were reported
+		bool& exhaust1,            // mate 1 exhausted?
+		bool& exhaust2);           // mate 2 exhausted?
+
+	/**
+	 * Store alignments for the read/pair most recently passed to find().
+	 */
+	void add(
+		const EList<AlnRes>& rs1,
+		const EList<AlnRes>& rs2,
+		const EList<AlnRes>& rs1u,
+		const EList<AlnRes>& rs2u,
+		const EList<char>& order,
+		bool exhaust1,
+		bool exhaust2);
+
+protected:
+
+	/**
+	 * Append the part of the key contributed by read 'rd'.
+	 */
+	void appendKey(const Read& rd);
+
+	struct Entry {
+		bool          valid;
+		uint64_t      hash;
+		BTString      key;
+		EList<AlnRes> rs1;
+		EList<AlnRes> rs2;
+		EList<AlnRes> rs1u;
+		EList<AlnRes> rs2u;
+		EList<char>   order;
+		bool          exhaust1;
+		bool          exhaust2;
+	};
+
+	EList<Entry> ents_;     // slots
+	char         qbuck_[256]; // quality char -> bucket with same penalties
+	BTString     key_;      // key of most recent find()
+	uint64_t     hash_;     // hash of key_
+};
+
 /**
  * Per-thread hit sink "wrapper" for the MultiSeed aligner.  Encapsulates
  * aspects of the MultiSeed aligner hit sink that are per-thread.  This
@@ -969,7 +1169,8 @@ public:
 		AlnSink& g,                // AlnSink being wrapped
 		const ReportingParams& rp, // Parameters governing reporting
 		Mapq& mapq,                // Mapq calculator
-		size_t threadId) :         // Thread ID
+		size_t threadId,           // Thread ID
+		DupReadCache* dcache = NULL) : // duplicate read cache, or NULL
 		g_(g),
 		rp_(rp),
 		threadid_(threadId),
@@ -993,11 +1194,31 @@ public:
 		rs2u_(),       // mate 2 unpaired alignments
 		select1_(),    // for selecting random subsets for mate 1
 		select2_(),    // for selecting random subsets for mate 2
-		st_(rp)        // reporting state - what's left to do?
+		st_(rp),       // reporting state - what's left to do?
+		dcache_(dcache), // duplicate read cache
+		replayed_(false), // alignments came from dcache_?
+		cexhaust1_(false),
+		cexhaust2_(false),
+		order_(),      // order in which alignments were reported
+		arena_(MISC_CAT) // per-read scratch memory
 	{
 		assert(rp_.repOk());
 	}
 
+	/**
+	 * Append any reads still buffered for the --un/--al etc. files.
+	 */
+	~AlnSinkWrap() {
+		ReadOutFiles *rdout = g_.readOutFiles();
+		if(rdout == NULL || rdout->reorder()) return;
+		for(int i = 0; i < RDOUT_NFILES; i++) {
+			if(!rdbuf_[i].empty()) {
+				rdout->write(i, rdbuf_[i]);
+				rdbuf_[i].clear();
+			}
+		}
+	}
+
 	/**
 	 * Initialize the wrapper with a new read pair and return an
 	 * integer >= -1 indicating which stage the aligner should start
@@ -1038,6 +1259,13 @@ public:
 		const Scoring& sc,              // scoring scheme
 		bool suppressSeedSummary = true,
 		bool suppressAlignments = false);
+
+	/**
+	 * Called by the aligner for a read it won't align at all (e.g. one
+	 * left out by --sample).  Outputs are in input order when --reorder
+	 * is specified, so the read still has to take its (empty) turn.
+	 */
+	void skipRead(TReadId rdid);
 	
 	/**
 	 * Called by the aligner when a new unpaired or paired alignment is
@@ -1113,6 +1341,12 @@ public:
 	 * AlnSinkWrap.
 	 */
 	const ReportingState& state() const { return st_; }
+
+	/**
+	 * Return the scratch arena for the current read.  It's reset when
+	 * finishRead() is called.
+	 */
+	Arena& arena() { return arena_; }
 	
 	/**
 	 * Return true iff we're in -M mode.
@@ -1270,10 +1504,44 @@ protected:
 	EList<size_t>   select1_; // parallel to rs1_/rs2_ - which to report
 	EList<size_t>   select2_; // parallel to rs1_/rs2_ - which to report
 	ReportingState  st_;      // reporting state - what's left to do?
+	DupReadCache*   dcache_;  // alignments for reads seen recently, or NULL
+	bool            replayed_; // alignments for this read came from dcache_
+	bool            cexhaust1_; // mate 1 exhausted, according to dcache_
+	bool            cexhaust2_; // mate 2 exhausted, according to dcache_
+	EList<char>     order_;   // categories of alignments, in order reported
 	
+	/**
+	 * Copy the current read into the --un/--al/--un-conc/--al-conc files
+	 * according to whether it aligned.  'concord' says whether a pair
+	 * aligned concordantly, 'aligned' whether an unpaired read aligned.
+	 * If 'report' is false, the read goes to no file.
+	 */
+	void copyToReadFiles(bool report, bool concord, bool aligned);
+
+	/**
+	 * Append the original text of 'rd' to the buffer for file 'which', if
+	 * that file is open.
+	 */
+	void appendOrig(int which, const Read& rd) {
+		if(!g_.readOutFiles()->active(which)) return;
+		const size_t len = rd.readOrigBuf.length();
+		rdbuf_[which].append(rd.readOrigBuf.buf(), len);
+		if(len > 0 && rd.readOrigBuf[len-1] != '\n') {
+			rdbuf_[which].append('\n');
+		}
+	}
+
+	// Records buffered for the --un/--al etc. files are appended once
+	// there are at least this many bytes
+	static const size_t RDOUT_FLUSH_SZ = 64 * 1024;
+
 	EList<std::pair<AlnScore, size_t> > selectBuf_;
+	// Scratch memory for the current read; mutable since the const
+	// selectByScore() sorts with it
+	mutable Arena arena_;
 	BTString obuf_;
 	StackedAln staln_;
+	BTString rdbuf_[RDOUT_NFILES]; // reads bound for --un/--al etc. files
 };
 
 /**
@@ -1292,11 +1560,13 @@ public:
 		OutputQueue&     oq,           // output queue
 		const SamConfig& samc,         // settings & routines for SAM output
 		const StrList&   refnames,     // reference names
-		bool             quiet) :      // don't print alignment summary at end
+		bool             quiet,        // don't print alignment summary at end
+		ReadOutFiles*    rdout = NULL) : // --un/--al etc. files
 		AlnSink(
 			oq,
 			refnames,
-			quiet),
+			quiet,
+			rdout),
 		samc_(samc)
 	{ }
 	
@@ -1342,12 +1612,21 @@ public:
 
 protected:
 
+	/**
+	 * Return the SAM FLAG field for an alignment of a mate, or for a mate
+	 * that failed to align if rs is NULL.
+	 */
+	static int samFlag(
+		const AlnFlags& flags,
+		const AlnRes* rs,
+		const AlnRes* rso);
+
 	/**
 	 * Append a single per-mate alignment result to the given output
 	 * stream.  If the alignment is part of a pair, information about
 	 * the opposite mate and its alignment are given in rdo/rso.
 	 */
-	void appendMate(
+	virtual void appendMate(
 		BTString&     o,
 		StackedAln&   staln,
 		const Read&   rd,
@@ -1368,4 +1647,128 @@ protected:
 	BTString         dqual_;   // buffer for decoded quality sequence
 };
 
+/**
+ * An AlnSink concrete subclass for printing BAM records.  Records are
+ * encoded straight from the alignment results rather than by way of SAM
+ * text; only the optional fields are printed as text by SamConfig and then
+ * converted.  The OutputQueue is responsible for BGZF compression.
+ */
+class AlnSinkBam : public AlnSinkSam {
+
+	typedef EList<std::string> StrList;
+
+public:
+
+	AlnSinkBam(
+		OutputQueue&     oq,           // output queue
+		const SamConfig& samc,         // settings & routines for SAM output
+		const StrList&   refnames,     // reference names
+		bool             quiet,        // don't print alignment summary at end
+		ReadOutFiles*    rdout = NULL) : // --un/--al etc. files
+		AlnSinkSam(
+			oq,
+			samc,
+			refnames,
+			quiet,
+			rdout)
+	{ }
+
+	virtual ~AlnSinkBam() { }
+
+protected:
+
+	/**
+	 * Append a single per-mate BAM record to the given output buffer.
+	 */
+	virtual void appendMate(
+		BTString&     o,
+		StackedAln&   staln,
+		const Read&   rd,
+		const Read*   rdo,
+		const TReadId rdid,
+		AlnRes* rs,
+		AlnRes* rso,
+		const AlnSetSumm& summ,
+		const SeedAlSumm& ssm,
+		const SeedAlSumm& ssmo,
+		const AlnFlags& flags,
+		const PerReadMetrics& prm, // per-read metrics
+		const Mapq& mapq,          // MAPQ calculator
+		const Scoring& sc);        // scoring scheme
+};
+
+/**
+ * The fields of one SAM record, as collected by AlnSinkRecords.  Offsets
+ * are 0-based and -1 means "*" (refid, nrefid) or 0 (pos, npos).
+ */
+struct AlnRecord {
+	TReadId  rdid;    // read id
+	int      mate;    // 0 = unpaired, 1 = mate 1, 2 = mate 2
+	int      flag;    // SAM FLAG
+	int64_t  refid;   // RNAME as an index into the reference names
+	int64_t  pos;     // POS
+	int      mapq;    // MAPQ
+	BTString cigar;   // CIGAR, or empty for "*"
+	int64_t  nrefid;  // RNEXT
+	int64_t  npos;    // PNEXT
+	int64_t  isize;   // TLEN
+	BTString opts;    // tab-separated optional fields
+};
+
+/**
+ * An AlnSink concrete subclass for programs that link Bowtie 2 as a
+ * library.  Rather than printing SAM, it appends the fields of each record
+ * to a caller-supplied list, so that nothing has to be formatted and then
+ * parsed again.  Nothing is written to the output stream.  Records from
+ * different threads arrive in no particular order, but a read's records
+ * are appended in the order the SAM sink would print them.
+ */
+class AlnSinkRecords : public AlnSinkSam {
+
+	typedef EList<std::string> StrList;
+
+public:
+
+	AlnSinkRecords(
+		OutputQueue&      oq,           // output queue
+		const SamConfig&  samc,         // settings & routines for SAM output
+		const StrList&    refnames,     // reference names
+		bool              quiet,        // don't print alignment summary at end
+		EList<AlnRecord>& recs) :       // append records here
+		AlnSinkSam(
+			oq,
+			samc,
+			refnames,
+			quiet,
+			NULL),
+		recs_(recs)
+	{ }
+
+	virtual ~AlnSinkRecords() { }
+
+protected:
+
+	/**
+	 * Append the fields of a single per-mate record to the record list.
+	 */
+	virtual void appendMate(
+		BTString&     o,
+		StackedAln&   staln,
+		const Read&   rd,
+		const Read*   rdo,
+		const TReadId rdid,
+		AlnRes* rs,
+		AlnRes* rso,
+		const AlnSetSumm& summ,
+		const SeedAlSumm& ssm,
+		const SeedAlSumm& ssmo,
+		const AlnFlags& flags,
+		const PerReadMetrics& prm, // per-read metrics
+		const Mapq& mapq,          // MAPQ calculator
+		const Scoring& sc);        // scoring scheme
+
+	EList<AlnRecord>& recs_;    // records collected so far
+	MUTEX_T           mutex_m;  // serialize appends to recs_
+};
+
 #endif /*ndef ALN_SINK_H_*/
@@ -35,6 +35,7 @@
 #include "timer.h"
 #include "ds.h"
 #include "mem_ids.h"
+#include "threading.h"
 
 using namespace std;
 
@@ -213,12 +214,23 @@ public:
 	      	              bool __sanityCheck = false,
 	   	                  bool __passMemExc = false,
 	      	              bool __verbose = false,
+	                      int __nthreads = 1,
 	      	              ostream& __logger = cout) :
 	InorderBlockwiseSA<TStr>(__text, __bucketSz, __sanityCheck, __passMemExc, __verbose, __logger),
-	_sampleSuffs(EBWTB_CAT), _cur(0), _dcV(__dcV), _dc(EBWTB_CAT), _built(false)
+	_sampleSuffs(EBWTB_CAT), _cur(0), _dcV(__dcV), _dc(EBWTB_CAT), _built(false),
+	_nthreads(max(__nthreads, 1))
+#ifndef WITH_TBB
+	, _slots(NULL), _slotDone(NULL), _nextClaim(0), _stop(false), _failed(0)
+#endif
 	{ _randomSrc.init(__seed); reset(); }
 
-	~KarkkainenBlockwiseSA() { }
+	~KarkkainenBlockwiseSA() {
+#ifndef WITH_TBB
+		stopWorkers();
+		delete[] _slots;
+		delete[] _slotDone;
+#endif
+	}
 
 	/**
 	 * Allocate an amount of memory that simulates the peak memory
@@ -226,20 +238,36 @@ public:
 	 * Throws bad_alloc if it's not going to fit in memory.  Returns
 	 * the approximate number of bytes the Cover takes at all times.
 	 */
-	static size_t simulateAllocs(const TStr& text, TIndexOffU bucketSz) {
+	static size_t simulateAllocs(
+		const TStr& text,
+		TIndexOffU bucketSz,
+		int nthreads = 1)
+	{
 		size_t len = text.length();
-		// _sampleSuffs and _itrBucket are in memory at the peak
+		// _sampleSuffs and _itrBucket are in memory at the peak, along
+		// with a block and its sort buckets per worker thread if there
+		// are several
 		size_t bsz = bucketSz;
+		if(nthreads > 1) {
+			bsz *= (nthreads + 1);
+			bsz += (size_t)nthreads * 4 * min<size_t>(bucketSz, BUCKET_SORT_CUTOFF);
+		}
 		size_t sssz = len / max<TIndexOffU>(bucketSz-1, 1);
 		AutoArray<TIndexOffU> tmp(bsz + sssz + (1024 * 1024 /*out of caution*/), EBWT_CAT);
 		return bsz;
 	}
 
-	/// Defined in blockwise_sa.cpp
+	/**
+	 * Make the next block the current one.  With more than one thread,
+	 * the blocks are built ahead of time by worker threads and this
+	 * just waits for the next one in order.
+	 */
 	virtual void nextBlock();
 
 	/// Defined in blockwise_sa.cpp
-	virtual void qsort(EList<TIndexOffU>& bucket);
+	virtual void qsort(
+		EList<TIndexOffU>& bucket,
+		EList<TIndexOffU>* scratch = NULL);
 
 	/// Return true iff more blocks are available
 	virtual bool hasMoreBlocks() const {
@@ -258,6 +286,9 @@ protected:
 	 * the first block.
 	 */
 	virtual void reset() {
+#ifndef WITH_TBB
+		stopWorkers();
+#endif
 		if(!_built) {
 			build();
 		}
@@ -318,19 +349,73 @@ private:
 
 	void buildSamples();
 
+	/**
+	 * Gather and sort the suffixes of block 'cur' into 'bucket'.  This
+	 * only reads the text, samples and difference cover, so several
+	 * blocks can be built at once as long as each passes its own
+	 * 'scratch' for the bucket sort.
+	 */
+	void buildBlock(
+		TIndexOffU cur,
+		EList<TIndexOffU>& bucket,
+		EList<TIndexOffU>* scratch = NULL);
+
+#ifndef WITH_TBB
+	void startWorkers();
+	void stopWorkers();
+	static void blockWorker(void *vp);
+#endif
+
 	EList<TIndexOffU>  _sampleSuffs; /// sample suffixes
 	TIndexOffU         _cur;         /// offset to 1st elt of next block
 	const uint32_t   _dcV;         /// difference-cover periodicity
 	PtrWrap<TDC>     _dc;          /// queryable difference-cover data
 	bool             _built;       /// whether samples/DC have been built
 	RandomSource     _randomSrc;   /// source of pseudo-randoms
+	const int        _nthreads;    /// # threads building blocks
+#ifndef WITH_TBB
+	// Workers build up to _nthreads blocks ahead of the consumer; block
+	// b goes in slot b % _nthreads, which bounds the memory in flight
+	EList<tthread::thread*>     _workers;
+	EList<TIndexOffU>          *_slots;     /// blocks built ahead
+	bool                       *_slotDone;  /// slot holds a finished block
+	TIndexOffU                  _nextClaim; /// next block for a worker
+	bool                        _stop;      /// workers should quit
+	int                         _failed;    /// 1: throw 1, 2: bad_alloc
+	tthread::mutex              _mutex;
+	tthread::condition_variable _cond;
+#endif
 };
 
+/**
+ * Return pointers to 4 buckets carved out of 'scratch' that are big
+ * enough for mkeyQSortSufDcU8 to sort 'slen' suffixes with, or NULL to
+ * use the global buckets if 'scratch' is NULL.
+ */
+static inline TIndexOffU **scratchBuckets(
+	EList<TIndexOffU>* scratch,
+	size_t slen,
+	TIndexOffU *bk[4])
+{
+	if(scratch == NULL) return NULL;
+	size_t per = min<size_t>(slen, BUCKET_SORT_CUTOFF);
+	if(scratch->size() < per * 4) {
+		scratch->resizeExact(per * 4);
+	}
+	for(int i = 0; i < 4; i++) {
+		bk[i] = scratch->ptr() + i * per;
+	}
+	return bk;
+}
+
 /**
  * Qsort the set of suffixes whose offsets are in 'bucket'.
  */
 template<typename TStr>
-inline void KarkkainenBlockwiseSA<TStr>::qsort(EList<TIndexOffU>& bucket) {
+inline void KarkkainenBlockwiseSA<TStr>::qsort(
+	EList<TIndexOffU>& bucket,
+	EList<TIndexOffU>* scratch)
+{
 	const TStr& t = this->text();
 	TIndexOffU *s = bucket.ptr();
 	size_t slen = bucket.size();
@@ -342,8 +427,10 @@ inline void KarkkainenBlockwiseSA<TStr>::qsort(EList<TIndexOffU>& bucket) {
 		// with than the EList<> container
 		const uint8_t *host = (const uint8_t *)t.buf();
 		assert(_dc.get() != NULL);
+		TIndexOffU *bk[4];
 		mkeyQSortSufDcU8(t, host, len, s, slen, *_dc.get(), 4,
-		                 this->verbose(), this->sanityCheck());
+		                 this->verbose(), this->sanityCheck(),
+		                 scratchBuckets(scratch, slen, bk));
 	} else {
 		VMSG_NL("  (Not using difference cover)");
 		// We don't have a difference cover - just do a normal
@@ -361,7 +448,8 @@ inline void KarkkainenBlockwiseSA<TStr>::qsort(EList<TIndexOffU>& bucket) {
  */
 template<>
 inline void KarkkainenBlockwiseSA<S2bDnaString>::qsort(
-	EList<TIndexOffU>& bucket)
+	EList<TIndexOffU>& bucket,
+	EList<TIndexOffU>* scratch)
 {
 	const S2bDnaString& t = this->text();
 	TIndexOffU *s = bucket.ptr();
@@ -372,8 +460,10 @@ inline void KarkkainenBlockwiseSA<S2bDnaString>::qsort(
 		VMSG_NL("  (Using difference cover)");
 		// Can't use the text's 'host' array because the backing
 		// store for the packed string is not one-char-per-elt.
+		TIndexOffU *bk[4];
 		mkeyQSortSufDcU8(t, t, len, s, slen, *_dc.get(), 4,
-		                 this->verbose(), this->sanityCheck());
+		                 this->verbose(), this->sanityCheck(),
+		                 scratchBuckets(scratch, slen, bk));
 	} else {
 		VMSG_NL("  (Not using difference cover)");
 		// We don't have a difference cover - just do a normal
@@ -770,16 +860,19 @@ bool KarkkainenBlockwiseSA<TStr>::suffixCmp(
 }
 
 /**
- * Retrieve the next block.  This is the most performance-critical part
+ * Build the given block.  This is the most performance-critical part
  * of the blockwise suffix sorting process.
  */
 template<typename TStr>
-void KarkkainenBlockwiseSA<TStr>::nextBlock() {
-	EList<TIndexOffU>& bucket = this->_itrBucket;
-	VMSG_NL("Getting block " << (_cur+1) << " of " << _sampleSuffs.size()+1);
+void KarkkainenBlockwiseSA<TStr>::buildBlock(
+	TIndexOffU cur,
+	EList<TIndexOffU>& bucket,
+	EList<TIndexOffU>* scratch)
+{
+	VMSG_NL("Getting block " << (cur+1) << " of " << _sampleSuffs.size()+1);
 	assert(_built);
 	assert_gt(_dcV, 3);
-	assert_leq(_cur, _sampleSuffs.size());
+	assert_leq(cur, _sampleSuffs.size());
 	const TStr& t = this->text();
 	TIndexOffU len = (TIndexOffU)t.length();
 	// Set up the bucket
@@ -789,7 +882,7 @@ void KarkkainenBlockwiseSA<TStr>::nextBlock() {
 		// Special case: if _sampleSuffs is 0, then multikey-quicksort
 		// everything
 		VMSG_NL("  No samples; assembling all-inclusive block");
-		assert_eq(0, _cur);
+		assert_eq(0, cur);
 		try {
 			if(bucket.capacity() < this->bucketSz()) {
 				bucket.reserveExact(len+1);
@@ -830,17 +923,17 @@ void KarkkainenBlockwiseSA<TStr>::nextBlock() {
 		// calculate the Z array up to the difference-cover periodicity
 		// for both.  Be careful about first/last buckets.
 		EList<TIndexOffU> zLo(EBWTB_CAT), zHi(EBWTB_CAT);
-		assert_geq(_cur, 0);
-		assert_leq(_cur, _sampleSuffs.size());
-		bool first = (_cur == 0);
-		bool last  = (_cur == _sampleSuffs.size());
+		assert_geq(cur, 0);
+		assert_leq(cur, _sampleSuffs.size());
+		bool first = (cur == 0);
+		bool last  = (cur == _sampleSuffs.size());
 		try {
 			Timer timer(cout, "  Calculating Z arrays time: ", this->verbose());
 			VMSG_NL("  Calculating Z arrays");
 			if(!last) {
 				// Not the last bucket
-				assert_lt(_cur, _sampleSuffs.size());
-				hi = _sampleSuffs[_cur];
+				assert_lt(cur, _sampleSuffs.size());
+				hi = _sampleSuffs[cur];
 				zHi.resizeExact(_dcV);
 				zHi.fillZero();
 				assert_eq(zHi[0], 0);
@@ -848,9 +941,9 @@ void KarkkainenBlockwiseSA<TStr>::nextBlock() {
 			}
 			if(!first) {
 				// Not the first bucket
-				assert_gt(_cur, 0);
-				assert_leq(_cur, _sampleSuffs.size());
-				lo = _sampleSuffs[_cur-1];
+				assert_gt(cur, 0);
+				assert_leq(cur, _sampleSuffs.size());
+				lo = _sampleSuffs[cur-1];
 				zLo.resizeExact(_dcV);
 				zLo.fillZero();
 				assert_gt(_dcV, 3);
@@ -923,7 +1016,7 @@ void KarkkainenBlockwiseSA<TStr>::nextBlock() {
 	if(bucket.size() > 0) {
 		Timer timer(cout, "  Sorting block time: ", this->verbose());
 		VMSG_NL("  Sorting block of length " << bucket.size());
-		this->qsort(bucket);
+		this->qsort(bucket, scratch);
 	}
 	if(hi != OFF_MASK) {
 		// Not the final bucket; throw in the sample on the RHS
@@ -933,7 +1026,140 @@ void KarkkainenBlockwiseSA<TStr>::nextBlock() {
 		bucket.push_back(len);
 	}
 	VMSG_NL("Returning block of " << bucket.size());
+}
+
+template<typename TStr>
+void KarkkainenBlockwiseSA<TStr>::nextBlock() {
+#ifndef WITH_TBB
+	if(_nthreads > 1 && _sampleSuffs.size() > 0) {
+		if(_slots == NULL) {
+			_slots = new EList<TIndexOffU>[_nthreads];
+			_slotDone = new bool[_nthreads];
+			for(int i = 0; i < _nthreads; i++) {
+				_slots[i].setCat(EBWTB_CAT);
+			}
+		}
+		if(_workers.empty()) {
+			startWorkers();
+		}
+		size_t slot = _cur % _nthreads;
+		{
+			tthread::lock_guard<tthread::mutex> lg(_mutex);
+			while(!_slotDone[slot] && _failed == 0) {
+				_cond.wait(_mutex);
+			}
+		}
+		if(_failed != 0) {
+			int failed = _failed;
+			stopWorkers();
+			if(failed == 2) throw bad_alloc();
+			throw 1; // error was already reported
+		}
+		// Swap the finished block in; the slot keeps the old buffer
+		EList<TIndexOffU> tmp(EBWTB_CAT);
+		tmp.xfer(this->_itrBucket);
+		this->_itrBucket.xfer(_slots[slot]);
+		_slots[slot].xfer(tmp);
+		{
+			tthread::lock_guard<tthread::mutex> lg(_mutex);
+			_slotDone[slot] = false;
+			_cur++; // advance to next bucket
+			_cond.notify_all();
+		}
+		if(!hasMoreBlocks()) {
+			stopWorkers();
+		}
+		return;
+	}
+#endif
+	buildBlock(_cur, this->_itrBucket);
 	_cur++; // advance to next bucket
 }
 
+#ifndef WITH_TBB
+/**
+ * Start the threads that build blocks ahead of the consumer, starting
+ * with the current block.
+ */
+template<typename TStr>
+void KarkkainenBlockwiseSA<TStr>::startWorkers() {
+	assert(_workers.empty());
+	_nextClaim = _cur;
+	_stop = false;
+	_failed = 0;
+	for(int i = 0; i < _nthreads; i++) {
+		_slotDone[i] = false;
+	}
+	for(int i = 0; i < _nthreads; i++) {
+		_workers.push_back(new tthread::thread(blockWorker, (void *)this));
+	}
+}
+
+/**
+ * Tell the worker threads to quit and wait for them.  Blocks they built
+ * but that weren't consumed are discarded.
+ */
+template<typename TStr>
+void KarkkainenBlockwiseSA<TStr>::stopWorkers() {
+	if(_workers.empty()) return;
+	{
+		tthread::lock_guard<tthread::mutex> lg(_mutex);
+		_stop = true;
+		_cond.notify_all();
+	}
+	for(size_t i = 0; i < _workers.size(); i++) {
+		_workers[i]->join();
+		delete _workers[i];
+	}
+	_workers.clear();
+}
+
+/**
+ * Body of a block-building thread: repeatedly claim the next unclaimed
+ * block, waiting while it would be more than _nthreads blocks ahead of
+ * the consumer, and build it into its slot.
+ */
+template<typename TStr>
+void KarkkainenBlockwiseSA<TStr>::blockWorker(void *vp) {
+	KarkkainenBlockwiseSA<TStr> *bsa = (KarkkainenBlockwiseSA<TStr> *)vp;
+	const TIndexOffU nblocks = (TIndexOffU)bsa->_sampleSuffs.size() + 1;
+	const TIndexOffU n = (TIndexOffU)bsa->_nthreads;
+	EList<TIndexOffU> scratch(EBWTB_CAT); // this thread's sort buckets
+	while(true) {
+		TIndexOffU b;
+		{
+			tthread::lock_guard<tthread::mutex> lg(bsa->_mutex);
+			while(!bsa->_stop && bsa->_nextClaim < nblocks &&
+			      bsa->_nextClaim >= bsa->_cur + n)
+			{
+				bsa->_cond.wait(bsa->_mutex);
+			}
+			if(bsa->_stop || bsa->_nextClaim >= nblocks) {
+				return;
+			}
+			b = bsa->_nextClaim++;
+		}
+		EList<TIndexOffU>& bucket = bsa->_slots[b % n];
+		int failed = 0;
+		try {
+			bsa->buildBlock(b, bucket, &scratch);
+		} catch(bad_alloc& e) {
+			failed = 2;
+		} catch(...) {
+			failed = 1;
+		}
+		tthread::lock_guard<tthread::mutex> lg(bsa->_mutex);
+		if(failed != 0) {
+			if(bsa->_failed == 0) bsa->_failed = failed;
+		} else {
+			bsa->_slotDone[b % n] = true;
+		}
+		bsa->_cond.notify_all();
+		if(failed != 0) {
+			return;
+		}
+	}
+}
+#endif
+
 #endif /*BLOCKWISE_SA_H_*/
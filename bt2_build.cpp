@@ -50,6 +50,7 @@ static int noDc;
 static int entireSA;
 static int seed;
 static int showVersion;
+static int nthreads;
 //   Ebwt parameters
 static int32_t lineRate;
 static int32_t linesPerSide;
@@ -78,6 +79,7 @@ static void resetOptions() {
 	entireSA     = 0;     // 1 = disable blockwise SA
 	seed         = 0;     // srandom seed
 	showVersion  = 0;     // just print version and quit?
+	nthreads     = 1;     // # threads sorting suffix-array blocks
 	//   Ebwt parameters
 	lineRate     = Ebwt::default_lineRate; // a "line" is 64 or 128 bytes
 	linesPerSide = 1;  // 1 64-byte line on a side
@@ -108,7 +110,8 @@ enum {
 	ARG_USAGE,
 	ARG_REVERSE_EACH,
 	ARG_SA,
-	ARG_WRAPPER
+	ARG_WRAPPER,
+	ARG_THREADS
 };
 
 /**
@@ -154,6 +157,7 @@ static void printUsage(ostream& out) {
 	    //<< "    --big --little          endianness (default: little, this host: "
 	    //<< (currentlyBigEndian()? "big":"little") << ")" << endl
 	    << "    --seed <int>            seed for random number generator" << endl
+	    << "    --threads <int>         # of threads sorting SA blocks (default: 1)" << endl
 	    << "    -q/--quiet              verbose output (for debugging)" << endl
 	    << "    -h/--help               print detailed description of tool and its options" << endl
 	    << "    --usage                 print this usage message" << endl
@@ -199,6 +203,7 @@ static struct option long_options[] = {
 	{(char*)"reverse-each", no_argument,       0,            ARG_REVERSE_EACH},
 	{(char*)"usage",        no_argument,       0,            ARG_USAGE},
 	{(char*)"wrapper",      required_argument, 0,            ARG_WRAPPER},
+	{(char*)"threads",      required_argument, 0,            ARG_THREADS},
 	{(char*)0, 0, 0, 0} // terminator
 };
 
@@ -292,6 +297,9 @@ static bool parseOptions(int argc, const char **argv) {
 			case ARG_SEED:
 				seed = parseNumber<int>(0, "--seed arg must be at least 0");
 				break;
+			case ARG_THREADS:
+				nthreads = parseNumber<int>(1, "--threads arg must be at least 1");
+				break;
 			case ARG_REVERSE_EACH:
 				reverseEach = true;
 				break;
@@ -450,7 +458,8 @@ static void driver(
 		doBwtFile,    // make a file with just the BWT string in it
 		verbose,      // be talkative
 		autoMem,      // pass exceptions up to the toplevel so that we can adjust memory settings automatically
-		sanityCheck); // verify results and internal consistency
+		sanityCheck,  // verify results and internal consistency
+		nthreads);    // # threads sorting suffix-array blocks
 	// Note that the Ebwt is *not* resident in memory at this time.  To
 	// load it into memory, call ebwt.loadIntoMemory()
 	if(verbose) {
@@ -585,6 +594,7 @@ int bowtie_build(int argc, const char **argv) {
 				cout << "  Max bucket size, len divisor: " << bmaxDivN << endl;
 			}
 			cout << "  Difference-cover sample period: " << dcv << endl;
+			cout << "  Threads: " << nthreads << endl;
 			cout << "  Endianness: " << (bigEndian? "big":"little") << endl
 				 << "  Actual local endianness: " << (currentlyBigEndian()? "big":"little") << endl
 				 << "  Sanity checking: " << (sanityCheck? "enabled":"disabled") << endl;
@@ -418,6 +418,17 @@ struct SideLocus {
 		return ebwt + _sideByteOff;
 	}
 
+	/**
+	 * Start bringing this locus's side into cache so that a rank query
+	 * issued a little later doesn't stall on it.  A side can straddle two
+	 * cache lines.
+	 */
+	void prefetch(const uint8_t* ebwt, int32_t sideSz) const {
+		const uint8_t *s = ebwt + _sideByteOff;
+		__builtin_prefetch(s);
+		__builtin_prefetch(s + sideSz - 1);
+	}
+
 	TIndexOffU _sideByteOff; // offset of top side within ebwt[]
 	TIndexOffU _sideNum;     // index of side
 	uint32_t _charOff;      // character offset within side
@@ -510,6 +521,7 @@ public:
 	    _ebwt(EBWT_CAT), \
 	    _useMm(false), \
 	    useShmem_(false), \
+	    useHugePages_(false), \
 	    _refnames(EBWT_CAT), \
 	    mmFile1_(NULL), \
 	    mmFile2_(NULL)
@@ -523,6 +535,7 @@ public:
 	     int32_t offRatePlus, // = -1,
 	     bool useMm, // = false,
 	     bool useShmem, // = false,
+	     bool useHugePages, // = false,
 	     bool mmSweep, // = false,
 	     bool loadNames, // = false,
 		 bool loadSASamp, // = true,
@@ -536,12 +549,12 @@ public:
 	{
 		assert(!useMm || !useShmem);
 #ifdef POPCNT_CAPABILITY 
-        ProcessorSupport ps; 
-        _usePOPCNTinstruction = ps.POPCNTenabled(); 
+        _usePOPCNTinstruction = ProcessorSupport::instance().POPCNTenabled(); 
 #endif 
 		packed_ = false;
 		_useMm = useMm;
 		useShmem_ = useShmem;
+		useHugePages_ = useHugePages;
 		_in1Str = in + ".1." + gEbwt_ext;
 		_in2Str = in + ".2." + gEbwt_ext;
 		readIntoMemory(
@@ -597,7 +610,8 @@ public:
 		bool doBwtFile = false,
 		bool verbose = false,
 		bool passMemExc = false,
-		bool sanityCheck = false) :
+		bool sanityCheck = false,
+		int nthreads = 1) :
 		Ebwt_INITS,
 		_eh(
 			joinedLen(szs),
@@ -608,8 +622,7 @@ public:
 			refparams.reverse == REF_READ_REVERSE)
 	{
 #ifdef POPCNT_CAPABILITY 
-        ProcessorSupport ps; 
-        _usePOPCNTinstruction = ps.POPCNTenabled(); 
+        _usePOPCNTinstruction = ProcessorSupport::instance().POPCNTenabled(); 
 #endif 
 		_in1Str = file + ".1." + gEbwt_ext;
 		_in2Str = file + ".2." + gEbwt_ext;
@@ -666,7 +679,8 @@ public:
 		    bmaxDivN,
 		    dcv,
 		    seed,
-		    verbose);
+		    verbose,
+		    nthreads);
 		// Close output files
 		fout1.flush();
 		
@@ -926,7 +940,8 @@ public:
 	                    TIndexOffU bmaxDivN,
 	                    int dcv,
 	                    uint32_t seed,
-	                    bool verbose)
+	                    bool verbose,
+	                    int nthreads = 1)
 	{
 		// Compose text strings into single string
 		VMSG_NL("Calculating joined length");
@@ -1053,7 +1068,7 @@ public:
 					AutoArray<uint8_t> tmp(sz, EBWT_CAT);
 					dcv >>= 1;
 					// Likewise with the KarkkainenBlockwiseSA
-					sz = (TIndexOffU)KarkkainenBlockwiseSA<TStr>::simulateAllocs(s, bmax);
+					sz = (TIndexOffU)KarkkainenBlockwiseSA<TStr>::simulateAllocs(s, bmax, nthreads);
 					AutoArray<uint8_t> tmp2(sz, EBWT_CAT);
 					// Now throw in the 'ftab' and 'isaSample' structures
 					// that we'll eventually allocate in buildToDisk
@@ -1070,7 +1085,7 @@ public:
 					VMSG_NL("");
 				}
 				VMSG_NL("Constructing suffix-array element generator");
-				KarkkainenBlockwiseSA<TStr> bsa(s, bmax, dcv, seed, _sanity, _passMemExc, _verbose);
+				KarkkainenBlockwiseSA<TStr> bsa(s, bmax, dcv, seed, _sanity, _passMemExc, _verbose, nthreads);
 				assert(bsa.suffixItrIsReset());
 				assert_eq(bsa.size(), s.length()+1);
 				VMSG_NL("Converting suffix-array elements to index image");
@@ -1132,6 +1147,12 @@ public:
 
 	/// Destruct an Ebwt
 	~Ebwt() {
+		if(offs() != NULL && useShmem_) {
+			FREE_SHARED(offs());
+		}
+		if(ebwt() != NULL && useShmem_) {
+			FREE_SHARED(ebwt());
+		}
 		_fchr.reset();
 		_ftab.reset();
 		_eftab.reset();
@@ -1139,12 +1160,6 @@ public:
 		_rstarts.reset();
 		_offs.reset();
 		_ebwt.reset();
-		if(offs() != NULL && useShmem_) {
-			FREE_SHARED(offs());
-		}
-		if(ebwt() != NULL && useShmem_) {
-			FREE_SHARED(ebwt());
-		}
 		if (_in1 != NULL) fclose(_in1);
 		if (_in2 != NULL) fclose(_in2);
 	}
@@ -1265,6 +1280,10 @@ public:
 	 */
 	void evictFromMemory() {
 		assert(isInMemory());
+		if(useShmem_) {
+			FREE_SHARED(offs());
+			FREE_SHARED(ebwt());
+		}
 		_fchr.free();
 		_ftab.free();
 		_eftab.free();
@@ -1400,6 +1419,23 @@ public:
 		assert_geq(bot, top);
 		return true;
 	}
+
+	/**
+	 * Start bringing the ftab entries ftabLoHi() would consult for the same
+	 * arguments into cache.
+	 */
+	void prefetchFtab(
+		const BTDnaString& seq, // sequence to extract from
+		size_t off,             // offset into seq to begin extracting
+		bool rev) const         // reverse while extracting
+	{
+		TIndexOffU fi = ftabSeqToInt(seq, off, rev);
+		if(fi == std::numeric_limits<TIndexOffU>::max()) {
+			return;
+		}
+		__builtin_prefetch(ftab() + fi);
+		__builtin_prefetch(ftab() + fi + 1);
+	}
 	
 	/**
 	 * Get "low interpretation" of ftab entry at index i.  The low
@@ -2396,6 +2432,7 @@ template<typename Operation>
 	APtrWrap<uint8_t> _ebwt;
 	bool       _useMm;        /// use memory-mapped files to hold the index
 	bool       useShmem_;     /// use shared memory to hold large parts of the index
+	bool       useHugePages_; /// back large parts of the index with huge pages
 	EList<string> _refnames; /// names of the reference sequences
 	char *mmFile1_;
 	char *mmFile2_;
@@ -339,6 +339,7 @@ static void print_index_summary(
 		0,                    // offrate-plus (0 = index default)
 		false,                // use memory-mapped IO
 		false,                // use shared memory
+		false,                // use huge pages
 		false,                // sweep memory-mapped memory
 		true,                 // load names?
 		false,                // load SA sample?
@@ -388,6 +389,7 @@ static void driver(
 			0,                    // offrate-plus (0 = index default)
 			false,                // use memory-mapped IO
 			false,                // use shared memory
+			false,                // use huge pages
 			false,                // sweep memory-mapped memory
 			true,                 // load names?
 			true,                 // load SA sample?
@@ -27,6 +27,22 @@
 
 using namespace std;
 
+/**
+ * Allocate one of the big index arrays.  If 'huge' is true, try to back
+ * it with huge pages first, falling back on new[] if none are available.
+ */
+template<typename T>
+static void allocIndexArray(APtrWrap<T>& arr, size_t len, bool huge) {
+	if(huge) {
+		T *p = (T*)allocHugePages(len * sizeof(T));
+		if(p != NULL) {
+			arr.init(p, len, true, true);
+			return;
+		}
+	}
+	arr.init(new T[len], len, true);
+}
+
 ///////////////////////////////////////////////////////////////////////
 //
 // Functions for reading and writing Ebwts
@@ -97,6 +113,9 @@ void Ebwt::readIntoMemory(
 					cerr << "Error: Could not memory-map the index file " << names[i] << endl;
 					throw 1;
 				}
+				if(useHugePages_) {
+					adviseHugePages(mmFile[i], (size_t)sbuf.st_size);
+				}
 				if(mmSweep) {
 					int sum = 0;
 					for(off_t j = 0; j < sbuf.st_size; j += 1024) {
@@ -339,7 +358,7 @@ void Ebwt::readIntoMemory(
 		if(useShmem_) {
 			uint8_t *tmp = NULL;
 			shmemLeader = ALLOC_SHARED_U8(
-				(_in1Str + "[ebwt]"), eh->_ebwtTotLen, &tmp,
+				_in1Str, eh->_ebwtTotLen, &tmp,
 				"ebwt[]", (_verbose || startVerbose));
 			assert(tmp != NULL);
 			_ebwt.init(tmp, eh->_ebwtTotLen, false);
@@ -348,7 +367,7 @@ void Ebwt::readIntoMemory(
 			}
 		} else {
 			try {
-				_ebwt.init(new uint8_t[eh->_ebwtTotLen], eh->_ebwtTotLen, true);
+				allocIndexArray(_ebwt, eh->_ebwtTotLen, useHugePages_);
 			} catch(bad_alloc& e) {
 				cerr << "Out of memory allocating the ebwt[] array for the Bowtie index.  Please try" << endl
 				<< "again on a computer with more memory." << endl;
@@ -433,7 +452,7 @@ void Ebwt::readIntoMemory(
 				fseeko(_in1, eh->_ftabLen*OFF_SIZE, SEEK_CUR);
 #endif
 			} else {
-				_ftab.init(new TIndexOffU[eh->_ftabLen], eh->_ftabLen, true);
+				allocIndexArray(_ftab, eh->_ftabLen, useHugePages_);
 				if(switchEndian) {
 					for(TIndexOffU i = 0; i < eh->_ftabLen; i++)
 						this->ftab()[i] = readU<TIndexOffU>(_in1, switchEndian);
@@ -531,7 +550,7 @@ void Ebwt::readIntoMemory(
 			if(!useShmem_) {
 				// Allocate offs_
 				try {
-					_offs.init(new TIndexOffU[offsLenSampled], offsLenSampled, true);
+					allocIndexArray(_offs, offsLenSampled, useHugePages_);
 				} catch(bad_alloc& e) {
 					cerr << "Out of memory allocating the offs[] array  for the Bowtie index." << endl
 					<< "Please try again on a computer with more memory." << endl;
@@ -540,7 +559,7 @@ void Ebwt::readIntoMemory(
 			} else {
 				TIndexOffU *tmp = NULL;
 				shmemLeader = ALLOC_SHARED_U(
-					(_in2Str + "[offs]"), offsLenSampled*OFF_SIZE, &tmp,
+					_in2Str, offsLenSampled*OFF_SIZE, &tmp,
 					"offs", (_verbose || startVerbose));
 				_offs.init((TIndexOffU*)tmp, offsLenSampled, false);
 			}
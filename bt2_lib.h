@@ -0,0 +1,129 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BT2_LIB_H_
+#define BT2_LIB_H_
+
+/**
+ * bt2_lib.h:
+ *
+ * C interface to libbowtie2.a, for programs that want to align reads they
+ * hold in memory without writing them to a file and parsing SAM back.
+ *
+ * Options are given as bowtie2 command-line arguments.  Those passed to
+ * bt2_index_load() are the defaults for every bt2_align() call on the
+ * index; a call's own arguments are appended to them.  Arguments that
+ * name read or output files are ignored by bt2_align().  Pass --quiet to
+ * keep the alignment summary off stderr.
+ *
+ * Bowtie 2 keeps its settings in global variables, so only one index can
+ * be loaded at a time, and calls into the library are serialized.  Use
+ * -p to align a batch with several threads.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct bt2_index bt2_index;
+
+/**
+ * A read to be aligned.  'qual' holds Phred+33 qualities and may be NULL,
+ * in which case all qualities are 'I'.  'name' may be NULL.
+ */
+typedef struct bt2_read {
+	const char *name;
+	const char *seq;
+	const char *qual;
+} bt2_read;
+
+/**
+ * One SAM record.  refid and next_refid index the names returned by
+ * bt2_index_refname() and are -1 for "*"; pos and next_pos are 0-based
+ * and -1 when there is no position.  cigar is empty for "*".  opts holds
+ * the tab-separated optional fields.
+ */
+typedef struct bt2_record {
+	size_t  read;       /* index of the read or pair in the batch */
+	int     mate;       /* 0 = unpaired, 1 = mate 1, 2 = mate 2 */
+	int     flag;
+	int64_t refid;
+	int64_t pos;
+	int     mapq;
+	char   *cigar;
+	int64_t next_refid;
+	int64_t next_pos;
+	int64_t isize;
+	char   *opts;
+} bt2_record;
+
+/**
+ * Load the index named by -x in argv, along with its reference, and keep
+ * them in memory until bt2_index_free().  argv[0] is the program name.
+ * Returns NULL after printing a message to stderr if the options are
+ * invalid, the index can't be loaded or an index is already loaded.
+ */
+bt2_index *bt2_index_load(int argc, const char **argv);
+
+/**
+ * Release the index and reference.
+ */
+void bt2_index_free(bt2_index *idx);
+
+/**
+ * Return the number of reference sequences in the index.
+ */
+size_t bt2_index_nrefs(const bt2_index *idx);
+
+/**
+ * Return the name of the given reference sequence.
+ */
+const char *bt2_index_refname(const bt2_index *idx, size_t refid);
+
+/**
+ * Align 'n' unpaired reads, or 'n' pairs if reads2 isn't NULL.  argv
+ * holds options for this call only, with no program name.  On
+ * success, *recs is set to a newly allocated array of the *nrecs records,
+ * ordered by read and then as bowtie2 would print them, and 0 is
+ * returned.  On failure, a message is printed to stderr and the exit
+ * status bowtie2 would have had is returned.
+ */
+int bt2_align(
+	bt2_index *idx,
+	int argc,
+	const char **argv,
+	const bt2_read *reads1,
+	const bt2_read *reads2,
+	size_t n,
+	bt2_record **recs,
+	size_t *nrecs);
+
+/**
+ * Release records returned by bt2_align().
+ */
+void bt2_records_free(bt2_record *recs, size_t nrecs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BT2_LIB_H_ */
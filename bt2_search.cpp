@@ -27,6 +27,11 @@
 #include <math.h>
 #include <utility>
 #include <limits>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sstream>
+#include <signal.h>
+#include <unistd.h>
 #include "alphabet.h"
 #include "assert_helpers.h"
 #include "endian_swap.h"
@@ -54,6 +59,10 @@
 #include "outq.h"
 #include "aligner_seed2.h"
 #include "bt2_search.h"
+#include "processor_support.h"
+#include "simd_seq.h"
+#include "job_server.h"
+#include "bt2_lib.h"
 
 using namespace std;
 
@@ -94,6 +103,9 @@ static bool useSpinlock;  // false -> don't use of spinlocks even if they're #de
 static bool fileParallel; // separate threads read separate input files in parallel
 static bool useShmem;     // use shared memory to hold the index
 static bool useMm;        // use memory-mapped files to hold the index
+static bool useHugePages; // back the index and reference with huge pages
+static string serverSock; // serve alignment jobs on this Unix domain socket
+static string connectSock;// hand this job to the server on this socket
 static bool mmSweep;      // sweep through memory-mapped files immediately after mapping
 int gMinInsert;           // minimum insert size
 int gMaxInsert;           // maximum insert size
@@ -201,7 +213,9 @@ static int    multiseedLen;   // length of multiseed seeds
 static size_t multiseedOff;   // offset to begin extracting seeds
 static uint32_t seedCacheLocalMB;   // # MB to use for non-shared seed alignment cacheing
 static uint32_t seedCacheCurrentMB; // # MB to use for current-read seed hit cacheing
+static uint32_t seedCacheSharedMB;  // # MB to use for seed hits shared among threads
 static uint32_t exactCacheCurrentMB; // # MB to use for current-read seed hit cacheing
+static size_t dupCacheSz;     // # reads/pairs per thread to remember results for; 0 = off
 static size_t maxhalf;        // max width on one side of DP table
 static bool seedSumm;         // print summary information about seed hits, not alignments
 static bool doUngapped;       // do ungapped alignment
@@ -219,6 +233,7 @@ static bool enable8;          // use 8-bit SSE where possible?
 static size_t cminlen;        // longer reads use checkpointing
 static size_t cpow2;          // checkpoint interval log2
 static bool doTri;            // do triangular mini-fills?
+static bool doEditFilter;     // skip end-to-end fills with too many edits?
 static string defaultPreset;  // default preset; applied immediately
 static bool ignoreQuals;      // all mms incur same penalty, regardless of qual
 static string wrapper;        // type of wrapper script, so we can print correct usage
@@ -232,6 +247,17 @@ static size_t do1mmMinLen;    // length below which we disable 1mm e2e search
 static int seedBoostThresh;   // if average non-zero position has more than this many elements
 static size_t nSeedRounds;    // # seed rounds
 static bool reorder;          // true -> reorder SAM recs in -p mode
+static int readsPerBatch;     // # reads/pairs a thread claims from the input at once
+static size_t outBufKb;       // KB of output a thread collects before handing it to the writer
+static bool mmapReads;        // true -> memory-map uncompressed FASTQ read files
+static string unFn;           // --un: write unpaired reads that fail to align here
+static string alFn;           // --al: write unpaired reads that align here
+static string unConcFn;       // --un-conc: write pairs that fail to align concordantly here
+static string alConcFn;       // --al-conc: write pairs that align concordantly here
+static int unFmt;             // compression for --un file
+static int alFmt;             // compression for --al file
+static int unConcFmt;         // compression for --un-conc files
+static int alConcFmt;         // compression for --al-conc files
 static float sampleFrac;      // only align random fraction of input reads
 static bool arbitraryRandom;  // pseudo-randoms no longer a function of read properties
 static bool bowtie2p5;
@@ -282,6 +308,9 @@ static void resetOptions() {
 	fileParallel			= false; // separate threads read separate input files in parallel
 	useShmem				= false; // use shared memory to hold the index
 	useMm					= false; // use memory-mapped files to hold the index
+	useHugePages			= false; // back the index and reference with huge pages
+	serverSock				= "";    // serve alignment jobs on this Unix domain socket
+	connectSock				= "";    // hand this job to the server on this socket
 	mmSweep					= false; // sweep through memory-mapped files immediately after mapping
 	gMinInsert				= 0;     // minimum insert size
 	gMaxInsert				= 500;   // maximum insert size
@@ -389,7 +418,9 @@ static void resetOptions() {
 	multiseedOff    = 0;
 	seedCacheLocalMB   = 32; // # MB to use for non-shared seed alignment cacheing
 	seedCacheCurrentMB = 20; // # MB to use for current-read seed hit cacheing
+	seedCacheSharedMB  = 256; // # MB to use for seed hits shared among threads
 	exactCacheCurrentMB = 20; // # MB to use for current-read seed hit cacheing
+	dupCacheSz         = 0;  // # reads/pairs per thread to remember results for
 	maxhalf            = 15; // max width on one side of DP table
 	seedSumm           = false; // print summary information about seed hits, not alignments
 	doUngapped         = true;  // do ungapped alignment
@@ -407,6 +438,7 @@ static void resetOptions() {
 	cminlen            = 2000;  // longer reads use checkpointing
 	cpow2              = 4;     // checkpoint interval log2
 	doTri              = false; // do triangular mini-fills?
+	doEditFilter       = true;  // skip end-to-end fills with too many edits?
 	defaultPreset      = "sensitive%LOCAL%"; // default preset; applied immediately
 	extra_opts.clear();
 	extra_opts_cur = 0;
@@ -423,6 +455,14 @@ static void resetOptions() {
 	nSeedRounds = 2;         // # rounds of seed searches to do for repetitive reads
 	do1mmMinLen = 60;        // length below which we disable 1mm search
 	reorder = false;         // reorder SAM records with -p > 1
+	readsPerBatch = 16;      // # reads/pairs a thread claims from the input at once
+	outBufKb = 4096;         // threads hand output to the writer in 4 MB chunks
+	mmapReads = false;       // read FASTQ files through a FileBuf
+	unFn.clear();            // don't write unaligned unpaired reads anywhere
+	alFn.clear();            // don't write aligned unpaired reads anywhere
+	unConcFn.clear();        // don't write non-concordant pairs anywhere
+	alConcFn.clear();        // don't write concordant pairs anywhere
+	unFmt = alFmt = unConcFmt = alConcFmt = COMPRESS_NONE;
 	sampleFrac = 1.1f;       // align all reads
 	arbitraryRandom = false; // let pseudo-random seeds be a function of read properties
 	bowtie2p5 = false;
@@ -486,6 +526,9 @@ static struct option long_options[] = {
 	{(char*)"phred64",      no_argument,       0,            ARG_PHRED64},
 	{(char*)"solexa1.3-quals", no_argument,    0,            ARG_PHRED64},
 	{(char*)"mm",           no_argument,       0,            ARG_MM},
+	{(char*)"huge-pages",   no_argument,       0,            ARG_HUGE_PAGES},
+	{(char*)"server",       required_argument, 0,            ARG_SERVER},
+	{(char*)"connect",      required_argument, 0,            ARG_CONNECT},
 	{(char*)"shmem",        no_argument,       0,            ARG_SHMEM},
 	{(char*)"mmsweep",      no_argument,       0,            ARG_MMSWEEP},
 	{(char*)"hadoopout",    no_argument,       0,            ARG_HADOOPOUT},
@@ -595,15 +638,34 @@ static struct option long_options[] = {
 	{(char*)"mapq-extra",       no_argument,       0,        ARG_MAPQ_EX},
 	{(char*)"seed-rounds",      required_argument, 0,        'R'},
 	{(char*)"reorder",          no_argument,       0,        ARG_REORDER},
+	{(char*)"reads-per-batch",  required_argument, 0,        ARG_READS_PER_BATCH},
+	{(char*)"out-buf-kb",       required_argument, 0,        ARG_OUT_BUF_KB},
+	{(char*)"mm-reads",         no_argument,       0,        ARG_MM_READS},
+	{(char*)"un",               required_argument, 0,        ARG_UN},
+	{(char*)"un-gz",            required_argument, 0,        ARG_UN_GZ},
+	{(char*)"un-bz2",           required_argument, 0,        ARG_UN_BZ2},
+	{(char*)"al",               required_argument, 0,        ARG_AL},
+	{(char*)"al-gz",            required_argument, 0,        ARG_AL_GZ},
+	{(char*)"al-bz2",           required_argument, 0,        ARG_AL_BZ2},
+	{(char*)"un-conc",          required_argument, 0,        ARG_UN_CONC},
+	{(char*)"un-conc-gz",       required_argument, 0,        ARG_UN_CONC_GZ},
+	{(char*)"un-conc-bz2",      required_argument, 0,        ARG_UN_CONC_BZ2},
+	{(char*)"al-conc",          required_argument, 0,        ARG_AL_CONC},
+	{(char*)"al-conc-gz",       required_argument, 0,        ARG_AL_CONC_GZ},
+	{(char*)"al-conc-bz2",      required_argument, 0,        ARG_AL_CONC_BZ2},
+	{(char*)"bam",              no_argument,       0,        ARG_BAM},
 	{(char*)"passthrough",      no_argument,       0,        ARG_READ_PASSTHRU},
 	{(char*)"sample",           required_argument, 0,        ARG_SAMPLE},
 	{(char*)"cp-min",           required_argument, 0,        ARG_CP_MIN},
 	{(char*)"cp-ival",          required_argument, 0,        ARG_CP_IVAL},
 	{(char*)"tri",              no_argument,       0,        ARG_TRI},
+	{(char*)"no-dp-filter",     no_argument,       0,        ARG_NO_DP_FILTER},
 	{(char*)"nondeterministic", no_argument,       0,        ARG_NON_DETERMINISTIC},
 	{(char*)"non-deterministic", no_argument,      0,        ARG_NON_DETERMINISTIC},
 	{(char*)"local-seed-cache-sz", required_argument, 0,     ARG_LOCAL_SEED_CACHE_SZ},
 	{(char*)"seed-cache-sz",       required_argument, 0,     ARG_CURRENT_SEED_CACHE_SZ},
+	{(char*)"shared-seed-cache-sz", required_argument, 0,    ARG_SHARED_SEED_CACHE_SZ},
+	{(char*)"dup-cache-sz",     required_argument, 0,        ARG_DUP_CACHE_SZ},
 	{(char*)"no-unal",          no_argument,       0,        ARG_SAM_NO_UNAL},
 	{(char*)"test-25",          no_argument,       0,        ARG_TEST_25},
 	// TODO: following should be a function of read length?
@@ -763,18 +825,14 @@ static void printUsage(ostream& out) {
 		<< "  --no-overlap       not concordant when mates overlap at all" << endl
 		<< endl
 	    << " Output:" << endl;
-	//if(wrapper == "basic-0") {
-	//	out << "  --bam              output directly to BAM (by piping through 'samtools view')" << endl;
-	//}
+	out << "  --bam              write BAM instead of SAM" << endl;
 	out << "  -t/--time          print wall-clock time taken by search phases" << endl;
-	if(wrapper == "basic-0") {
 	out << "  --un <path>           write unpaired reads that didn't align to <path>" << endl
 	    << "  --al <path>           write unpaired reads that aligned at least once to <path>" << endl
 	    << "  --un-conc <path>      write pairs that didn't align concordantly to <path>" << endl
 	    << "  --al-conc <path>      write pairs that aligned concordantly at least once to <path>" << endl
 	    << "  (Note: for --un, --al, --un-conc, or --al-conc, add '-gz' to the option name, e.g." << endl
 		<< "  --un-gz <path>, to gzip compress output, or add '-bz2' to bzip2 compress output.)" << endl;
-	}
 	out << "  --quiet            print nothing to stderr except serious errors" << endl
 	//  << "  --refidx           refer to ref. seqs by 0-based index rather than name" << endl
 		<< "  --met-file <path>  send metrics to file at <path> (off)" << endl
@@ -793,11 +851,18 @@ static void printUsage(ostream& out) {
 	//    << "  -o/--offrate <int> override offrate of index; must be >= index's offrate" << endl
 	    << "  -p/--threads <int> number of alignment threads to launch (1)" << endl
 	    << "  --reorder          force SAM output order to match order of input reads" << endl
+	    << "  --reads-per-batch <int>" << endl
+	    << "                     # of reads/pairs a thread takes from the input at once (16)" << endl
+	    << "  --out-buf-kb <int> KB of output a thread collects before it's written (4096)" << endl
 #ifdef BOWTIE_MM
 	    << "  --mm               use memory-mapped I/O for index; many 'bowtie's can share" << endl
+	    << "  --mm-reads         use memory-mapped I/O for uncompressed FASTQ read files" << endl
+	    << "  --huge-pages       back index and reference with 2 MB pages to spare the TLB" << endl
 #endif
+	    << "  --server <path>    keep index loaded; run jobs sent to socket <path>" << endl
+	    << "  --connect <path>   run this job on the --server listening at <path>" << endl
 #ifdef BOWTIE_SHARED_MEM
-		//<< "  --shmem            use shared mem for index; many 'bowtie's can share" << endl
+	    << "  --shmem            use shared mem for index; many 'bowtie's can share" << endl
 #endif
 		<< endl
 	    << " Other:" << endl
@@ -984,7 +1049,19 @@ static void parseOption(int next_option, const char *arg) {
 		case ARG_FF: gMate1fw = true;  gMate2fw = true;  break;
 		case ARG_RF: gMate1fw = false; gMate2fw = true;  break;
 		case ARG_FR: gMate1fw = true;  gMate2fw = false; break;
-		case ARG_SHMEM: useShmem = true; break;
+		case ARG_SHMEM: {
+#ifdef BOWTIE_SHARED_MEM
+			useShmem = true;
+			break;
+#else
+			cerr << "Shared-memory mode is disabled because bowtie was not compiled with" << endl
+				 << "BOWTIE_SHARED_MEM defined." << endl;
+			throw 1;
+#endif
+		}
+		case ARG_HUGE_PAGES: useHugePages = true; break;
+		case ARG_SERVER: serverSock = arg; break;
+		case ARG_CONNECT: connectSock = arg; break;
 		case ARG_SEED_SUMM: seedSumm = true; break;
 		case ARG_MM: {
 #ifdef BOWTIE_MM
@@ -998,6 +1075,37 @@ static void parseOption(int next_option, const char *arg) {
 			throw 1;
 #endif
 		}
+		case ARG_MM_READS: {
+#ifdef BOWTIE_MM
+			mmapReads = true;
+			break;
+#else
+			cerr << "Memory-mapped I/O mode is disabled because bowtie was not compiled with" << endl
+				 << "BOWTIE_MM defined.  Memory-mapped I/O is not supported under Windows." << endl;
+			throw 1;
+#endif
+		}
+		case ARG_BAM: {
+#ifdef WITH_ZLIB
+			outType = OUTPUT_BAM;
+			break;
+#else
+			cerr << "Error: --bam requires zlib, but this binary was built with WITH_ZLIB=0" << endl;
+			throw 1;
+#endif
+		}
+		case ARG_UN:          unFn = arg;     unFmt = COMPRESS_NONE;      break;
+		case ARG_UN_GZ:       unFn = arg;     unFmt = COMPRESS_GZIP;      break;
+		case ARG_UN_BZ2:      unFn = arg;     unFmt = COMPRESS_BZIP2;     break;
+		case ARG_AL:          alFn = arg;     alFmt = COMPRESS_NONE;      break;
+		case ARG_AL_GZ:       alFn = arg;     alFmt = COMPRESS_GZIP;      break;
+		case ARG_AL_BZ2:      alFn = arg;     alFmt = COMPRESS_BZIP2;     break;
+		case ARG_UN_CONC:     unConcFn = arg; unConcFmt = COMPRESS_NONE;  break;
+		case ARG_UN_CONC_GZ:  unConcFn = arg; unConcFmt = COMPRESS_GZIP;  break;
+		case ARG_UN_CONC_BZ2: unConcFn = arg; unConcFmt = COMPRESS_BZIP2; break;
+		case ARG_AL_CONC:     alConcFn = arg; alConcFmt = COMPRESS_NONE;  break;
+		case ARG_AL_CONC_GZ:  alConcFn = arg; alConcFmt = COMPRESS_GZIP;  break;
+		case ARG_AL_CONC_BZ2: alConcFn = arg; alConcFmt = COMPRESS_BZIP2; break;
 		case ARG_MMSWEEP: mmSweep = true; break;
 		case ARG_HADOOPOUT: hadoopOut = true; break;
 		case ARG_SOLEXA_QUALS: solexaQuals = true; break;
@@ -1013,6 +1121,12 @@ static void parseOption(int next_option, const char *arg) {
 		case ARG_CURRENT_SEED_CACHE_SZ:
 			seedCacheCurrentMB = (uint32_t)parseInt(1, "--seed-cache-sz arg must be at least 1", arg);
 			break;
+		case ARG_SHARED_SEED_CACHE_SZ:
+			seedCacheSharedMB = (uint32_t)parseInt(1, "--shared-seed-cache-sz arg must be at least 1", arg);
+			break;
+		case ARG_DUP_CACHE_SZ:
+			dupCacheSz = (size_t)parseInt(0, "--dup-cache-sz arg must be at least 0", arg);
+			break;
 		case ARG_REFIDX: noRefNames = true; break;
 		case ARG_FUZZY: fuzzy = true; break;
 		case ARG_FULLREF: fullRef = true; break;
@@ -1157,6 +1271,12 @@ static void parseOption(int next_option, const char *arg) {
 		case ARG_SAM_NOSQ: samNoSQ = true; break;
 		case ARG_SAM_PRINT_YI: sam_print_yi = true; break;
 		case ARG_REORDER: reorder = true; break;
+		case ARG_READS_PER_BATCH:
+			readsPerBatch = parseInt(1, "--reads-per-batch arg must be at least 1", arg);
+			break;
+		case ARG_OUT_BUF_KB:
+			outBufKb = (size_t)parseInt(0, "--out-buf-kb arg must be at least 0", arg);
+			break;
 		case ARG_MAPQ_EX: {
 			sam_print_zp = true;
 			// TODO: remove next line
@@ -1181,6 +1301,9 @@ static void parseOption(int next_option, const char *arg) {
 		case ARG_TRI:
 			doTri = true;
 			break;
+		case ARG_NO_DP_FILTER:
+			doEditFilter = false;
+			break;
 		case ARG_READ_PASSTHRU: {
 			sam_print_xr = true;
 			break;
@@ -1556,6 +1679,10 @@ static void parseOptions(int argc, const char **argv) {
 	if(qUpto + skipReads > qUpto) {
 		qUpto += skipReads;
 	}
+	if(outType == OUTPUT_BAM && seedSumm) {
+		cerr << "Error: --bam cannot be combined with --seed-summ" << endl;
+		throw 1;
+	}
 	if(useShmem && useMm && !gQuiet) {
 		cerr << "Warning: --shmem overrides --mm..." << endl;
 		useMm = false;
@@ -1574,6 +1701,18 @@ static void parseOptions(int argc, const char **argv) {
 		multiseedMms = multiseedLen-1;
 	}
 	sam_print_zm = sam_print_zm && bowtie2p5;
+	if(sam_print_xss) {
+		// Xs:i/Ys:i report the best score of fills that found nothing
+		// valid, so every such fill has to run to completion
+		doEditFilter = false;
+	}
+	if(seedSumm || sam_print_xss || sam_print_zt || sam_print_xt ||
+	   sam_print_xd || sam_print_xu || sam_print_xp || sam_print_zb ||
+	   sam_print_zr || sam_print_zf || sam_print_zm || sam_print_zi)
+	{
+		// These describe the search itself, which a duplicate read skips
+		dupCacheSz = 0;
+	}
 #ifndef NDEBUG
 	if(!gQuiet) {
 		cerr << "Warning: Running in debug mode.  Please use debug mode only "
@@ -1602,7 +1741,7 @@ static Ebwt*                    multiseed_ebwtFw;
 static Ebwt*                    multiseed_ebwtBw;
 static Scoring*                 multiseed_sc;
 static BitPairReference*        multiseed_refs;
-static AlignmentCache*          multiseed_ca; // seed cache
+static SharedSeedCache*         multiseed_ca; // seed cache shared by threads
 static AlnSink*                 multiseed_msink;
 static OutFileBuf*              multiseed_metricsOfb;
 
@@ -2777,7 +2916,7 @@ static void multiseedSearchWorker(void *vp) {
 	const Ebwt&             ebwtBw   = *multiseed_ebwtBw;
 	const Scoring&          sc       = *multiseed_sc;
 	const BitPairReference& ref      = *multiseed_refs;
-	AlignmentCache&         scShared = *multiseed_ca;
+	SharedSeedCache*        scShared = multiseed_ca;
 	AlnSink&                msink    = *multiseed_msink;
 	OutFileBuf*             metricsOfb = multiseed_metricsOfb;
 
@@ -2802,7 +2941,7 @@ static void multiseedSearchWorker(void *vp) {
 	AlignmentCacheIface ca(
 		&scCurrent,
 		scLocal.get(),
-		msNoCache ? NULL : &scShared);
+		scShared);
 	
 	// Instantiate an object for holding reporting-related parameters.
 	ReportingParams rp(
@@ -2816,12 +2955,17 @@ static void multiseedSearchWorker(void *vp) {
 	// Instantiate a mapping quality calculator
 	auto_ptr<Mapq> bmapq(new_mapq(mapqv, scoreMin, sc));
 	
+	// Alignments for recently aligned reads, for reporting duplicates
+	auto_ptr<DupReadCache> dcache(
+		dupCacheSz > 0 ? new DupReadCache(dupCacheSz, sc) : NULL);
+
 	// Make a per-thread wrapper for the global MHitSink object.
 	AlnSinkWrap msinkwrap(
 		msink,         // global sink
 		rp,            // reporting parameters
 		*bmapq.get(),  // MAPQ calculator
-		(size_t)tid);  // thread id
+		(size_t)tid,   // thread id
+		dcache.get()); // duplicate read cache
 	
 	// Write dynamic-programming problem descriptions here
 	ofstream *dpLog = NULL, *dpLogOpp = NULL;
@@ -2907,12 +3051,16 @@ static void multiseedSearchWorker(void *vp) {
 	int mergeival = 16;
 	while(true) {
 		bool success = false, done = false, paired = false;
-		ps->nextReadPair(success, done, paired, outType != OUTPUT_SAM);
+		ps->nextReadPair(success, done, paired, outType != OUTPUT_SAM && outType != OUTPUT_BAM);
 		if(!success && done) {
 			break;
 		} else if(!success) {
 			continue;
 		}
+		if(msink.outq().failed()) {
+			// Output can't be written; the main thread reports the error
+			break;
+		}
 		TReadId rdid = ps->rdid();
 		bool sample = true;
 		if(arbitraryRandom) {
@@ -2964,7 +3112,7 @@ static void multiseedSearchWorker(void *vp) {
 				const size_t rdlen1 = ps->bufa().length();
 				const size_t rdlen2 = pair ? ps->bufb().length() : 0;
 				olm.bases += (rdlen1 + rdlen2);
-				msinkwrap.nextRead(
+				int nrs = msinkwrap.nextRead(
 					&ps->bufa(),
 					pair ? &ps->bufb() : NULL,
 					rdid,
@@ -3048,7 +3196,7 @@ static void multiseedSearchWorker(void *vp) {
 				prm.nFilt += (filt[0] ? 0 : 1) + (filt[1] ? 0 : 1);
 				Read* rds[2] = { &ps->bufa(), &ps->bufb() };
 				// For each mate...
-				assert(msinkwrap.empty());
+				assert(nrs == -1 || msinkwrap.empty());
 				sd.nextRead(paired, rdrows[0], rdrows[1]); // SwDriver
 				size_t minedfw[2] = { 0, 0 };
 				size_t minedrc[2] = { 0, 0 };
@@ -3135,10 +3283,12 @@ static void multiseedSearchWorker(void *vp) {
 					}
 				}
 				size_t eePeEeltLimit = std::numeric_limits<size_t>::max();
-				// Whether we're done with mate1 / mate2
-				bool done[2] = { !filt[0], !filt[1] };
+				// Whether we're done with mate1 / mate2.  nextRead() returns -1
+				// if it found the read's alignments in the duplicate read
+				// cache, leaving nothing to search for.
+				bool dup = (nrs == -1);
+				bool done[2] = { !filt[0] || dup, !filt[1] || dup };
 				size_t nelt[2] = {0, 0};
-									
 					// Find end-to-end exact alignments for each read
 					if(doExactUpFront) {
 						for(size_t matei = 0; matei < (pair ? 2:1); matei++) {
@@ -3816,6 +3966,10 @@ static void multiseedSearchWorker(void *vp) {
 		else if(rdid >= qUpto) {
 			break;
 		}
+		else if(rdid >= skipReads) {
+			// Left out by --sample; keep output in order anyway
+			msinkwrap.skipRead(rdid);
+		}
 		if(metricsPerRead) {
 			MERGE_METRICS(metricsPt, nthreads > 1);
 			nametmp = ps->bufa().name;
@@ -3954,12 +4108,16 @@ static void multiseedSearchWorker_2p5(void *vp) {
 	int mergeival = 16;
 	while(true) {
 		bool success = false, done = false, paired = false;
-		ps->nextReadPair(success, done, paired, outType != OUTPUT_SAM);
+		ps->nextReadPair(success, done, paired, outType != OUTPUT_SAM && outType != OUTPUT_BAM);
 		if(!success && done) {
 			break;
 		} else if(!success) {
 			continue;
 		}
+		if(msink.outq().failed()) {
+			// Output can't be written; the main thread reports the error
+			break;
+		}
 		TReadId rdid = ps->rdid();
 		bool sample = true;
 		if(arbitraryRandom) {
@@ -4154,6 +4312,10 @@ static void multiseedSearchWorker_2p5(void *vp) {
 		else if(rdid >= qUpto) {
 			break;
 		}
+		else if(rdid >= skipReads) {
+			// Left out by --sample; keep output in order anyway
+			msinkwrap.skipRead(rdid);
+		}
 		if(metricsPerRead) {
 			MERGE_METRICS(metricsPt, nthreads > 1);
 			nametmp = ps->bufa().name;
@@ -4174,12 +4336,32 @@ static void multiseedSearchWorker_2p5(void *vp) {
  * shared global data structures, creates per-thread structures, then
  * enters the search loop.
  */
+/**
+ * Construct the bitpacked reference for adjIdxBase.
+ */
+static BitPairReference* newBitPairReference() {
+	return new BitPairReference(
+		adjIdxBase,
+		false,
+		sanityCheck,
+		NULL,
+		NULL,
+		false,
+		useMm,
+		useShmem,
+		useHugePages,
+		mmSweep,
+		gVerbose,
+		startVerbose);
+}
+
 static void multiseedSearch(
 	Scoring& sc,
 	PairedPatternSource& patsrc,  // pattern source
 	AlnSink& msink,             // hit sink
 	Ebwt& ebwtFw,                 // index of original text
 	Ebwt& ebwtBw,                 // index of mirror text
+	BitPairReference* resRefs,    // reference already loaded, or NULL
 	OutFileBuf *metricsOfb)
 {
 	multiseed_patsrc = &patsrc;
@@ -4188,33 +4370,26 @@ static void multiseedSearch(
 	multiseed_ebwtBw = &ebwtBw;
 	multiseed_sc     = &sc;
 	multiseed_metricsOfb      = metricsOfb;
-	Timer *_t = new Timer(cerr, "Time loading reference: ", timing);
-	auto_ptr<BitPairReference> refs(
-		new BitPairReference(
-			adjIdxBase,
-			false,
-			sanityCheck,
-			NULL,
-			NULL,
-			false,
-			useMm,
-			useShmem,
-			mmSweep,
-			gVerbose,
-			startVerbose)
-	);
-	delete _t;
-	if(!refs->loaded()) throw 1;
-	multiseed_refs = refs.get();
+	auto_ptr<BitPairReference> refs;
+	if(resRefs == NULL) {
+		Timer _t(cerr, "Time loading reference: ", timing);
+		refs.reset(newBitPairReference());
+		if(!refs->loaded()) throw 1;
+		resRefs = refs.get();
+	}
+	multiseed_refs = resRefs;
+	// One seed cache for all threads, within one memory budget
+	auto_ptr<SharedSeedCache> seedCache(msNoCache ? NULL :
+		new SharedSeedCache((uint64_t)seedCacheSharedMB * 1024 * 1024));
+	multiseed_ca = seedCache.get();
 #ifdef WITH_TBB
 	tbb::task_group tbb_grp;
 #else
 	AutoArray<tthread::thread*> threads(nthreads+1);
 	AutoArray<int> tids(nthreads+1);
 #endif
-	{
+	if(!ebwtFw.isInMemory()) {
 		// Load the other half of the index into memory
-		assert(!ebwtFw.isInMemory());
 		Timer _t(cerr, "Time loading forward index: ", timing);
 		ebwtFw.loadIntoMemory(
 			0,  // colorspace?
@@ -4225,9 +4400,8 @@ static void multiseedSearch(
 			!noRefNames,  // load names?
 			startVerbose);
 	}
-	if(multiseedMms > 0 || do1mmUpFront) {
+	if((multiseedMms > 0 || do1mmUpFront) && !ebwtBw.isInMemory()) {
 		// Load the other half of the index into memory
-		assert(!ebwtBw.isInMemory());
 		Timer _t(cerr, "Time loading mirror index: ", timing);
 		ebwtBw.loadIntoMemory(
 			0, // colorspace?
@@ -4272,8 +4446,205 @@ static void multiseedSearch(
 	}
 }
 
+/**
+ * Work out where the --un/--al (paired = false) or --un-conc/--al-conc
+ * (paired = true) reads go, by the same rules the bowtie2 wrapper has
+ * always used.  If 'path' is a directory, the file(s) go inside it and are
+ * named after the option.  For pairs, any '%' in the file name is replaced
+ * with the mate number; failing that, ".1" or ".2" goes before the last
+ * extension, or at the end if there is none.
+ */
+static void readOutFileNames(
+	const string& path, // argument given to the option
+	const string& opt,  // option name, without dashes or compression suffix
+	bool paired,        // option is --un-conc or --al-conc?
+	string& fn1,        // file name for unpaired reads or mate 1s
+	string& fn2)        // file name for mate 2s
+{
+	string dir, base;
+	struct stat st;
+	if(stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+		dir = path;
+		if(dir[dir.length()-1] != '/') dir += '/';
+	} else {
+		size_t slash = path.find_last_of('/');
+		if(slash != string::npos) {
+			dir = path.substr(0, slash + 1);
+			base = path.substr(slash + 1);
+		} else {
+			base = path;
+		}
+	}
+	if(!paired) {
+		fn1 = dir + (base.empty() ? opt + "-seqs" : base);
+		return;
+	}
+	if(base.empty()) {
+		base = opt + "-mate";
+	}
+	fn1 = fn2 = base;
+	if(base.find('%') != string::npos) {
+		for(size_t i = 0; i < base.length(); i++) {
+			if(base[i] == '%') {
+				fn1[i] = '1';
+				fn2[i] = '2';
+			}
+		}
+	} else {
+		size_t dot = base.find_last_of('.');
+		if(dot != string::npos) {
+			fn1.insert(dot, ".1");
+			fn2.insert(dot, ".2");
+		} else {
+			fn1 += ".1";
+			fn2 += ".2";
+		}
+	}
+	fn1 = dir + fn1;
+	fn2 = dir + fn2;
+}
+
 static string argstr;
 
+/**
+ * Construct the forward index for adjIdxBase.  Only the header is read
+ * here; the big arrays are loaded by loadIntoMemory().
+ */
+static Ebwt* newEbwtFw() {
+	return new Ebwt(
+		adjIdxBase,
+	    0,        // index is colorspace
+		-1,       // fw index
+	    true,     // index is for the forward direction
+	    /* overriding: */ offRate,
+		0, // amount to add to index offrate or <= 0 to do nothing
+	    useMm,    // whether to use memory-mapped files
+	    useShmem, // whether to use shared memory
+	    useHugePages, // back large arrays with huge pages
+	    mmSweep,  // sweep memory-mapped files
+	    !noRefNames, // load names?
+		true,        // load SA sample?
+		true,        // load ftab?
+		true,        // load rstarts?
+	    gVerbose, // whether to be talkative
+	    startVerbose, // talkative during initialization
+	    false /*passMemExc*/,
+	    sanityCheck);
+}
+
+/**
+ * Construct the mirror index for adjIdxBase.
+ */
+static Ebwt* newEbwtBw() {
+	return new Ebwt(
+		adjIdxBase + ".rev",
+		0,       // index is colorspace
+		1,       // TODO: maybe not
+	    false, // index is for the reverse direction
+	    /* overriding: */ offRate,
+		0, // amount to add to index offrate or <= 0 to do nothing
+	    useMm,    // whether to use memory-mapped files
+	    useShmem, // whether to use shared memory
+	    useHugePages, // back large arrays with huge pages
+	    mmSweep,  // sweep memory-mapped files
+	    !noRefNames, // load names?
+		true,        // load SA sample?
+		true,        // load ftab?
+		true,        // load rstarts?
+	    gVerbose,    // whether to be talkative
+	    startVerbose, // talkative during initialization
+	    false /*passMemExc*/,
+	    sanityCheck);
+}
+
+// Index and reference kept in memory between jobs by a --server
+static string residentKey;              // residentIndexKey() they match
+static Ebwt* residentFw = NULL;         // forward index
+static Ebwt* residentBw = NULL;         // mirror index
+static BitPairReference* residentRefs = NULL; // bitpacked reference
+
+/**
+ * Return the current working directory, or an empty string if it can't
+ * be determined.
+ */
+static string workingDir() {
+	char cwd[PATH_MAX];
+	if(getcwd(cwd, sizeof(cwd)) == NULL) {
+		return string();
+	}
+	return string(cwd);
+}
+
+/**
+ * Return 'path' made absolute against the current working directory.
+ */
+static string absolutePath(const string& path) {
+	if(path.empty() || path[0] == '/') {
+		return path;
+	}
+	return workingDir() + "/" + path;
+}
+
+/**
+ * Summarize the index basename and the options that change what gets
+ * loaded for it; a job can use the resident index iff this matches.
+ * Jobs run in their clients' working directories, so the basename is
+ * made absolute.
+ */
+static string residentIndexKey() {
+	ostringstream os;
+	os << absolutePath(adjIdxBase) << '\t' << offRate << '\t' << noRefNames << '\t'
+	   << useMm << useShmem << useHugePages;
+	return os.str();
+}
+
+/**
+ * Load the forward and mirror indexes and the reference for adjIdxBase
+ * in full, to be kept for the lifetime of a --server.  The mirror index
+ * is always loaded so that jobs allowing seed mismatches can use it.
+ */
+static void loadResidentIndex() {
+	Timer _t(cerr, "Time loading resident index: ", timing);
+	residentFw = newEbwtFw();
+	residentFw->loadIntoMemory(
+		0,            // colorspace?
+		-1,           // not the reverse index
+		true,         // load SA samp
+		true,         // load ftab
+		true,         // load rstarts
+		!noRefNames,  // load names?
+		startVerbose);
+	residentBw = newEbwtBw();
+	residentBw->loadIntoMemory(
+		0,            // colorspace?
+		1,            // reverse of the concatenated strings
+		false,        // don't load SA samp in reverse index
+		true,         // need ftab in reverse index
+		false,        // don't load rstarts in reverse index
+		!noRefNames,  // load names?
+		startVerbose);
+	residentRefs = newBitPairReference();
+	if(!residentRefs->loaded()) throw 1;
+	residentKey = residentIndexKey();
+}
+
+/**
+ * Free the resident index and reference.
+ */
+static void freeResidentIndex() {
+	delete residentFw;
+	delete residentBw;
+	delete residentRefs;
+	residentFw = residentBw = NULL;
+	residentRefs = NULL;
+	residentKey.clear();
+}
+
+// Reads and records of the bt2_align() call in progress, if any
+static const EList<MemoryRead>* libReads1 = NULL; // unpaired reads or mate 1s
+static const EList<MemoryRead>* libReads2 = NULL; // mate 2s, or empty
+static EList<AlnRecord>*        libRecs = NULL;   // records collected
+
 template<typename TStr>
 static void driver(
 	const char * type,
@@ -4283,6 +4654,16 @@ static void driver(
 	if(gVerbose || startVerbose)  {
 		cerr << "Entered driver(): "; logTime(cerr, true);
 	}
+	SwAligner::initEditFilter(doEditFilter);
+	if(gVerbose) {
+		cerr << "SIMD code paths: popcount: "
+#ifdef POPCNT_CAPABILITY
+		     << (ProcessorSupport::instance().POPCNTenabled() ? "POPCNT" : "generic")
+#else
+		     << "generic"
+#endif
+		     << ", read parsing: " << (seqHasAvx2() ? "AVX2" : "SSE2") << endl;
+	}
 	// Vector of the reference sequences; used for sanity-checking
 	EList<SString<char> > names, os;
 	EList<size_t> nameLens, seqLens;
@@ -4304,78 +4685,88 @@ static void driver(
 		fuzzy,         // true -> try to parse fuzzy fastq
 		fastaContLen,  // length of sampled reads for FastaContinuous...
 		fastaContFreq, // frequency of sampled reads for FastaContinuous...
-		skipReads      // skip the first 'skip' patterns
+		skipReads,     // skip the first 'skip' patterns
+		readsPerBatch, // # reads/pairs a thread claims from the input at once
+		mmapReads      // true -> memory-map uncompressed FASTQ read files
 	);
 	if(gVerbose || startVerbose) {
 		cerr << "Creating PatternSource: "; logTime(cerr, true);
 	}
-	PairedPatternSource *patsrc = PairedPatternSource::setupPatternSources(
-		queries,     // singles, from argv
-		mates1,      // mate1's, from -1 arg
-		mates2,      // mate2's, from -2 arg
-		mates12,     // both mates on each line, from --12 arg
-		qualities,   // qualities associated with singles
-		qualities1,  // qualities associated with m1
-		qualities2,  // qualities associated with m2
-		pp,          // read read-in parameters
-		gVerbose || startVerbose); // be talkative
+	PairedPatternSource *patsrc = NULL;
+	if(libReads1 != NULL) {
+		// Reads come from the caller of bt2_align()
+		EList<PatternSource*>* srcs = new EList<PatternSource*>();
+		srcs->push_back(new MemoryPatternSource(*libReads1, *libReads2, pp));
+		patsrc = new PairedSoloPatternSource(srcs, pp);
+	} else {
+		patsrc = PairedPatternSource::setupPatternSources(
+			queries,     // singles, from argv
+			mates1,      // mate1's, from -1 arg
+			mates2,      // mate2's, from -2 arg
+			mates12,     // both mates on each line, from --12 arg
+			qualities,   // qualities associated with singles
+			qualities1,  // qualities associated with m1
+			qualities2,  // qualities associated with m2
+			pp,          // read read-in parameters
+			gVerbose || startVerbose); // be talkative
+	}
 	// Open hit output file
 	if(gVerbose || startVerbose) {
 		cerr << "Opening hit output file: "; logTime(cerr, true);
 	}
 	OutFileBuf *fout;
-	if(!outfile.empty()) {
-		fout = new OutFileBuf(outfile.c_str(), false);
+	if(libRecs != NULL) {
+		// bt2_align() returns records rather than writing any output
+		outType = OUTPUT_SAM;
+		fout = new OutFileBuf();
+	} else if(!outfile.empty()) {
+		fout = new OutFileBuf(outfile.c_str(), outType == OUTPUT_BAM);
 	} else {
 		fout = new OutFileBuf();
 	}
+	// Open files for reads sorted by whether they aligned
+	ReadOutFiles rdout(
+		reorder && nthreads > 1, // whether to reorder when there's >1 thread
+		nthreads,                // # threads
+		skipReads,               // first read will have this rdid
+		readsPerBatch);          // # reads a thread claims at once
+	{
+		string fn1, fn2;
+		if(!unFn.empty()) {
+			readOutFileNames(unFn, "un", false, fn1, fn2);
+			rdout.open(RDOUT_UN, fn1, unFmt);
+		}
+		if(!alFn.empty()) {
+			readOutFileNames(alFn, "al", false, fn1, fn2);
+			rdout.open(RDOUT_AL, fn1, alFmt);
+		}
+		if(!unConcFn.empty()) {
+			readOutFileNames(unConcFn, "un-conc", true, fn1, fn2);
+			rdout.open(RDOUT_UN_CONC1, fn1, unConcFmt);
+			rdout.open(RDOUT_UN_CONC2, fn2, unConcFmt);
+		}
+		if(!alConcFn.empty()) {
+			readOutFileNames(alConcFn, "al-conc", true, fn1, fn2);
+			rdout.open(RDOUT_AL_CONC1, fn1, alConcFmt);
+			rdout.open(RDOUT_AL_CONC2, fn2, alConcFmt);
+		}
+	}
 	// Initialize Ebwt object and read in header
 	if(gVerbose || startVerbose) {
 		cerr << "About to initialize fw Ebwt: "; logTime(cerr, true);
 	}
 	adjIdxBase = adjustEbwtBase(argv0, bt2indexBase, gVerbose);
-	Ebwt ebwt(
-		adjIdxBase,
-	    0,        // index is colorspace
-		-1,       // fw index
-	    true,     // index is for the forward direction
-	    /* overriding: */ offRate,
-		0, // amount to add to index offrate or <= 0 to do nothing
-	    useMm,    // whether to use memory-mapped files
-	    useShmem, // whether to use shared memory
-	    mmSweep,  // sweep memory-mapped files
-	    !noRefNames, // load names?
-		true,        // load SA sample?
-		true,        // load ftab?
-		true,        // load rstarts?
-	    gVerbose, // whether to be talkative
-	    startVerbose, // talkative during initialization
-	    false /*passMemExc*/,
-	    sanityCheck);
-	Ebwt* ebwtBw = NULL;
+	// A server keeps its index loaded between the jobs that use it
+	bool resident = !residentKey.empty() && residentKey == residentIndexKey();
+	Ebwt* ebwtFw = resident ? residentFw : newEbwtFw();
+	Ebwt& ebwt = *ebwtFw;
+	Ebwt* ebwtBw = resident ? residentBw : NULL;
 	// We need the mirror index if mismatches are allowed
-	if(multiseedMms > 0 || do1mmUpFront) {
+	if(!resident && (multiseedMms > 0 || do1mmUpFront)) {
 		if(gVerbose || startVerbose) {
 			cerr << "About to initialize rev Ebwt: "; logTime(cerr, true);
 		}
-		ebwtBw = new Ebwt(
-			adjIdxBase + ".rev",
-			0,       // index is colorspace
-			1,       // TODO: maybe not
-		    false, // index is for the reverse direction
-		    /* overriding: */ offRate,
-			0, // amount to add to index offrate or <= 0 to do nothing
-		    useMm,    // whether to use memory-mapped files
-		    useShmem, // whether to use shared memory
-		    mmSweep,  // sweep memory-mapped files
-		    !noRefNames, // load names?
-			true,        // load SA sample?
-			true,        // load ftab?
-			true,        // load rstarts?
-		    gVerbose,    // whether to be talkative
-		    startVerbose, // talkative during initialization
-		    false /*passMemExc*/,
-		    sanityCheck);
+		ebwtBw = newEbwtBw();
 	}
 	if(sanityCheck && !os.empty()) {
 		// Sanity check number of patterns and pattern lengths in Ebwt
@@ -4386,7 +4777,7 @@ static void driver(
 		}
 	}
 	// Sanity-check the restored version of the Ebwt
-	if(sanityCheck && !os.empty()) {
+	if(sanityCheck && !os.empty() && !resident) {
 		ebwt.loadIntoMemory(
 			0,
 			-1, // fw index
@@ -4403,7 +4794,10 @@ static void driver(
 		reorder && nthreads > 1, // whether to reorder when there's >1 thread
 		nthreads,                // # threads
 		nthreads > 1,            // whether to be thread-safe
-		skipReads);              // first read will have this rdid
+		skipReads,               // first read will have this rdid
+		outType == OUTPUT_BAM,   // compress into BGZF blocks
+		readsPerBatch,           // # reads a thread claims at once
+		outBufKb * 1024);        // per-thread output buffer size
 	{
 		Timer _t(cerr, "Time searching: ", timing);
 		// Set up penalities
@@ -4485,13 +4879,23 @@ static void driver(
 		// then instruct the sink to "retain" hits in a vector in
 		// memory so that we can easily sanity check them later on
 		AlnSink *mssink = NULL;
-		switch(outType) {
+		switch(libRecs != NULL ? OUTPUT_RECORDS : outType) {
+			case OUTPUT_RECORDS: {
+				mssink = new AlnSinkRecords(
+					oq,           // output queue
+					samc,         // settings & routines for SAM output
+					refnames,     // reference names
+					gQuiet,       // don't print alignment summary at end
+					*libRecs);    // records for bt2_align()'s caller
+				break;
+			}
 			case OUTPUT_SAM: {
 				mssink = new AlnSinkSam(
 					oq,           // output queue
 					samc,         // settings & routines for SAM output
 					refnames,     // reference names
-					gQuiet);      // don't print alignment summary at end
+					gQuiet,       // don't print alignment summary at end
+					rdout.any() ? &rdout : NULL); // --un/--al etc. files
 				if(!samNoHead) {
 					bool printHd = true, printSq = true;
 					BTString buf;
@@ -4500,6 +4904,27 @@ static void driver(
 				}
 				break;
 			}
+#ifdef WITH_ZLIB
+			case OUTPUT_BAM: {
+				mssink = new AlnSinkBam(
+					oq,           // output queue
+					samc,         // settings & routines for SAM output
+					refnames,     // reference names
+					gQuiet,       // don't print alignment summary at end
+					rdout.any() ? &rdout : NULL); // --un/--al etc. files
+				// BAM always has a header, but --no-hd and --no-sq still
+				// leave the corresponding lines out of its text part
+				BTString buf, zbuf;
+				if(samNoHead) {
+					samc.printBamHeader(buf, string(), rgs, false, false, false);
+				} else {
+					samc.printBamHeader(buf, rgid, rgs, true, !samNoSQ, true);
+				}
+				bgzfCompress(buf.buf(), buf.length(), zbuf);
+				fout->writeString(zbuf);
+				break;
+			}
+#endif
 			default:
 				cerr << "Invalid output type: " << outType << endl;
 				throw 1;
@@ -4521,13 +4946,17 @@ static void driver(
 			*mssink, // hit sink
 			ebwt,    // BWT
 			*ebwtBw, // BWT'
+			resident ? residentRefs : NULL,
 			metricsOfb);
-		// Evict any loaded indexes from memory
-		if(ebwt.isInMemory()) {
-			ebwt.evictFromMemory();
-		}
-		if(ebwtBw != NULL) {
-			delete ebwtBw;
+		if(!resident) {
+			// Evict any loaded indexes from memory
+			if(ebwt.isInMemory()) {
+				ebwt.evictFromMemory();
+			}
+			delete ebwtFw;
+			if(ebwtBw != NULL) {
+				delete ebwtBw;
+			}
 		}
 		if(!gQuiet && !seedSumm) {
 			size_t repThresh = mhits;
@@ -4543,6 +4972,12 @@ static void driver(
 		oq.flush(true);
 		assert_eq(oq.numStarted(), oq.numFinished());
 		assert_eq(oq.numStarted(), oq.numFlushed());
+#ifdef WITH_ZLIB
+		if(outType == OUTPUT_BAM) {
+			fout->writeChars((const char *)BGZF_EOF, sizeof(BGZF_EOF));
+		}
+#endif
+		rdout.close();
 		delete patsrc;
 		delete mssink;
 		delete metricsOfb;
@@ -4552,6 +4987,98 @@ static void driver(
 	}
 }
 
+extern "C" {
+	int bowtie(int argc, const char **argv);
+}
+
+/**
+ * Load the index once, then run the alignment jobs that --connect
+ * clients send to the Unix domain socket named by --server, one at a
+ * time, for as long as the process lives.  The server's own arguments,
+ * minus --server, are the defaults for every job; a job's arguments are
+ * appended to them.  While a job runs, the client's stdin, stdout and
+ * stderr replace the server's.
+ */
+static int runServer(int argc, const char **argv) {
+	string sock = serverSock;
+	EList<string> baseArgs;
+	for(int i = 0; i < argc; i++) {
+		string arg(argv[i]);
+		if(arg == "--server") {
+			i++;
+			continue;
+		}
+		if(arg.compare(0, 9, "--server=") == 0) continue;
+		baseArgs.push_back(arg);
+	}
+	adjIdxBase = adjustEbwtBase(argv0, bt2index, gVerbose);
+	loadResidentIndex();
+	// Jobs run in their clients' working directories, so name our index
+	// by its absolute path; a job's own -x, coming later, still wins
+	baseArgs.push_back("-x");
+	baseArgs.push_back(absolutePath(adjIdxBase));
+	string serverDir = workingDir();
+	if(serverDir.empty()) {
+		perror("getcwd");
+		cerr << "Error: Could not get the server's working directory" << endl;
+		throw 1;
+	}
+#ifdef SIGPIPE
+	// A client that goes away mid-job must not take the server with it
+	signal(SIGPIPE, SIG_IGN);
+#endif
+	int lfd = jobServerListen(sock);
+	if(!gQuiet) {
+		cerr << "Serving alignment jobs on " << sock.c_str() << endl;
+	}
+	int saved[3] = { dup(0), dup(1), dup(2) };
+	string jobDir;
+	EList<string> args, jobArgs;
+	EList<const char *> jobArgv;
+	while(true) {
+		int fds[3];
+		int cfd = jobServerAccept(lfd, jobDir, args, fds);
+		if(cfd < 0) continue;
+		jobArgs = baseArgs;
+		for(size_t i = 0; i < args.size(); i++) {
+			jobArgs.push_back(args[i]);
+		}
+		jobArgv.clear();
+		for(size_t i = 0; i < jobArgs.size(); i++) {
+			jobArgv.push_back(jobArgs[i].c_str());
+		}
+		fflush(stdout);
+		for(int i = 0; i < 3; i++) {
+			dup2(fds[i], i);
+			close(fds[i]);
+		}
+		clearerr(stdin);
+		int ret = 1;
+		if(chdir(jobDir.c_str()) != 0) {
+			// Reported on the client's stderr
+			perror("chdir");
+			cerr << "Error: Server could not change to the job's working directory "
+			     << jobDir.c_str() << endl;
+		} else {
+			ret = bowtie((int)jobArgv.size(), jobArgv.ptr());
+		}
+		cout.flush();
+		fflush(stdout);
+		for(int i = 0; i < 3; i++) {
+			dup2(saved[i], i);
+		}
+		clearerr(stdin);
+		if(chdir(serverDir.c_str()) != 0) {
+			perror("chdir");
+			cerr << "Error: Could not return to the server's working directory "
+			     << serverDir.c_str() << endl;
+			throw 1;
+		}
+		jobServerReply(cfd, ret);
+	}
+	return 0;
+}
+
 // C++ name mangling is disabled for the bowtie() function to make it
 // easier to use Bowtie as a library.
 extern "C" {
@@ -4566,6 +5093,8 @@ int bowtie(int argc, const char **argv) {
 		// Reset all global state, including getopt state
 		opterr = optind = 1;
 		resetOptions();
+		metrics.reset();
+		argstr.clear();
 		for(int i = 0; i < argc; i++) {
 			argstr += argv[i];
 			if(i < argc-1) argstr += " ";
@@ -4573,6 +5102,24 @@ int bowtie(int argc, const char **argv) {
 		if(startVerbose) { cerr << "Entered main(): "; logTime(cerr, true); }
 		parseOptions(argc, argv);
 		argv0 = argv[0];
+		if(!residentKey.empty() && (!serverSock.empty() || !connectSock.empty())) {
+			cerr << "Error: --server and --connect can't be given to a job run by a server" << endl;
+			return 1;
+		}
+		if(!connectSock.empty()) {
+			// Forward everything but --connect to the server
+			EList<string> args;
+			for(int i = 1; i < argc; i++) {
+				string arg(argv[i]);
+				if(arg == "--connect") {
+					i++;
+					continue;
+				}
+				if(arg.compare(0, 10, "--connect=") == 0) continue;
+				args.push_back(arg);
+			}
+			return jobClientRun(connectSock, args);
+		}
 		if(showVersion) {
 			cout << argv0 << " version " << BOWTIE2_VERSION << endl;
 			if(sizeof(void*) == 4) {
@@ -4605,9 +5152,13 @@ int bowtie(int argc, const char **argv) {
 				printUsage(cerr);
 				return 1;
 			}
+			if(!serverSock.empty()) {
+				return runServer(argc, argv);
+			}
 
 			// Get query filename
-			bool got_reads = !queries.empty() || !mates1.empty() || !mates12.empty();
+			bool got_reads = libReads1 != NULL ||
+			                 !queries.empty() || !mates1.empty() || !mates12.empty();
 			if(optind >= argc) {
 				if(!got_reads) {
 					printUsage(cerr);
@@ -4693,3 +5244,170 @@ int bowtie(int argc, const char **argv) {
 	}
 } // bowtie()
 } // extern "C"
+
+/**
+ * State behind a bt2_index handle.  The index itself is the resident one
+ * that a --server would keep; the handle holds what's needed to run jobs
+ * against it.
+ */
+struct bt2_index {
+	EList<string> args;     // options given to bt2_index_load()
+	EList<string> refnames; // reference sequence names
+};
+
+// Serializes calls into the library, since they share global state
+static MUTEX_T libMutex;
+
+/**
+ * Copy a string into a buffer allocated with malloc().
+ */
+static char *libStrdup(const BTString& s) {
+	char *r = (char *)malloc(s.length() + 1);
+	if(r == NULL) throw std::bad_alloc();
+	memcpy(r, s.buf(), s.length());
+	r[s.length()] = '\0';
+	return r;
+}
+
+extern "C" {
+
+bt2_index *bt2_index_load(int argc, const char **argv) {
+	ThreadSafe ts(&libMutex);
+	if(!residentKey.empty()) {
+		cerr << "Error: Only one index can be loaded at a time" << endl;
+		return NULL;
+	}
+	try {
+		opterr = optind = 1;
+		resetOptions();
+		parseOptions(argc, argv);
+		argv0 = argv[0];
+		if(bt2index.empty()) {
+			cerr << "Error: No index specified with -x" << endl;
+			return NULL;
+		}
+		if(!serverSock.empty() || !connectSock.empty()) {
+			cerr << "Error: --server and --connect can't be used with the library" << endl;
+			return NULL;
+		}
+		adjIdxBase = adjustEbwtBase(argv0, bt2index, gVerbose);
+		loadResidentIndex();
+		bt2_index *idx = new bt2_index;
+		for(int i = 0; i < argc; i++) {
+			idx->args.push_back(string(argv[i]));
+		}
+		readEbwtRefnames(adjIdxBase, idx->refnames);
+		return idx;
+	} catch(std::exception& e) {
+		cerr << "Error: Encountered exception: '" << e.what() << "'" << endl;
+	} catch(int e) { }
+	freeResidentIndex();
+	return NULL;
+}
+
+void bt2_index_free(bt2_index *idx) {
+	if(idx == NULL) return;
+	ThreadSafe ts(&libMutex);
+	freeResidentIndex();
+	delete idx;
+}
+
+size_t bt2_index_nrefs(const bt2_index *idx) {
+	return idx->refnames.size();
+}
+
+const char *bt2_index_refname(const bt2_index *idx, size_t refid) {
+	return idx->refnames[refid].c_str();
+}
+
+int bt2_align(
+	bt2_index *idx,
+	int argc,
+	const char **argv,
+	const bt2_read *reads1,
+	const bt2_read *reads2,
+	size_t n,
+	bt2_record **recs,
+	size_t *nrecs)
+{
+	ThreadSafe ts(&libMutex);
+	*recs = NULL;
+	*nrecs = 0;
+	EList<MemoryRead> m1, m2;
+	EList<AlnRecord> out;
+	EList<const char *> args;
+	try {
+		for(size_t i = 0; i < n; i++) {
+			MemoryRead m = { reads1[i].name, reads1[i].seq, reads1[i].qual };
+			m1.push_back(m);
+			if(reads2 != NULL) {
+				MemoryRead m = { reads2[i].name, reads2[i].seq, reads2[i].qual };
+				m2.push_back(m);
+			}
+		}
+		for(size_t i = 0; i < idx->args.size(); i++) {
+			args.push_back(idx->args[i].c_str());
+		}
+		for(int i = 0; i < argc; i++) {
+			args.push_back(argv[i]);
+		}
+	} catch(std::bad_alloc& e) {
+		cerr << "Error: Out of memory" << endl;
+		return 1;
+	}
+	libReads1 = &m1;
+	libReads2 = &m2;
+	libRecs = &out;
+	int ret = bowtie((int)args.size(), args.ptr());
+	libReads1 = libReads2 = NULL;
+	libRecs = NULL;
+	if(ret != 0) {
+		return ret;
+	}
+	// Records from different threads are interleaved; put them in read
+	// order, keeping each read's records in the order they were made
+	EList<pair<TReadId, size_t> > order;
+	bt2_record *rs = NULL;
+	size_t nrs = 0;
+	try {
+		for(size_t i = 0; i < out.size(); i++) {
+			order.push_back(make_pair(out[i].rdid, i));
+		}
+		order.sort();
+		rs = (bt2_record *)calloc(out.size() + 1, sizeof(bt2_record));
+		if(rs == NULL) throw std::bad_alloc();
+		for(; nrs < out.size(); nrs++) {
+			const AlnRecord& rec = out[order[nrs].second];
+			bt2_record& r = rs[nrs];
+			r.read = (size_t)rec.rdid;
+			r.mate = rec.mate;
+			r.flag = rec.flag;
+			r.refid = rec.refid;
+			r.pos = rec.pos;
+			r.mapq = rec.mapq;
+			r.next_refid = rec.nrefid;
+			r.next_pos = rec.npos;
+			r.isize = rec.isize;
+			r.cigar = libStrdup(rec.cigar);
+			r.opts = libStrdup(rec.opts);
+		}
+	} catch(std::bad_alloc& e) {
+		cerr << "Error: Out of memory" << endl;
+		bt2_records_free(rs, rs == NULL ? 0 : min(nrs + 1, out.size()));
+		return 1;
+	}
+	*recs = rs;
+	*nrecs = nrs;
+	return 0;
+}
+
+void bt2_records_free(bt2_record *recs, size_t nrecs) {
+	if(recs == NULL) return;
+	for(size_t i = 0; i < nrecs; i++) {
+		free(recs[i].cigar);
+		free(recs[i].opts);
+	}
+	free(recs);
+}
+
+} // extern "C"
@@ -0,0 +1,467 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COMPRESS_H_
+#define COMPRESS_H_
+
+#include <iostream>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#ifdef WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef WITH_BZIP2
+#include <bzlib.h>
+#endif
+#ifndef WITH_TBB
+#include "tinythread.h"
+#endif
+#include "assert_helpers.h"
+#include "decompress.h"
+
+/**
+ * Abstract parent for a sink that compresses bytes and writes them out.
+ */
+class Compressor {
+
+public:
+
+	virtual ~Compressor() { }
+
+	/**
+	 * Compress the 'len' bytes at 'src' and write out whatever output
+	 * the compressor has ready.
+	 */
+	virtual void write(const uint8_t *src, size_t len) = 0;
+
+	/**
+	 * Compress anything still pending and end the stream.  Must be called
+	 * once, after the last write(); the underlying FILE* is left open.
+	 */
+	virtual void finish() = 0;
+
+	/**
+	 * Return a new compressor writing to 'out', whose name is 'name', in
+	 * the given format.  If the format wasn't compiled in, print an error
+	 * and throw 1.
+	 */
+	static Compressor* create(FILE *out, int fmt, const char *name);
+};
+
+/**
+ * Abstract parent for a compressor that writes compressed bytes to a
+ * FILE* in large chunks; subclasses wrap a particular compression
+ * library.
+ */
+class FileCompressor : public Compressor {
+
+public:
+
+	FileCompressor(FILE *out, const char *name) : out_(out), name_(name) { }
+
+protected:
+
+	/**
+	 * Write the first 'n' bytes of outbuf_ to the file.
+	 */
+	void put(size_t n) {
+		if(n > 0 && fwrite(outbuf_, 1, n, out_) != n) {
+			std::cerr << "Error: could not write to output file " << name_ << std::endl;
+			throw 1;
+		}
+	}
+
+	static const size_t OUT_SZ = 256 * 1024;
+	FILE       *out_;
+	const char *name_;
+	uint8_t     outbuf_[OUT_SZ];  // compressed output
+};
+
+#ifdef WITH_ZLIB
+/**
+ * Compress to a single gzip member with zlib, at gzip's default level.
+ */
+class GzipCompressor : public FileCompressor {
+
+public:
+
+	GzipCompressor(FILE *out, const char *name) : FileCompressor(out, name) {
+		memset(&zs_, 0, sizeof(zs_));
+		// 15 + 16: maximum window size, write a gzip header
+		if(deflateInit2(&zs_, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+		                Z_DEFAULT_STRATEGY) != Z_OK)
+		{
+			std::cerr << "Error: could not initialize zlib" << std::endl;
+			throw 1;
+		}
+	}
+
+	virtual ~GzipCompressor() {
+		deflateEnd(&zs_);
+	}
+
+	virtual void write(const uint8_t *src, size_t len) {
+		zs_.next_in = (Bytef *)src;
+		zs_.avail_in = (uInt)len;
+		do {
+			zs_.next_out = outbuf_;
+			zs_.avail_out = (uInt)OUT_SZ;
+			deflate(&zs_, Z_NO_FLUSH);
+			put(OUT_SZ - zs_.avail_out);
+		} while(zs_.avail_out == 0);
+		assert_eq(0, zs_.avail_in);
+	}
+
+	virtual void finish() {
+		int ret;
+		zs_.next_in = NULL;
+		zs_.avail_in = 0;
+		do {
+			zs_.next_out = outbuf_;
+			zs_.avail_out = (uInt)OUT_SZ;
+			ret = deflate(&zs_, Z_FINISH);
+			put(OUT_SZ - zs_.avail_out);
+		} while(ret == Z_OK);
+		if(ret != Z_STREAM_END) {
+			std::cerr << "Error: could not finish gzip output to " << name_ << std::endl;
+			throw 1;
+		}
+	}
+
+private:
+
+	z_stream zs_;
+};
+#endif
+
+#ifdef WITH_BZIP2
+/**
+ * Compress to a single bzip2 stream with libbz2, at bzip2's default
+ * block size.
+ */
+class Bzip2Compressor : public FileCompressor {
+
+public:
+
+	Bzip2Compressor(FILE *out, const char *name) : FileCompressor(out, name) {
+		memset(&bs_, 0, sizeof(bs_));
+		if(BZ2_bzCompressInit(&bs_, 9, 0, 0) != BZ_OK) {
+			std::cerr << "Error: could not initialize libbz2" << std::endl;
+			throw 1;
+		}
+	}
+
+	virtual ~Bzip2Compressor() {
+		BZ2_bzCompressEnd(&bs_);
+	}
+
+	virtual void write(const uint8_t *src, size_t len) {
+		bs_.next_in = (char *)src;
+		bs_.avail_in = (unsigned int)len;
+		while(bs_.avail_in > 0) {
+			bs_.next_out = (char *)outbuf_;
+			bs_.avail_out = (unsigned int)OUT_SZ;
+			if(BZ2_bzCompress(&bs_, BZ_RUN) != BZ_RUN_OK) {
+				std::cerr << "Error: could not bzip2-compress output to " << name_ << std::endl;
+				throw 1;
+			}
+			put(OUT_SZ - bs_.avail_out);
+		}
+	}
+
+	virtual void finish() {
+		int ret;
+		bs_.next_in = NULL;
+		bs_.avail_in = 0;
+		do {
+			bs_.next_out = (char *)outbuf_;
+			bs_.avail_out = (unsigned int)OUT_SZ;
+			ret = BZ2_bzCompress(&bs_, BZ_FINISH);
+			put(OUT_SZ - bs_.avail_out);
+		} while(ret == BZ_FINISH_OK);
+		if(ret != BZ_STREAM_END) {
+			std::cerr << "Error: could not finish bzip2 output to " << name_ << std::endl;
+			throw 1;
+		}
+	}
+
+private:
+
+	bz_stream bs_;
+};
+#endif
+
+#ifdef WITH_ZLIB
+/**
+ * Maximum number of uncompressed bytes in a BGZF block.  Leaves room for
+ * the block header and footer, and for deflate's worst-case expansion,
+ * within BGZF's 64KB limit on the size of a compressed block.
+ */
+static const size_t BGZF_BLOCK_SZ = 0xff00;
+
+/**
+ * BGZF end-of-file marker: an empty block that ends every BGZF file.
+ */
+static const uint8_t BGZF_EOF[28] = {
+	0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00,
+	0x42, 0x43, 0x02, 0x00, 0x1b, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00
+};
+
+/**
+ * Compress the 'len' bytes at 'src' into BGZF blocks, as used by BAM, and
+ * append them to 'dst'.  Each block is an independent gzip member holding
+ * up to BGZF_BLOCK_SZ input bytes, so blocks compressed by different
+ * threads can be concatenated in any order that keeps records intact.
+ */
+template<typename TStr>
+static inline void bgzfCompress(const char *src, size_t len, TStr& dst) {
+	static const size_t HDR_SZ = 18, FTR_SZ = 8;
+	uint8_t blk[65536];
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	// -15: raw deflate; BGZF writes its own gzip header and footer
+	if(deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+	                Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+		std::cerr << "Error: could not initialize zlib" << std::endl;
+		throw 1;
+	}
+	while(len > 0) {
+		size_t n = std::min(len, BGZF_BLOCK_SZ);
+		zs.next_in = (Bytef *)src;
+		zs.avail_in = (uInt)n;
+		zs.next_out = blk + HDR_SZ;
+		zs.avail_out = (uInt)(sizeof(blk) - HDR_SZ - FTR_SZ);
+		if(deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+			std::cerr << "Error: BGZF block overflowed while compressing BAM output" << std::endl;
+			throw 1;
+		}
+		size_t bsz = HDR_SZ + zs.total_out + FTR_SZ;
+		static const uint8_t hdr[16] = {
+			0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff,
+			0x06, 0x00, 0x42, 0x43, 0x02, 0x00
+		};
+		memcpy(blk, hdr, sizeof(hdr));
+		blk[16] = (uint8_t)((bsz - 1) & 0xff);
+		blk[17] = (uint8_t)((bsz - 1) >> 8);
+		uint32_t crc = (uint32_t)crc32(crc32(0L, Z_NULL, 0), (const Bytef *)src, (uInt)n);
+		uint8_t *ftr = blk + bsz - FTR_SZ;
+		for(int i = 0; i < 4; i++) {
+			ftr[i]     = (uint8_t)(crc >> (8 * i));
+			ftr[i + 4] = (uint8_t)((uint32_t)n >> (8 * i));
+		}
+		dst.append((const char *)blk, bsz);
+		deflateReset(&zs);
+		src += n;
+		len -= n;
+	}
+	deflateEnd(&zs);
+}
+#endif
+
+#ifndef WITH_TBB
+/**
+ * Runs another Compressor in a dedicated thread.  Writers copy their bytes
+ * into a small ring of buffers and return; the thread compresses full
+ * buffers in the background.  Writers only wait when the ring is full.
+ */
+class ThreadedCompressor : public Compressor {
+
+public:
+
+	/**
+	 * Take ownership of 'comp' and start a thread to drive it.
+	 */
+	ThreadedCompressor(Compressor *comp) :
+		comp_(comp),
+		head_(0),
+		tail_(0),
+		nfull_(0),
+		stop_(false),
+		failed_(false),
+		thread_(NULL)
+	{
+		for(size_t i = 0; i < NSLOTS; i++) {
+			slots_[i].len = 0;
+		}
+		thread_ = new tthread::thread(ThreadedCompressor::drainWorker, (void *)this);
+	}
+
+	virtual ~ThreadedCompressor() {
+		stop();
+		delete comp_;
+	}
+
+	/**
+	 * Copy 'len' bytes into the ring, handing each slot that fills up to
+	 * the compression thread.
+	 */
+	virtual void write(const uint8_t *src, size_t len) {
+		while(len > 0) {
+			Slot& s = slots_[head_];
+			size_t n = std::min(len, SLOT_SZ - s.len);
+			memcpy(s.buf + s.len, src, n);
+			s.len += n;
+			src += n;
+			len -= n;
+			if(s.len == SLOT_SZ) {
+				handOff();
+			}
+		}
+	}
+
+	/**
+	 * Hand over the last partial slot, wait for the thread to compress
+	 * everything, and end the stream.
+	 */
+	virtual void finish() {
+		if(slots_[head_].len > 0) {
+			handOff();
+		}
+		stop();
+		if(failed_) {
+			throw 1; // error was already reported
+		}
+		comp_->finish();
+	}
+
+private:
+
+	/**
+	 * Hand slot 'head_' to the compression thread, waiting for a free
+	 * slot to write into next.
+	 */
+	void handOff() {
+		tthread::lock_guard<tthread::mutex> lg(mutex_);
+		head_ = (head_ + 1) % NSLOTS;
+		nfull_++;
+		cond_.notify_all();
+		while(nfull_ == NSLOTS && !failed_) {
+			cond_.wait(mutex_);
+		}
+		if(failed_) {
+			throw 1; // error was already reported
+		}
+		slots_[head_].len = 0;
+	}
+
+	/**
+	 * Ask the compression thread to quit once it has drained the ring,
+	 * and wait for it.
+	 */
+	void stop() {
+		if(thread_ == NULL) return;
+		{
+			tthread::lock_guard<tthread::mutex> lg(mutex_);
+			stop_ = true;
+			cond_.notify_all();
+		}
+		thread_->join();
+		delete thread_;
+		thread_ = NULL;
+	}
+
+	/**
+	 * Body of the compression thread: compress full slots until asked to
+	 * stop and the ring is empty.
+	 */
+	static void drainWorker(void *vp) {
+		ThreadedCompressor *tc = (ThreadedCompressor *)vp;
+		while(true) {
+			{
+				tthread::lock_guard<tthread::mutex> lg(tc->mutex_);
+				while(tc->nfull_ == 0 && !tc->stop_) {
+					tc->cond_.wait(tc->mutex_);
+				}
+				if(tc->nfull_ == 0) return;
+			}
+			Slot& s = tc->slots_[tc->tail_];
+			bool ok = true;
+			try {
+				tc->comp_->write(s.buf, s.len);
+			} catch(...) {
+				ok = false;
+			}
+			tthread::lock_guard<tthread::mutex> lg(tc->mutex_);
+			if(!ok) {
+				tc->failed_ = true;
+				tc->cond_.notify_all();
+				return;
+			}
+			tc->tail_ = (tc->tail_ + 1) % NSLOTS;
+			tc->nfull_--;
+			tc->cond_.notify_all();
+		}
+	}
+
+	static const size_t NSLOTS = 4;
+	static const size_t SLOT_SZ = 256 * 1024;
+
+	struct Slot {
+		uint8_t buf[SLOT_SZ];
+		size_t  len;
+	};
+
+	Compressor *comp_;      // compressor run by the worker thread
+	Slot    slots_[NSLOTS]; // ring of uncompressed buffers
+	size_t  head_;          // slot writers are filling
+	size_t  tail_;          // next slot for the worker to compress
+	size_t  nfull_;         // # slots handed off but not yet compressed
+	bool    stop_;          // no more slots are coming
+	bool    failed_;        // worker hit a compression or write error
+	tthread::mutex mutex_;
+	tthread::condition_variable cond_;
+	tthread::thread *thread_;
+};
+#endif
+
+/**
+ * Return a new compressor writing to 'out' in the given format.  Where
+ * threads are available, the compressor runs in a thread of its own.
+ */
+inline Compressor* Compressor::create(FILE *out, int fmt, const char *name) {
+	Compressor *comp = NULL;
+	switch(fmt) {
+#ifdef WITH_ZLIB
+		case COMPRESS_GZIP:
+			comp = new GzipCompressor(out, name);
+			break;
+#endif
+#ifdef WITH_BZIP2
+		case COMPRESS_BZIP2:
+			comp = new Bzip2Compressor(out, name);
+			break;
+#endif
+		default:
+			std::cerr << "Error: cannot write " << compressionName(fmt)
+			          << "-compressed output to " << name << " because this "
+			          << "binary was built without " << compressionName(fmt)
+			          << " support" << std::endl;
+			throw 1;
+	}
+#ifndef WITH_TBB
+	comp = new ThreadedCompressor(comp);
+#endif
+	return comp;
+}
+
+#endif /* COMPRESS_H_ */
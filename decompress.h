@@ -0,0 +1,536 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DECOMPRESS_H_
+#define DECOMPRESS_H_
+
+#include <iostream>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#ifdef WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef WITH_BZIP2
+#include <bzlib.h>
+#endif
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#endif
+#ifndef WITH_TBB
+#include "tinythread.h"
+#endif
+#include "assert_helpers.h"
+
+/**
+ * Compression formats we can recognize by the first few bytes of an
+ * input file.
+ */
+enum {
+	COMPRESS_NONE = 0,
+	COMPRESS_GZIP,  // gzip, including multi-member files such as BGZF
+	COMPRESS_BZIP2,
+	COMPRESS_ZSTD
+};
+
+/**
+ * Number of leading bytes needed to recognize any of the formats above.
+ */
+static const size_t COMPRESS_MAGIC_LEN = 4;
+
+/**
+ * Given the first 'len' bytes of a file, return the compression format
+ * it's in.
+ */
+static inline int compressionFromMagic(const uint8_t *b, size_t len) {
+	if(len >= 2 && b[0] == 0x1f && b[1] == 0x8b) {
+		return COMPRESS_GZIP;
+	}
+	if(len >= 3 && b[0] == 'B' && b[1] == 'Z' && b[2] == 'h') {
+		return COMPRESS_BZIP2;
+	}
+	if(len >= 4 && b[0] == 0x28 && b[1] == 0xb5 && b[2] == 0x2f && b[3] == 0xfd) {
+		return COMPRESS_ZSTD;
+	}
+	return COMPRESS_NONE;
+}
+
+/**
+ * Return a name for the compression format suitable for error messages.
+ */
+static inline const char *compressionName(int fmt) {
+	switch(fmt) {
+		case COMPRESS_GZIP:  return "gzip";
+		case COMPRESS_BZIP2: return "bzip2";
+		case COMPRESS_ZSTD:  return "zstd";
+		default:             return "uncompressed";
+	}
+}
+
+/**
+ * Abstract parent for a source of decompressed bytes.
+ */
+class Decompressor {
+
+public:
+
+	virtual ~Decompressor() { }
+
+	/**
+	 * Decompress up to 'len' bytes into 'dst' and return the number of
+	 * bytes written.  Returns less than 'len' only when the end of the
+	 * input is reached.
+	 */
+	virtual size_t read(uint8_t *dst, size_t len) = 0;
+
+	/**
+	 * Return a new decompressor for 'in', which is compressed with the
+	 * given format.  The first 'npre' bytes of the file were already
+	 * consumed (while looking for the magic number) and are in 'pre'.
+	 * If the format wasn't compiled in, print an error and throw 1.
+	 */
+	static Decompressor* create(
+		FILE *in,
+		int fmt,
+		const uint8_t *pre,
+		size_t npre);
+};
+
+/**
+ * Abstract parent for a decompressor that reads compressed bytes from a
+ * FILE* in large chunks; subclasses wrap a particular decompression
+ * library.
+ */
+class FileDecompressor : public Decompressor {
+
+public:
+
+	FileDecompressor(FILE *in, const uint8_t *pre, size_t npre) :
+		in_(in),
+		inlen_(npre)
+	{
+		assert_leq(npre, IN_SZ);
+		memcpy(inbuf_, pre, npre);
+	}
+
+protected:
+
+	/**
+	 * Read the next chunk of compressed bytes into inbuf_.  Returns the
+	 * number of bytes read; 0 means the file is exhausted.
+	 */
+	size_t refill() {
+		inlen_ = fread(inbuf_, 1, IN_SZ, in_);
+		return inlen_;
+	}
+
+	/**
+	 * Complain that the input ended partway through a compressed stream.
+	 */
+	static void truncated(const char *what) {
+		std::cerr << "Error: " << what << " read file ended unexpectedly; "
+		          << "it may be truncated" << std::endl;
+		throw 1;
+	}
+
+	static const size_t IN_SZ = 256 * 1024;
+	FILE    *in_;
+	size_t   inlen_;         // # bytes read into inbuf_ by last refill()
+	uint8_t  inbuf_[IN_SZ];  // compressed input
+};
+
+#ifdef WITH_ZLIB
+/**
+ * Decompress gzip input with zlib.  A file may consist of several gzip
+ * members, one after the other, as is the case for concatenated .gz files
+ * and for BGZF; we start a new stream after each member ends.
+ */
+class GzipDecompressor : public FileDecompressor {
+
+public:
+
+	GzipDecompressor(FILE *in, const uint8_t *pre, size_t npre) :
+		FileDecompressor(in, pre, npre),
+		inMember_(false)
+	{
+		memset(&zs_, 0, sizeof(zs_));
+		// 15 + 32: maximum window size, detect gzip/zlib header
+		if(inflateInit2(&zs_, 15 + 32) != Z_OK) {
+			std::cerr << "Error: could not initialize zlib" << std::endl;
+			throw 1;
+		}
+		zs_.next_in = inbuf_;
+		zs_.avail_in = (uInt)inlen_;
+	}
+
+	virtual ~GzipDecompressor() {
+		inflateEnd(&zs_);
+	}
+
+	virtual size_t read(uint8_t *dst, size_t len) {
+		zs_.next_out = dst;
+		zs_.avail_out = (uInt)len;
+		while(zs_.avail_out > 0) {
+			if(zs_.avail_in == 0) {
+				if(refill() == 0) {
+					if(inMember_) truncated("gzipped");
+					break;
+				}
+				zs_.next_in = inbuf_;
+				zs_.avail_in = (uInt)inlen_;
+			}
+			int ret = inflate(&zs_, Z_NO_FLUSH);
+			inMember_ = (ret != Z_STREAM_END);
+			if(ret == Z_STREAM_END) {
+				// End of one member; there may be another after it
+				if(zs_.avail_in == 0) {
+					if(refill() == 0) break;
+					zs_.next_in = inbuf_;
+					zs_.avail_in = (uInt)inlen_;
+				}
+				inflateReset(&zs_);
+			} else if(ret != Z_OK && ret != Z_BUF_ERROR) {
+				std::cerr << "Error: could not decompress gzipped read file: "
+				          << (zs_.msg != NULL ? zs_.msg : "corrupt input")
+				          << std::endl;
+				throw 1;
+			}
+		}
+		return len - zs_.avail_out;
+	}
+
+private:
+
+	z_stream zs_;
+	bool     inMember_; // true iff we're partway through a gzip member
+};
+#endif
+
+#ifdef WITH_BZIP2
+/**
+ * Decompress bzip2 input with libbz2.  As with gzip, a file may consist of
+ * several concatenated streams (e.g. as written by pbzip2).
+ */
+class Bzip2Decompressor : public FileDecompressor {
+
+public:
+
+	Bzip2Decompressor(FILE *in, const uint8_t *pre, size_t npre) :
+		FileDecompressor(in, pre, npre),
+		inStream_(false)
+	{
+		init();
+		bs_.next_in = (char *)inbuf_;
+		bs_.avail_in = (unsigned int)inlen_;
+	}
+
+	virtual ~Bzip2Decompressor() {
+		BZ2_bzDecompressEnd(&bs_);
+	}
+
+	virtual size_t read(uint8_t *dst, size_t len) {
+		bs_.next_out = (char *)dst;
+		bs_.avail_out = (unsigned int)len;
+		while(bs_.avail_out > 0) {
+			if(bs_.avail_in == 0) {
+				if(refill() == 0) {
+					if(inStream_) truncated("bzip2ed");
+					break;
+				}
+				bs_.next_in = (char *)inbuf_;
+				bs_.avail_in = (unsigned int)inlen_;
+			}
+			int ret = BZ2_bzDecompress(&bs_);
+			inStream_ = (ret != BZ_STREAM_END);
+			if(ret == BZ_STREAM_END) {
+				// End of one stream; there may be another after it
+				if(bs_.avail_in == 0) {
+					if(refill() == 0) break;
+					bs_.next_in = (char *)inbuf_;
+					bs_.avail_in = (unsigned int)inlen_;
+				}
+				char *next_in = bs_.next_in;
+				unsigned int avail_in = bs_.avail_in;
+				char *next_out = bs_.next_out;
+				unsigned int avail_out = bs_.avail_out;
+				BZ2_bzDecompressEnd(&bs_);
+				init();
+				bs_.next_in = next_in;
+				bs_.avail_in = avail_in;
+				bs_.next_out = next_out;
+				bs_.avail_out = avail_out;
+			} else if(ret != BZ_OK) {
+				std::cerr << "Error: could not decompress bzip2ed read file (error "
+				          << ret << ")" << std::endl;
+				throw 1;
+			}
+		}
+		return len - bs_.avail_out;
+	}
+
+private:
+
+	void init() {
+		memset(&bs_, 0, sizeof(bs_));
+		if(BZ2_bzDecompressInit(&bs_, 0, 0) != BZ_OK) {
+			std::cerr << "Error: could not initialize libbz2" << std::endl;
+			throw 1;
+		}
+	}
+
+	bz_stream bs_;
+	bool      inStream_; // true iff we're partway through a bzip2 stream
+};
+#endif
+
+#ifdef WITH_ZSTD
+/**
+ * Decompress zstd input with libzstd.  Consecutive frames are handled by
+ * the library.
+ */
+class ZstdDecompressor : public FileDecompressor {
+
+public:
+
+	ZstdDecompressor(FILE *in, const uint8_t *pre, size_t npre) :
+		FileDecompressor(in, pre, npre)
+	{
+		ds_ = ZSTD_createDStream();
+		if(ds_ == NULL || ZSTD_isError(ZSTD_initDStream(ds_))) {
+			std::cerr << "Error: could not initialize libzstd" << std::endl;
+			throw 1;
+		}
+		zin_.src = inbuf_;
+		zin_.size = inlen_;
+		zin_.pos = 0;
+		inFrame_ = false;
+	}
+
+	virtual ~ZstdDecompressor() {
+		ZSTD_freeDStream(ds_);
+	}
+
+	virtual size_t read(uint8_t *dst, size_t len) {
+		ZSTD_outBuffer zout = { dst, len, 0 };
+		while(zout.pos < zout.size) {
+			if(zin_.pos == zin_.size) {
+				if(refill() == 0) {
+					if(inFrame_) truncated("zstd-compressed");
+					break;
+				}
+				zin_.size = inlen_;
+				zin_.pos = 0;
+			}
+			size_t ret = ZSTD_decompressStream(ds_, &zout, &zin_);
+			if(ZSTD_isError(ret)) {
+				std::cerr << "Error: could not decompress zstd read file: "
+				          << ZSTD_getErrorName(ret) << std::endl;
+				throw 1;
+			}
+			// 0 means a frame was completely decoded and flushed
+			inFrame_ = (ret != 0);
+		}
+		return zout.pos;
+	}
+
+private:
+
+	ZSTD_DStream  *ds_;
+	ZSTD_inBuffer  zin_;
+	bool           inFrame_; // true iff we're partway through a zstd frame
+};
+#endif
+
+#ifndef WITH_TBB
+/**
+ * Runs another Decompressor in a dedicated thread that keeps a small ring
+ * of buffers filled ahead of the reader.  This takes decompression out of
+ * the critical section in which the search threads parse reads; the
+ * reader only has to copy out bytes that are already decompressed.
+ */
+class ThreadedDecompressor : public Decompressor {
+
+public:
+
+	/**
+	 * Take ownership of 'dec' and start decompressing from it.
+	 */
+	ThreadedDecompressor(Decompressor *dec) :
+		dec_(dec),
+		head_(0),
+		tail_(0),
+		nfull_(0),
+		off_(0),
+		stop_(false),
+		failed_(false),
+		thread_(NULL)
+	{
+		for(size_t i = 0; i < NSLOTS; i++) {
+			slots_[i].len = 0;
+		}
+		thread_ = new tthread::thread(ThreadedDecompressor::fillWorker, (void *)this);
+	}
+
+	virtual ~ThreadedDecompressor() {
+		{
+			tthread::lock_guard<tthread::mutex> lg(mutex_);
+			stop_ = true;
+			cond_.notify_all();
+		}
+		thread_->join();
+		delete thread_;
+		delete dec_;
+	}
+
+	/**
+	 * Copy up to 'len' decompressed bytes from the ring into 'dst',
+	 * waiting for the decompression thread if the ring is empty.
+	 */
+	virtual size_t read(uint8_t *dst, size_t len) {
+		size_t nread = 0;
+		while(nread < len) {
+			{
+				tthread::lock_guard<tthread::mutex> lg(mutex_);
+				while(nfull_ == 0 && !failed_) {
+					cond_.wait(mutex_);
+				}
+				if(failed_ && nfull_ == 0) {
+					throw 1; // error was already reported
+				}
+			}
+			Slot& s = slots_[tail_];
+			if(s.len == 0) {
+				break; // end of input; leave the empty slot in place
+			}
+			size_t n = std::min(len - nread, s.len - off_);
+			memcpy(dst + nread, s.buf + off_, n);
+			nread += n;
+			off_ += n;
+			if(off_ == s.len) {
+				// Hand the slot back to the decompression thread
+				off_ = 0;
+				tthread::lock_guard<tthread::mutex> lg(mutex_);
+				tail_ = (tail_ + 1) % NSLOTS;
+				nfull_--;
+				cond_.notify_all();
+			}
+		}
+		return nread;
+	}
+
+private:
+
+	/**
+	 * Body of the decompression thread: fill slots until the input is
+	 * exhausted (signalled with an empty slot) or we're asked to stop.
+	 */
+	static void fillWorker(void *vp) {
+		ThreadedDecompressor *td = (ThreadedDecompressor *)vp;
+		while(true) {
+			{
+				tthread::lock_guard<tthread::mutex> lg(td->mutex_);
+				while(td->nfull_ == NSLOTS && !td->stop_) {
+					td->cond_.wait(td->mutex_);
+				}
+				if(td->stop_) return;
+			}
+			Slot& s = td->slots_[td->head_];
+			bool ok = true;
+			try {
+				s.len = td->dec_->read(s.buf, SLOT_SZ);
+			} catch(...) {
+				ok = false;
+			}
+			tthread::lock_guard<tthread::mutex> lg(td->mutex_);
+			if(!ok) {
+				td->failed_ = true;
+				td->cond_.notify_all();
+				return;
+			}
+			td->head_ = (td->head_ + 1) % NSLOTS;
+			td->nfull_++;
+			td->cond_.notify_all();
+			if(s.len == 0) return;
+		}
+	}
+
+	static const size_t NSLOTS = 4;
+	static const size_t SLOT_SZ = 256 * 1024;
+
+	struct Slot {
+		uint8_t buf[SLOT_SZ];
+		size_t  len;
+	};
+
+	Decompressor *dec_;     // decompressor run by the worker thread
+	Slot    slots_[NSLOTS]; // ring of decompressed buffers
+	size_t  head_;          // next slot for the worker to fill
+	size_t  tail_;          // next slot for the reader to drain
+	size_t  nfull_;         // # slots filled but not yet drained
+	size_t  off_;           // reader's offset into slot 'tail_'
+	bool    stop_;          // reader wants the worker to quit
+	bool    failed_;        // worker hit a decompression error
+	tthread::mutex mutex_;
+	tthread::condition_variable cond_;
+	tthread::thread *thread_;
+};
+#endif
+
+/**
+ * Return a new decompressor for 'in', which is compressed with the given
+ * format.  Where threads are available, the decompressor runs in a thread
+ * of its own.
+ */
+inline Decompressor* Decompressor::create(
+	FILE *in,
+	int fmt,
+	const uint8_t *pre,
+	size_t npre)
+{
+	Decompressor *dec = NULL;
+	switch(fmt) {
+#ifdef WITH_ZLIB
+		case COMPRESS_GZIP:
+			dec = new GzipDecompressor(in, pre, npre);
+			break;
+#endif
+#ifdef WITH_BZIP2
+		case COMPRESS_BZIP2:
+			dec = new Bzip2Decompressor(in, pre, npre);
+			break;
+#endif
+#ifdef WITH_ZSTD
+		case COMPRESS_ZSTD:
+			dec = new ZstdDecompressor(in, pre, npre);
+			break;
+#endif
+		default:
+			std::cerr << "Error: input appears to be " << compressionName(fmt)
+			          << "-compressed, but this binary was built without "
+			          << compressionName(fmt) << " support" << std::endl;
+			throw 1;
+	}
+#ifndef WITH_TBB
+	dec = new ThreadedDecompressor(dec);
+#endif
+	return dec;
+}
+
+#endif /* DECOMPRESS_H_ */
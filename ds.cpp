@@ -22,29 +22,37 @@
 MemoryTally gMemTally;
 
 /**
- * Tally a memory allocation of size amt bytes.
+ * Raise *peak to at least cur.  The peak only changes when a new high
+ * is reached, so the compare-and-swap rarely has to retry.
  */
-void MemoryTally::add(int cat, uint64_t amt) {
-	ThreadSafe ts(&mutex_m);
-	tots_[cat] += amt;
-	tot_ += amt;
-	if(tots_[cat] > peaks_[cat]) {
-		peaks_[cat] = tots_[cat];
-	}
-	if(tot_ > peak_) {
-		peak_ = tot_;
+static inline void raisePeak(uint64_t *peak, uint64_t cur) {
+	uint64_t old = *peak;
+	while(cur > old) {
+		uint64_t prev = __sync_val_compare_and_swap(peak, old, cur);
+		if(prev == old) break;
+		old = prev;
 	}
 }
 
+/**
+ * Tally a memory allocation of size amt bytes.  Lock-free so that
+ * threads growing their lists don't serialize on a single mutex.
+ */
+void MemoryTally::add(int cat, uint64_t amt) {
+	uint64_t cattot = __sync_add_and_fetch(&tots_[cat], amt);
+	uint64_t tot = __sync_add_and_fetch(&tot_, amt);
+	raisePeak(&peaks_[cat], cattot);
+	raisePeak(&peak_, tot);
+}
+
 /**
  * Tally a memory free of size amt bytes.
  */
 void MemoryTally::del(int cat, uint64_t amt) {
-	ThreadSafe ts(&mutex_m);
 	assert_geq(tots_[cat], amt);
 	assert_geq(tot_, amt);
-	tots_[cat] -= amt;
-	tot_ -= amt;
+	__sync_sub_and_fetch(&tots_[cat], amt);
+	__sync_sub_and_fetch(&tot_, amt);
 }
 	
 #ifdef MAIN_DS
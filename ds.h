@@ -21,6 +21,7 @@
 #define DS_H_
 
 #include <algorithm>
+#include <new>
 #include <stdexcept>
 #include <utility>
 #include <stdint.h>
@@ -30,6 +31,7 @@
 #include "threading.h"
 #include "random_source.h"
 #include "btypes.h"
+#include "hugepage.h"
 
 /**
  * Tally how much memory is allocated to certain 
@@ -92,7 +94,8 @@ public:
 
 protected:
 
-	MUTEX_T mutex_m;
+	// Updated with atomic operations rather than under a lock; totals
+	// and peaks read while other threads are allocating may be stale
 	uint64_t tots_[256];
 	uint64_t tot_;
 	uint64_t peaks_[256];
@@ -235,11 +238,16 @@ public:
 
 	~APtrWrap() { free(); }
 	
-	void init(T* p, size_t sz, bool freeable = true) {
+	/**
+	 * If 'huge' is true, p was obtained from allocHugePages() and is
+	 * released with freeHugePages() rather than delete[].
+	 */
+	void init(T* p, size_t sz, bool freeable = true, bool huge = false) {
 		assert(p_ == NULL);
 		p_ = p;
 		sz_ = sz;
 		freeable_ = freeable;
+		huge_ = huge;
 		if(p != NULL && freeable_) {
 			gMemTally.add(cat_, sizeof(T) * sz_);
 		}
@@ -248,7 +256,11 @@ public:
 	void free() {
 		if(p_ != NULL) {
 			if(freeable_) {
-				delete[] p_;
+				if(huge_) {
+					freeHugePages(p_, sizeof(T) * sz_);
+				} else {
+					delete[] p_;
+				}
 				gMemTally.del(cat_, sizeof(T) * sz_);
 			}
 			p_ = NULL;
@@ -262,9 +274,163 @@ private:
 	int cat_;
 	T *p_;
 	bool freeable_;
+	bool huge_;
 	size_t sz_;
 };
 
+/**
+ * A bump allocator for scratch memory that lives no longer than one
+ * read.  Each worker thread owns one.  Allocations come out of a single
+ * block; if the block runs out they're satisfied from the heap instead,
+ * and the next reset() grows the block to the high-water mark so that
+ * in the steady state nothing is allocated per read.
+ */
+class Arena {
+public:
+
+	explicit Arena(int cat = 0) :
+		cat_(cat),
+		buf_(NULL),
+		sz_(0),
+		cur_(0),
+		over_(NULL),
+		overBytes_(0),
+		hwm_(0) { }
+
+	~Arena() {
+		freeOverflow();
+		if(buf_ != NULL) {
+			delete[] buf_;
+			gMemTally.del(cat_, sz_);
+		}
+	}
+
+	/**
+	 * Return a pointer to 'bytes' bytes of uninitialized memory aligned
+	 * to 16 bytes.
+	 */
+	void *alloc(size_t bytes) {
+		bytes = (bytes + 15) & ~((size_t)15);
+		if(cur_ + bytes <= sz_) {
+			void *p = buf_ + cur_;
+			cur_ += bytes;
+			if(cur_ + overBytes_ > hwm_) hwm_ = cur_ + overBytes_;
+			return p;
+		}
+		// Doesn't fit; use the heap until the next reset()
+		uint8_t *p = new uint8_t[bytes + 16];
+		gMemTally.add(cat_, bytes + 16);
+		*(uint8_t**)p = over_;
+		*(size_t*)(p + sizeof(uint8_t*)) = bytes + 16;
+		over_ = p;
+		overBytes_ += bytes;
+		if(cur_ + overBytes_ > hwm_) hwm_ = cur_ + overBytes_;
+		return p + 16;
+	}
+
+	/**
+	 * Return a mark that release() can later roll the arena back to.
+	 */
+	size_t mark() const { return cur_; }
+
+	/**
+	 * Give back everything allocated from the block since mark() returned
+	 * 'm'.  Heap overflow is given back at the next reset().
+	 */
+	void release(size_t m) {
+		assert_leq(m, cur_);
+		cur_ = m;
+	}
+
+	/**
+	 * Give back everything.  If anything overflowed onto the heap since
+	 * the last reset(), replace the block with one as large as the
+	 * high-water mark.
+	 */
+	void reset() {
+		cur_ = 0;
+		if(over_ != NULL) {
+			freeOverflow();
+			if(buf_ != NULL) {
+				delete[] buf_;
+				gMemTally.del(cat_, sz_);
+			}
+			sz_ = hwm_;
+			buf_ = new uint8_t[sz_];
+			gMemTally.add(cat_, sz_);
+		}
+	}
+
+	/**
+	 * Return the most bytes that were in use at once.
+	 */
+	size_t highWater() const { return hwm_; }
+
+protected:
+
+	void freeOverflow() {
+		while(over_ != NULL) {
+			uint8_t *next = *(uint8_t**)over_;
+			size_t bytes = *(size_t*)(over_ + sizeof(uint8_t*));
+			delete[] over_;
+			gMemTally.del(cat_, bytes);
+			over_ = next;
+		}
+		overBytes_ = 0;
+	}
+
+	int      cat_;       // memory category, for accounting purposes
+	uint8_t *buf_;       // the block
+	size_t   sz_;        // size of the block
+	size_t   cur_;       // bytes of the block in use
+	uint8_t *over_;      // chunks allocated since the block ran out
+	size_t   overBytes_; // bytes in over_ chunks
+	size_t   hwm_;       // most bytes in use at once
+};
+
+/**
+ * Stable merge sort of the 'n' elements of 'a' using 'tmp', which holds
+ * room for 'n' more, as the other buffer.  Orders the same way
+ * std::stable_sort does but doesn't allocate.
+ */
+template <typename T>
+void stableSortWithBuffer(T *a, T *tmp, size_t n) {
+	const size_t RUN = 16;
+	// Insertion-sort short runs
+	for(size_t lo = 0; lo < n; lo += RUN) {
+		size_t hi = std::min(lo + RUN, n);
+		for(size_t i = lo + 1; i < hi; i++) {
+			if(!(a[i] < a[i-1])) continue;
+			T v = a[i];
+			size_t j = i;
+			do {
+				a[j] = a[j-1];
+				j--;
+			} while(j > lo && v < a[j-1]);
+			a[j] = v;
+		}
+	}
+	// Merge runs back and forth between the buffers
+	T *src = a, *dst = tmp;
+	for(size_t w = RUN; w < n; w *= 2) {
+		for(size_t lo = 0; lo < n; lo += 2 * w) {
+			size_t mid = std::min(lo + w, n), hi = std::min(lo + 2 * w, n);
+			size_t i = lo, j = mid, k = lo;
+			while(i < mid && j < hi) {
+				// Take from the left run on ties to keep it stable
+				if(src[j] < src[i]) dst[k++] = src[j++];
+				else                dst[k++] = src[i++];
+			}
+			while(i < mid) dst[k++] = src[i++];
+			while(j < hi)  dst[k++] = src[j++];
+		}
+		std::swap(src, dst);
+	}
+	if(src != a) {
+		for(size_t i = 0; i < n; i++) a[i] = src[i];
+	}
+}
+
 /**
  * An EList<T> is an expandable list with these features:
  *
@@ -765,12 +931,22 @@ public:
 	}
 	
 	/**
-	 * Sort some of the contents.
+	 * Sort some of the contents.  If 'arena' is given, the scratch
+	 * buffer is taken from it rather than from the heap.
 	 */
-	void sortPortion(size_t begin, size_t num) {
+	void sortPortion(size_t begin, size_t num, Arena *arena = NULL) {
 		assert_leq(begin+num, cur_);
 		if(num < 2) return;
-		std::stable_sort(list_ + begin, list_ + begin + num);
+		if(arena == NULL) {
+			std::stable_sort(list_ + begin, list_ + begin + num);
+			return;
+		}
+		size_t m = arena->mark();
+		T *tmp = (T*)arena->alloc(num * sizeof(T));
+		for(size_t i = 0; i < num; i++) new(tmp + i) T();
+		stableSortWithBuffer(list_ + begin, tmp, num);
+		for(size_t i = 0; i < num; i++) tmp[i].~T();
+		arena->release(m);
 	}
 	
 	/**
@@ -792,8 +968,8 @@ public:
 	/**
 	 * Sort contents
 	 */
-	void sort() {
-		sortPortion(0, cur_);
+	void sort(Arena *arena = NULL) {
+		sortPortion(0, cur_, arena);
 	}
 
 	/**
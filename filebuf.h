@@ -28,6 +28,9 @@
 #include <stdint.h>
 #include <stdexcept>
 #include "assert_helpers.h"
+#include "decompress.h"
+#include "compress.h"
+#include "simd_seq.h"
 
 /**
  * Simple, fast helper for determining if a character is a newline.
@@ -52,7 +55,8 @@ static inline bool isspace_notnl(int c) {
  *
  * Helper functions do things like parse strings, numbers, and FASTA records.
  *
- *
+ * If a FILE* turns out to be gzip-, bzip2- or zstd-compressed (judging by
+ * its first few bytes), its contents are decompressed in-process.
  */
 class FileBuf {
 public:
@@ -64,6 +68,7 @@ public:
 		init();
 		_in = in;
 		assert(_in != NULL);
+		detectCompression();
 	}
 
 	FileBuf(std::ifstream *inf) {
@@ -78,6 +83,10 @@ public:
 		assert(_ins != NULL);
 	}
 
+	~FileBuf() {
+		delete _dec;
+	}
+
 	/**
 	 * Return true iff there is a stream ready to read.
 	 */
@@ -89,6 +98,9 @@ public:
 	 * Close the input stream (if that's possible)
 	 */
 	void close() {
+		// Stop the decompressor before closing the file it reads from
+		delete _dec;
+		_dec = NULL;
 		if(_in != NULL && _in != stdin) {
 			fclose(_in);
 		} else if(_inf != NULL) {
@@ -122,12 +134,15 @@ public:
 	 * Initialize the buffer with a new C-style file.
 	 */
 	void newFile(FILE *in) {
+		delete _dec;
+		_dec = NULL;
 		_in = in;
 		_inf = NULL;
 		_ins = NULL;
 		_cur = BUF_SZ;
 		_buf_sz = BUF_SZ;
 		_done = false;
+		detectCompression();
 	}
 
 	/**
@@ -166,11 +181,16 @@ public:
 			_ins->clear();
 			_ins->seekg(0, std::ios::beg);
 		} else {
+			delete _dec;
+			_dec = NULL;
 			rewind(_in);
 		}
 		_cur = BUF_SZ;
 		_buf_sz = BUF_SZ;
 		_done = false;
+		if(_in != NULL) {
+			detectCompression();
+		}
 	}
 
 	/**
@@ -189,7 +209,9 @@ public:
 			// Read a new buffer's worth of data
 			else {
 				// Get the next chunk
-				if(_inf != NULL) {
+				if(_dec != NULL) {
+					_buf_sz = _dec->read(_buf, BUF_SZ);
+				} else if(_inf != NULL) {
 					_inf->read((char*)_buf, BUF_SZ);
 					_buf_sz = _inf->gcount();
 				} else if(_ins != NULL) {
@@ -259,6 +281,27 @@ public:
 		return len;
 	}
 
+	/**
+	 * Append all characters up to, but not including, the next newline
+	 * character (or EOF) to 'dst'.  Rather than dispensing characters one
+	 * at a time, scans the buffer for the newline and appends whole runs.
+	 * Returns the newline character that ended the line, or -1 for EOF.
+	 * Characters copied this way do not enter the last-N-chars buffer.
+	 */
+	template <typename TStr>
+	int getUptoNewline(TStr& dst) {
+		while(true) {
+			if(peek() == -1) return -1;
+			const char *s = (const char *)_buf + _cur;
+			size_t avail = _buf_sz - _cur;
+			// Old-style '\r' line endings also end the line
+			size_t n = seqFindNewline(s, avail);
+			dst.append(s, n);
+			_cur += n;
+			if(n < avail) return (int)_buf[_cur];
+		}
+	}
+
 	static const size_t LASTN_BUF_SZ = 8 * 1024;
 
 	/**
@@ -432,16 +475,40 @@ private:
 		_in = NULL;
 		_inf = NULL;
 		_ins = NULL;
+		_dec = NULL;
 		_cur = _buf_sz = BUF_SZ;
 		_done = false;
 		_lastn_cur = 0;
 		// no need to clear _buf[]
 	}
 
+	/**
+	 * Read the first few bytes of _in and, if they're the magic number of
+	 * a compressed format, set up a decompressor that subsequent buffer
+	 * refills will draw from.  Otherwise leave the bytes in the buffer to
+	 * be dispensed as usual.
+	 */
+	void detectCompression() {
+		assert(_in != NULL);
+		assert(_dec == NULL);
+		size_t n = fread(_buf, 1, COMPRESS_MAGIC_LEN, _in);
+		int fmt = compressionFromMagic(_buf, n);
+		if(fmt != COMPRESS_NONE) {
+			_dec = Decompressor::create(_in, fmt, _buf, n);
+			_cur = _buf_sz = BUF_SZ;
+		} else {
+			_cur = 0;
+			_buf_sz = n;
+			// A short read means we already hit EOF
+			_done = (n < COMPRESS_MAGIC_LEN);
+		}
+	}
+
 	static const size_t BUF_SZ = 256 * 1024;
 	FILE     *_in;
 	std::ifstream *_inf;
 	std::istream  *_ins;
+	Decompressor  *_dec; // non-NULL iff _in is compressed
 	size_t    _cur;
 	size_t    _buf_sz;
 	bool      _done;
@@ -529,7 +596,7 @@ public:
 	 * Open a new output stream to a file with given name.
 	 */
 	OutFileBuf(const std::string& out, bool binary = false) :
-		name_(out.c_str()), cur_(0), closed_(false)
+		name_(out.c_str()), cur_(0), closed_(false), comp_(NULL)
 	{
 		out_ = fopen(out.c_str(), binary ? "wb" : "w");
 		if(out_ == NULL) {
@@ -544,7 +611,7 @@ public:
 	 * Open a new output stream to a file with given name.
 	 */
 	OutFileBuf(const char *out, bool binary = false) :
-		name_(out), cur_(0), closed_(false)
+		name_(out), cur_(0), closed_(false), comp_(NULL)
 	{
 		assert(out != NULL);
 		out_ = fopen(out, binary ? "wb" : "w");
@@ -557,7 +624,7 @@ public:
 	/**
 	 * Open a new output stream to standard out.
 	 */
-	OutFileBuf() : name_("cout"), cur_(0), closed_(false) {
+	OutFileBuf() : name_("cout"), cur_(0), closed_(false), comp_(NULL) {
 		out_ = stdout;
 	}
 	
@@ -579,6 +646,18 @@ public:
 		reset();
 	}
 
+	/**
+	 * Compress everything written from now on in the given format
+	 * (COMPRESS_GZIP or COMPRESS_BZIP2).  Call before the first write.
+	 */
+	void setCompression(int fmt) {
+		assert_eq(0, cur_);
+		assert(comp_ == NULL);
+		if(fmt != COMPRESS_NONE) {
+			comp_ = Compressor::create(out_, fmt, name_);
+		}
+	}
+
 	/**
 	 * Write a single character into the write buffer and, if
 	 * necessary, flush.
@@ -598,7 +677,7 @@ public:
 		if(cur_ + slen > BUF_SZ) {
 			if(cur_ > 0) flush();
 			if(slen >= BUF_SZ) {
-				fwrite(s.c_str(), slen, 1, out_);
+				writeOut(s.c_str(), slen);
 			} else {
 				memcpy(&buf_[cur_], s.data(), slen);
 				assert_eq(0, cur_);
@@ -621,7 +700,7 @@ public:
 		if(cur_ + slen > BUF_SZ) {
 			if(cur_ > 0) flush();
 			if(slen >= BUF_SZ) {
-				fwrite(s.toZBuf(), slen, 1, out_);
+				writeOut(s.toZBuf(), slen);
 			} else {
 				memcpy(&buf_[cur_], s.toZBuf(), slen);
 				assert_eq(0, cur_);
@@ -642,7 +721,7 @@ public:
 		if(cur_ + len > BUF_SZ) {
 			if(cur_ > 0) flush();
 			if(len >= BUF_SZ) {
-				fwrite(s, len, 1, out_);
+				writeOut(s, len);
 			} else {
 				memcpy(&buf_[cur_], s, len);
 				assert_eq(0, cur_);
@@ -669,6 +748,11 @@ public:
 		if(closed_) return;
 		if(cur_ > 0) flush();
 		closed_ = true;
+		if(comp_ != NULL) {
+			comp_->finish();
+			delete comp_;
+			comp_ = NULL;
+		}
 		if(out_ != stdout) {
 			fclose(out_);
 		}
@@ -683,7 +767,9 @@ public:
 	}
 
 	void flush() {
-		if(!fwrite((const void *)buf_, cur_, 1, out_)) {
+		if(comp_ != NULL) {
+			comp_->write((const uint8_t *)buf_, cur_);
+		} else if(!fwrite((const void *)buf_, cur_, 1, out_)) {
 			std::cerr << "Error while flushing and closing output" << std::endl;
 			throw 1;
 		}
@@ -706,6 +792,18 @@ public:
 
 private:
 
+	/**
+	 * Write 'len' bytes straight to the file, bypassing buf_.
+	 */
+	void writeOut(const char *s, size_t len) {
+		if(comp_ != NULL) {
+			comp_->write((const uint8_t *)s, len);
+		} else if(!fwrite(s, len, 1, out_)) {
+			std::cerr << "Error while flushing and closing output" << std::endl;
+			throw 1;
+		}
+	}
+
 	static const size_t BUF_SZ = 16 * 1024;
 
 	const char *name_;
@@ -713,6 +811,7 @@ private:
 	size_t      cur_;
 	char        buf_[BUF_SZ]; // (large) input buffer
 	bool        closed_;
+	Compressor *comp_;        // compresses output, or NULL
 };
 
 #endif /*ndef FILEBUF_H_*/
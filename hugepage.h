@@ -0,0 +1,117 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HUGEPAGE_H_
+#define HUGEPAGE_H_
+
+/**
+ * hugepage.h:
+ *
+ * Helpers for backing the big index arrays (ebwt[], offs[], ftab[] and
+ * the bitpacked reference) with 2 MB pages.  Lookups into these arrays
+ * are essentially random, so with 4 KB pages nearly every access to a
+ * large index also misses the TLB.
+ *
+ * allocHugePages() first tries an explicit hugetlbfs mapping, which only
+ * succeeds if the administrator has reserved pages (vm.nr_hugepages).
+ * Failing that it makes an ordinary anonymous mapping aligned to a 2 MB
+ * boundary and advises the kernel to back it with transparent huge
+ * pages.  If neither works, NULL is returned and the caller should fall
+ * back on new[].  Memory from allocHugePages() must be released with
+ * freeHugePages().
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#ifdef BOWTIE_MM
+#include <sys/mman.h>
+#endif
+
+static const size_t HUGE_PAGE_SZ = 2 * 1024 * 1024;
+
+/**
+ * Round 'bytes' up to a whole number of huge pages.
+ */
+static inline size_t hugePageRound(size_t bytes) {
+	return (bytes + HUGE_PAGE_SZ - 1) & ~(HUGE_PAGE_SZ - 1);
+}
+
+/**
+ * Advise the kernel that the given range, which may be an anonymous or
+ * a file-backed mapping, should be backed by transparent huge pages.
+ * Only the 2 MB-aligned interior of the range is affected.  Whether
+ * file-backed (--mm) mappings are promoted depends on the kernel.
+ */
+static inline void adviseHugePages(void *p, size_t bytes) {
+#if defined(BOWTIE_MM) && defined(MADV_HUGEPAGE)
+	uintptr_t beg = ((uintptr_t)p + HUGE_PAGE_SZ - 1) & ~(uintptr_t)(HUGE_PAGE_SZ - 1);
+	uintptr_t end = ((uintptr_t)p + bytes) & ~(uintptr_t)(HUGE_PAGE_SZ - 1);
+	if(end > beg) {
+		madvise((void *)beg, (size_t)(end - beg), MADV_HUGEPAGE);
+	}
+#endif
+}
+
+/**
+ * Allocate 'bytes' bytes of zeroed memory backed by huge pages, or
+ * return NULL if huge-page backed memory couldn't be obtained.
+ */
+static inline void *allocHugePages(size_t bytes) {
+#if defined(BOWTIE_MM) && (defined(MAP_HUGETLB) || defined(MADV_HUGEPAGE))
+	if(bytes == 0) return NULL;
+	size_t len = hugePageRound(bytes);
+	void *p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+	p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+	         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if(p != MAP_FAILED) return p;
+#endif
+#ifdef MADV_HUGEPAGE
+	// Over-allocate by one huge page, then trim so that the mapping
+	// starts on a 2 MB boundary and THP can back all of it
+	p = mmap(NULL, len + HUGE_PAGE_SZ, PROT_READ | PROT_WRITE,
+	         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(p == MAP_FAILED) return NULL;
+	uintptr_t raw = (uintptr_t)p;
+	uintptr_t beg = (raw + HUGE_PAGE_SZ - 1) & ~(uintptr_t)(HUGE_PAGE_SZ - 1);
+	if(beg > raw) {
+		munmap(p, (size_t)(beg - raw));
+	}
+	if(raw + len + HUGE_PAGE_SZ > beg + len) {
+		munmap((void *)(beg + len), (size_t)(raw + len + HUGE_PAGE_SZ - (beg + len)));
+	}
+	madvise((void *)beg, len, MADV_HUGEPAGE);
+	return (void *)beg;
+#endif
+#endif
+	return NULL;
+}
+
+/**
+ * Release memory obtained from allocHugePages(bytes).
+ */
+static inline void freeHugePages(void *p, size_t bytes) {
+#ifdef BOWTIE_MM
+	if(p != NULL) {
+		munmap(p, hugePageRound(bytes));
+	}
+#endif
+}
+
+#endif /* HUGEPAGE_H_ */
@@ -0,0 +1,256 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include "job_server.h"
+
+using namespace std;
+
+#ifndef _WIN32
+
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define JOB_MAGIC 0x4a327462 // "bt2J"
+
+/**
+ * Fill in a Unix domain socket address for the given path.
+ */
+static void jobSockAddr(const string& path, struct sockaddr_un& addr) {
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(path.length() >= sizeof(addr.sun_path)) {
+		cerr << "Error: Socket path " << path.c_str() << " is too long" << endl;
+		throw 1;
+	}
+	strcpy(addr.sun_path, path.c_str());
+}
+
+/**
+ * Read exactly len bytes; return false if the peer hung up first.
+ */
+static bool readFully(int fd, void *buf, size_t len) {
+	char *p = (char*)buf;
+	while(len > 0) {
+		ssize_t r = read(fd, p, len);
+		if(r < 0 && errno == EINTR) continue;
+		if(r <= 0) return false;
+		p += r;
+		len -= (size_t)r;
+	}
+	return true;
+}
+
+/**
+ * Read a length-prefixed string; return false if the peer hung up first.
+ */
+static bool readString(int fd, string& s) {
+	uint32_t len = 0;
+	if(!readFully(fd, &len, sizeof(len))) return false;
+	s.assign(len, '\0');
+	return len == 0 || readFully(fd, &s[0], len);
+}
+
+/**
+ * Write exactly len bytes; return false if the peer hung up first.
+ */
+static bool writeFully(int fd, const void *buf, size_t len) {
+	const char *p = (const char*)buf;
+	while(len > 0) {
+		ssize_t r = write(fd, p, len);
+		if(r < 0 && errno == EINTR) continue;
+		if(r <= 0) return false;
+		p += r;
+		len -= (size_t)r;
+	}
+	return true;
+}
+
+/**
+ * Write a length-prefixed string; return false if the peer hung up first.
+ */
+static bool writeString(int fd, const string& s) {
+	uint32_t len = (uint32_t)s.length();
+	return writeFully(fd, &len, sizeof(len)) && writeFully(fd, s.c_str(), len);
+}
+
+int jobServerListen(const string& path) {
+	struct sockaddr_un addr;
+	jobSockAddr(path, addr);
+	int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(lfd < 0) {
+		perror("socket");
+		throw 1;
+	}
+	unlink(path.c_str());
+	// Whoever can write to the socket can run jobs as us, so create it
+	// with mode 0600 rather than relying on the caller's umask
+	mode_t oldMask = umask(S_IRWXG | S_IRWXO | S_IXUSR);
+	int ret = bind(lfd, (struct sockaddr*)&addr, sizeof(addr));
+	umask(oldMask);
+	if(ret != 0) {
+		perror("bind");
+		cerr << "Error: Could not bind server socket " << path.c_str() << endl;
+		throw 1;
+	}
+	if(listen(lfd, 16) != 0) {
+		perror("listen");
+		throw 1;
+	}
+	return lfd;
+}
+
+int jobServerAccept(int lfd, string& cwd, EList<string>& args, int fds[3]) {
+	args.clear();
+	int cfd;
+	do {
+		cfd = accept(lfd, NULL, NULL);
+	} while(cfd < 0 && errno == EINTR);
+	if(cfd < 0) {
+		perror("accept");
+		throw 1;
+	}
+	// Header carries the magic, the argument count and the descriptors;
+	// the working directory and then the arguments follow
+	uint32_t hdr[2];
+	struct iovec iov;
+	iov.iov_base = hdr;
+	iov.iov_len = sizeof(hdr);
+	char cbuf[CMSG_SPACE(3 * sizeof(int))];
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+	ssize_t r;
+	do {
+		r = recvmsg(cfd, &msg, 0);
+	} while(r < 0 && errno == EINTR);
+	struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+	bool gotFds = cm != NULL &&
+	              cm->cmsg_level == SOL_SOCKET &&
+	              cm->cmsg_type == SCM_RIGHTS &&
+	              cm->cmsg_len == CMSG_LEN(3 * sizeof(int));
+	if(gotFds) {
+		memcpy(fds, CMSG_DATA(cm), 3 * sizeof(int));
+	}
+	bool ok = gotFds && r == (ssize_t)sizeof(hdr) && hdr[0] == JOB_MAGIC;
+	ok = ok && readString(cfd, cwd);
+	for(uint32_t i = 0; ok && i < hdr[1]; i++) {
+		string arg;
+		ok = readString(cfd, arg);
+		args.push_back(arg);
+	}
+	if(!ok) {
+		if(gotFds) {
+			for(int i = 0; i < 3; i++) close(fds[i]);
+		}
+		close(cfd);
+		return -1;
+	}
+	return cfd;
+}
+
+void jobServerReply(int cfd, int ret) {
+	int32_t st = (int32_t)ret;
+	writeFully(cfd, &st, sizeof(st));
+	close(cfd);
+}
+
+int jobClientRun(const string& path, const EList<string>& args) {
+	char cwd[PATH_MAX];
+	if(getcwd(cwd, sizeof(cwd)) == NULL) {
+		perror("getcwd");
+		cerr << "Error: Could not get the working directory to send to the bowtie2 server" << endl;
+		return 1;
+	}
+	struct sockaddr_un addr;
+	jobSockAddr(path, addr);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0) {
+		perror("socket");
+		return 1;
+	}
+	if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		perror("connect");
+		cerr << "Error: Could not connect to a bowtie2 server at " << path.c_str() << endl;
+		close(fd);
+		return 1;
+	}
+	uint32_t hdr[2] = { JOB_MAGIC, (uint32_t)args.size() };
+	struct iovec iov;
+	iov.iov_base = hdr;
+	iov.iov_len = sizeof(hdr);
+	char cbuf[CMSG_SPACE(3 * sizeof(int))];
+	memset(cbuf, 0, sizeof(cbuf));
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+	struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_RIGHTS;
+	cm->cmsg_len = CMSG_LEN(3 * sizeof(int));
+	int fds[3] = { 0, 1, 2 };
+	memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+	fflush(stdout);
+	bool ok = sendmsg(fd, &msg, 0) == (ssize_t)sizeof(hdr);
+	ok = ok && writeString(fd, string(cwd));
+	for(size_t i = 0; ok && i < args.size(); i++) {
+		ok = writeString(fd, args[i]);
+	}
+	int32_t st = 1;
+	if(!ok || !readFully(fd, &st, sizeof(st))) {
+		cerr << "Error: Lost connection to the bowtie2 server at " << path.c_str() << endl;
+		st = 1;
+	}
+	close(fd);
+	return (int)st;
+}
+
+#else
+
+int jobServerListen(const string& path) {
+	cerr << "Error: --server is not supported on Windows" << endl;
+	throw 1;
+}
+
+int jobServerAccept(int lfd, string& cwd, EList<string>& args, int fds[3]) {
+	throw 1;
+}
+
+void jobServerReply(int cfd, int ret) { }
+
+int jobClientRun(const string& path, const EList<string>& args) {
+	cerr << "Error: --connect is not supported on Windows" << endl;
+	return 1;
+}
+
+#endif
@@ -0,0 +1,73 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JOB_SERVER_H_
+#define JOB_SERVER_H_
+
+/**
+ * job_server.h:
+ *
+ * Transport for bowtie2-align's server mode (--server/--connect).  A
+ * client connects to the server's Unix domain socket and sends its
+ * working directory and command-line arguments together with its stdin,
+ * stdout and stderr descriptors (as SCM_RIGHTS ancillary data).  The
+ * server runs the job against the index it already holds in memory, in
+ * the client's working directory and with the client's descriptors
+ * standing in for its own, so relative paths, streamed reads, alignments
+ * and the summary all behave exactly as if the client had run
+ * bowtie2-align itself.  The server then replies with the job's exit
+ * status.  The socket is only accessible to the user running the server.
+ */
+
+#include <string>
+#include "ds.h"
+
+/**
+ * Listen for jobs on a Unix domain socket at the given path, replacing
+ * any socket left behind by an earlier server.  The socket is created
+ * with mode 0600.  Returns the listening descriptor.
+ */
+extern int jobServerListen(const std::string& path);
+
+/**
+ * Wait for the next job.  Fills in the client's working directory, its
+ * arguments and its stdin/stdout/stderr descriptors and returns the
+ * connection descriptor, or returns -1 if a client went away before
+ * sending a complete job.
+ */
+extern int jobServerAccept(
+	int lfd,
+	std::string& cwd,
+	EList<std::string>& args,
+	int fds[3]);
+
+/**
+ * Tell the client the job finished with the given exit status and close
+ * the connection.
+ */
+extern void jobServerReply(int cfd, int ret);
+
+/**
+ * Hand a job with the given arguments, along with our working directory,
+ * stdin, stdout and stderr, to the server listening at the given path.  Waits for the job
+ * to finish and returns its exit status.
+ */
+extern int jobClientRun(const std::string& path, const EList<std::string>& args);
+
+#endif /* JOB_SERVER_H_ */
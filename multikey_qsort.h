@@ -702,8 +702,13 @@ void qsortSufDc(
 	if(end > begin+cur+1) qsortSufDc(host, hlen, s, slen, dc, begin+cur+1, end);
 }
 
+// 5 64-element buckets for bucket-sorting A, C, G, T, $
+extern TIndexOffU bkts[4][4 * 1024 * 1024];
+
 /**
- * Toplevel function for multikey quicksort over suffixes.
+ * Toplevel function for multikey quicksort over suffixes.  'bk' points
+ * to 4 scratch buckets of min(slen, 4M) elements each; if it's NULL the
+ * global bkts are used, so only one thread at a time may pass NULL.
  */
 template<typename T1, typename T2>
 void mkeyQSortSufDcU8(
@@ -715,10 +720,13 @@ void mkeyQSortSufDcU8(
 	const DifferenceCoverSample<T1>& dc,
 	int hi,
 	bool verbose = false,
-	bool sanityCheck = false)
+	bool sanityCheck = false,
+	TIndexOffU **bk = NULL)
 {
+	TIndexOffU *gbk[4] = { bkts[0], bkts[1], bkts[2], bkts[3] };
+	if(bk == NULL) bk = gbk;
 	if(sanityCheck) sanityCheckInputSufs(s, slen);
-	mkeyQSortSufDcU8(host1, host, hlen, s, slen, dc, hi, 0, slen, 0, sanityCheck);
+	mkeyQSortSufDcU8(host1, host, hlen, s, slen, dc, hi, 0, slen, 0, bk, sanityCheck);
 	if(sanityCheck) sanityCheckOrderedSufs(host1, hlen, s, slen, OFF_MASK);
 }
 
@@ -805,9 +813,6 @@ void qsortSufDcU8(
 #define BUCKET_SORT_CUTOFF (4 * 1024 * 1024)
 #define SELECTION_SORT_CUTOFF 6
 
-// 5 64-element buckets for bucket-sorting A, C, G, T, $
-extern TIndexOffU bkts[4][4 * 1024 * 1024];
-
 /**
  * Straightforwardly obtain a uint8_t-ized version of t[off].  This
  * works fine as long as TStr is not packed.
@@ -981,12 +986,13 @@ static void bucketSortSufDcU8(
         size_t begin,
         size_t end,
         size_t depth,
+        TIndexOffU **bk,
         bool sanityCheck = false)
 {
 	size_t cnts[] = { 0, 0, 0, 0, 0 };
 	#define BKT_RECURSE_SUF_DC_U8(nbegin, nend) { \
 		bucketSortSufDcU8<T1,T2>(host1, host, hlen, s, slen, dc, hi, \
-		                         (nbegin), (nend), depth+1, sanityCheck); \
+		                         (nbegin), (nend), depth+1, bk, sanityCheck); \
 	}
 	assert_gt(end, begin);
 	assert_leq(end-begin, BUCKET_SORT_CUTOFF);
@@ -1016,16 +1022,16 @@ static void bucketSortSufDcU8(
 		if(c == 0) {
 			s[begin + cnts[0]++] = s[i];
 		} else {
-			bkts[c-1][cnts[c]++] = s[i];
+			bk[c-1][cnts[c]++] = s[i];
 		}
 	}
 	assert_eq(cnts[0] + cnts[1] + cnts[2] + cnts[3] + cnts[4], end - begin);
 	size_t cur = begin + cnts[0];
-	if(cnts[1] > 0) { memcpy(&s[cur], bkts[0], cnts[1] << (OFF_SIZE/4 + 1)); cur += cnts[1]; }
-	if(cnts[2] > 0) { memcpy(&s[cur], bkts[1], cnts[2] << (OFF_SIZE/4 + 1)); cur += cnts[2]; }
-	if(cnts[3] > 0) { memcpy(&s[cur], bkts[2], cnts[3] << (OFF_SIZE/4 + 1)); cur += cnts[3]; }
-	if(cnts[4] > 0) { memcpy(&s[cur], bkts[3], cnts[4] << (OFF_SIZE/4 + 1)); }
-	// This frame is now totally finished with bkts[][], so recursive
+	if(cnts[1] > 0) { memcpy(&s[cur], bk[0], cnts[1] << (OFF_SIZE/4 + 1)); cur += cnts[1]; }
+	if(cnts[2] > 0) { memcpy(&s[cur], bk[1], cnts[2] << (OFF_SIZE/4 + 1)); cur += cnts[2]; }
+	if(cnts[3] > 0) { memcpy(&s[cur], bk[2], cnts[3] << (OFF_SIZE/4 + 1)); cur += cnts[3]; }
+	if(cnts[4] > 0) { memcpy(&s[cur], bk[3], cnts[4] << (OFF_SIZE/4 + 1)); }
+	// This frame is now totally finished with bk[][], so recursive
 	// callees can safely clobber it; we're not done with cnts[], but
 	// that's local to the stack frame.
 	cur = begin;
@@ -1075,13 +1081,14 @@ void mkeyQSortSufDcU8(
 	size_t begin,
 	size_t end,
 	size_t depth,
+	TIndexOffU **bk,
 	bool sanityCheck = false)
 {
 	// Helper for making the recursive call; sanity-checks arguments to
 	// make sure that the problem actually got smaller.
 	#define MQS_RECURSE_SUF_DC_U8(nbegin, nend, ndepth) { \
 		assert(nbegin > begin || nend < end || ndepth > depth); \
-		mkeyQSortSufDcU8(host1, host, hlen, s, slen, dc, hi, nbegin, nend, ndepth, sanityCheck); \
+		mkeyQSortSufDcU8(host1, host, hlen, s, slen, dc, hi, nbegin, nend, ndepth, bk, sanityCheck); \
 	}
 	assert_leq(begin, slen);
 	assert_leq(end, slen);
@@ -1100,7 +1107,7 @@ void mkeyQSortSufDcU8(
 	if(n <= BUCKET_SORT_CUTOFF) {
 		// Bucket sort remaining items
 		bucketSortSufDcU8(host1, host, hlen, s, slen, dc,
-		                  (uint8_t)hi, begin, end, depth, sanityCheck);
+		                  (uint8_t)hi, begin, end, depth, bk, sanityCheck);
 		if(sanityCheck) {
 			sanityCheckOrderedSufs(host1, hlen, s, slen, OFF_MASK, begin, end);
 		}
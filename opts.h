@@ -151,7 +151,29 @@ enum {
 	ARG_DESC_PRIORITIZE,        // --desc-prioritize
 	ARG_DESC_FMOPS,             // --desc-fmops
 	ARG_LOG_DP,                 // --log-dp
-	ARG_LOG_DP_OPP              // --log-dp-opp
+	ARG_LOG_DP_OPP,             // --log-dp-opp
+	ARG_READS_PER_BATCH,        // --reads-per-batch
+	ARG_MM_READS,               // --mm-reads
+	ARG_UN,                     // --un
+	ARG_UN_GZ,                  // --un-gz
+	ARG_UN_BZ2,                 // --un-bz2
+	ARG_AL,                     // --al
+	ARG_AL_GZ,                  // --al-gz
+	ARG_AL_BZ2,                 // --al-bz2
+	ARG_UN_CONC,                // --un-conc
+	ARG_UN_CONC_GZ,             // --un-conc-gz
+	ARG_UN_CONC_BZ2,            // --un-conc-bz2
+	ARG_AL_CONC,                // --al-conc
+	ARG_AL_CONC_GZ,             // --al-conc-gz
+	ARG_AL_CONC_BZ2,            // --al-conc-bz2
+	ARG_BAM,                    // --bam
+	ARG_OUT_BUF_KB,             // --out-buf-kb
+	ARG_NO_DP_FILTER,           // --no-dp-filter
+	ARG_SHARED_SEED_CACHE_SZ,   // --shared-seed-cache-sz
+	ARG_DUP_CACHE_SZ,           // --dup-cache-sz
+	ARG_HUGE_PAGES,             // --huge-pages
+	ARG_SERVER,                 // --server
+	ARG_CONNECT                 // --connect
 };
 
 #endif
@@ -17,86 +17,341 @@
  * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <sched.h>
 #include "outq.h"
 
 /**
  * Caller is telling us that they're about to write output record(s) for
- * the read with the given id.
+ * the read with the given id.  If the read is too far ahead of the oldest
+ * unwritten read to fit in the ring, wait until the straggler(s) finish.
  */
 void OutputQueue::beginRead(TReadId rdid, size_t threadId) {
-	ThreadSafe t(&mutex_m, threadSafe_);
-	nstarted_++;
 	if(reorder_) {
 		assert_geq(rdid, cur_);
-		assert_eq(lines_.size(), finished_.size());
-		assert_eq(lines_.size(), started_.size());
-		if(rdid - cur_ >= lines_.size()) {
-			// Make sure there's enough room in lines_, started_ and finished_
-			size_t oldsz = lines_.size();
-			lines_.resize(rdid - cur_ + 1);
-			started_.resize(rdid - cur_ + 1);
-			finished_.resize(rdid - cur_ + 1);
-			for(size_t i = oldsz; i < lines_.size(); i++) {
-				started_[i] = finished_[i] = false;
-			}
+		while(rdid - cur_ >= nslots_) {
+			sched_yield();
 		}
-		started_[rdid - cur_] = true;
-		finished_[rdid - cur_] = false;
+		assert(!done_[rdid % nslots_]);
 	}
+	__sync_fetch_and_add(&nstarted_, 1);
 }
 
 /**
  * Writer is finished writing to 
  */
 void OutputQueue::finishRead(const BTString& rec, TReadId rdid, size_t threadId) {
-	ThreadSafe t(&mutex_m, threadSafe_);
 	if(reorder_) {
 		assert_geq(rdid, cur_);
-		assert_eq(lines_.size(), finished_.size());
-		assert_eq(lines_.size(), started_.size());
-		assert_lt(rdid - cur_, lines_.size());
-		assert(started_[rdid - cur_]);
-		assert(!finished_[rdid - cur_]);
-		lines_[rdid - cur_] = rec;
-		nfinished_++;
-		finished_[rdid - cur_] = true;
-		flush(false, false); // don't force; already have lock
-	} else {
-		// obuf_ is the OutFileBuf for the output file
-		obuf_.writeString(rec);
+		assert_lt(rdid - cur_, nslots_);
+		size_t slot = (size_t)(rdid % nslots_);
+		assert(!done_[slot]);
+		lines_[slot] = rec;
+		__sync_fetch_and_add(&nfinished_, 1);
+		// Record must be in place before the flag is seen as set
+		__sync_synchronize();
+		done_[slot] = 1;
+		__sync_synchronize();
+		flushSlots();
+		return;
+	}
+	if(bufsz_ > 0) {
+		// Each thread fills a buffer of its own without taking the lock
+		assert_lt(threadId, bufs_.size());
+		if(bgzf_) {
+			raw_[threadId].append(rec.buf(), rec.length());
+			if(raw_[threadId].length() >= BGZF_FLUSH_SZ) {
+				flushBgzf(threadId, false);
+			}
+		} else {
+			bufs_[threadId]->append(rec.buf(), rec.length());
+		}
+		if(bufs_[threadId]->length() >= bufsz_) {
+			bufs_[threadId] = writer_->handOff(bufs_[threadId]);
+		}
+		__sync_fetch_and_add(&nfinished_, 1);
+		__sync_fetch_and_add(&nflushed_, 1);
+		return;
+	}
+	if(bgzf_) {
+		// Each thread compresses its own output outside of the lock and
+		// writes only whole BGZF blocks holding whole records
+		assert_lt(threadId, raw_.size());
+		raw_[threadId].append(rec.buf(), rec.length());
+		if(raw_[threadId].length() >= BGZF_FLUSH_SZ) {
+			flushBgzf(threadId, true);
+		}
+		ThreadSafe t(&mutex_m, threadSafe_);
 		nfinished_++;
 		nflushed_++;
+		return;
 	}
+	ThreadSafe t(&mutex_m, threadSafe_);
+	// obuf_ is the OutFileBuf for the output file
+	writeOut(rec);
+	nfinished_++;
+	nflushed_++;
 }
 
 /**
- * Write already-finished lines starting from cur_.
+ * Become the flusher, unless another thread already is, and write out the
+ * run of finished slots starting from cur_.  Only the flusher touches
+ * obuf_, raw_[0] and cur_, so no lock is needed for them.
+ */
+void OutputQueue::flushSlots() {
+	assert(reorder_);
+	while(done_[cur_ % nslots_] != 0) {
+		if(!__sync_bool_compare_and_swap(&flushing_, 0, 1)) {
+			// Another thread is flushing; it will pick up our slot
+			return;
+		}
+		size_t slot;
+		while(done_[slot = (size_t)(cur_ % nslots_)] != 0) {
+			__sync_synchronize();
+			if(bgzf_) {
+				raw_[0].append(lines_[slot].buf(), lines_[slot].length());
+				if(raw_[0].length() >= BGZF_FLUSH_SZ) {
+					flushBgzf(0, false);
+				}
+			} else {
+				writeOut(lines_[slot]);
+			}
+			done_[slot] = 0;
+			// Slot must be free before a waiting thread may claim it
+			__sync_synchronize();
+			cur_++;
+			nflushed_++;
+		}
+		__sync_synchronize();
+		flushing_ = 0;
+		// A record may have been finished after we looked at its slot but
+		// before we stopped flushing, in which case its writer saw us still
+		// flushing and left it to us; check again
+		__sync_synchronize();
+	}
+}
+
+/**
+ * Compress whatever is buffered in raw_[i] into BGZF blocks and write them
+ * out, or add them to the thread's buffer if there is one.
+ */
+void OutputQueue::flushBgzf(size_t i, bool getLock) {
+#ifdef WITH_ZLIB
+	if(raw_[i].empty()) {
+		return;
+	}
+	if(bufsz_ > 0) {
+		bgzfCompress(raw_[i].buf(), raw_[i].length(), *bufs_[i]);
+		raw_[i].clear();
+		return;
+	}
+	BTString z;
+	bgzfCompress(raw_[i].buf(), raw_[i].length(), z);
+	raw_[i].clear();
+	ThreadSafe t(&mutex_m, getLock && threadSafe_);
+	writeOut(z);
+#else
+	assert(false);
+#endif
+}
+
+/**
+ * Write already-finished lines starting from cur_.  If 'force' is true,
+ * also write out everything that's buffered for BGZF compression.
  */
 void OutputQueue::flush(bool force, bool getLock) {
 	if(!reorder_) {
+		if(bufsz_ > 0) {
+			if(force) {
+				// Hand over what the threads still have buffered and wait
+				// for all of it to be written
+				for(size_t i = 0; i < bufs_.size(); i++) {
+					if(bgzf_) {
+						flushBgzf(i, false);
+					}
+					if(!bufs_[i]->empty()) {
+						bufs_[i] = writer_->handOff(bufs_[i]);
+					}
+				}
+				writer_->drain();
+			}
+			return;
+		}
+		if(bgzf_ && force) {
+			// Compress and write whatever the threads still have buffered
+			for(size_t i = 0; i < raw_.size(); i++) {
+				flushBgzf(i, getLock);
+			}
+		}
+	} else {
+		flushSlots();
+		if(bgzf_ && force) {
+			// Workers are done by now, so nobody else is flushing
+			assert_eq(0, flushing_);
+			flushBgzf(0, false);
+		}
+	}
+	if(force && failed_) {
+		throw 1; // error was already reported
+	}
+}
+
+/**
+ * Write 'rec' to obuf_.  Worker threads write through here, so rather
+ * than throwing, a failed write is recorded and everything after it is
+ * dropped; flush(true) reports it from the main thread.
+ */
+void OutputQueue::writeOut(const BTString& rec) {
+	if(failed_) {
 		return;
 	}
-	ThreadSafe t(&mutex_m, getLock && threadSafe_);
-	size_t nflush = 0;
-	while(nflush < finished_.size() && finished_[nflush]) {
-		assert(started_[nflush]);
-		nflush++;
-	}
-	// Waiting until we have several in a row to flush cuts down on copies
-	// (but requires more buffering)
-	if(force || nflush >= NFLUSH_THRESH) {
-		for(size_t i = 0; i < nflush; i++) {
-			assert(started_[i]);
-			assert(finished_[i]);
-			obuf_.writeString(lines_[i]);
+	try {
+		obuf_.writeString(rec);
+	} catch(...) {
+		failed_ = true;
+	}
+}
+
+OutputWriter::OutputWriter(OutFileBuf& obuf, size_t nworkers) :
+	obuf_(obuf),
+	all_(RES_CAT),
+	free_(RES_CAT),
+	full_(RES_CAT),
+	writing_(false),
+	stop_(false),
+	failed_(false)
+{
+	for(size_t i = 0; i < nworkers + NSPARE; i++) {
+		all_.push_back(new BTString());
+		free_.push_back(all_.back());
+	}
+#ifndef WITH_TBB
+	thread_ = new tthread::thread(OutputWriter::writeWorker, (void *)this);
+#endif
+}
+
+OutputWriter::~OutputWriter() {
+#ifndef WITH_TBB
+	{
+		tthread::lock_guard<tthread::mutex> lg(mutex_);
+		stop_ = true;
+		cond_.notify_all();
+	}
+	thread_->join();
+	delete thread_;
+#endif
+	for(size_t i = 0; i < all_.size(); i++) {
+		delete all_[i];
+	}
+}
+
+/**
+ * Return an empty buffer for a worker to fill.
+ */
+BTString *OutputWriter::take() {
+	assert(!free_.empty());
+	BTString *buf = free_.back();
+	free_.pop_back();
+	return buf;
+}
+
+/**
+ * Queue 'buf' to be written and return an empty buffer in its place,
+ * waiting for one to be freed up if necessary.
+ */
+BTString *OutputWriter::handOff(BTString *buf) {
+#ifdef WITH_TBB
+	ThreadSafe t(&mutex_);
+	if(!failed_) {
+		try {
+			obuf_.writeString(*buf);
+		} catch(...) {
+			// drain() reports the error to the main thread
+			failed_ = true;
+		}
+	}
+	buf->clear();
+	return buf;
+#else
+	tthread::lock_guard<tthread::mutex> lg(mutex_);
+	if(failed_) {
+		// Nothing more gets written; drain() reports the error to the
+		// main thread
+		buf->clear();
+		return buf;
+	}
+	full_.push_back(buf);
+	cond_.notify_all();
+	while(free_.empty() && !failed_) {
+		cond_.wait(mutex_);
+	}
+	if(free_.empty()) {
+		// The writer thread quit after a failed write and won't free up
+		// any more buffers, so reuse one of the queued ones
+		assert(failed_);
+		assert(!full_.empty());
+		buf = full_.back();
+		full_.pop_back();
+		buf->clear();
+		return buf;
+	}
+	return take();
+#endif
+}
+
+/**
+ * Wait until all buffers handed over so far have been written.  Called
+ * from the main thread once the workers are done, so this is where a
+ * failed write turns into an error.
+ */
+void OutputWriter::drain() {
+#ifndef WITH_TBB
+	tthread::lock_guard<tthread::mutex> lg(mutex_);
+	while((!full_.empty() || writing_) && !failed_) {
+		cond_.wait(mutex_);
+	}
+#endif
+	if(failed_) {
+		throw 1; // error was already reported
+	}
+}
+
+#ifndef WITH_TBB
+/**
+ * Body of the writer thread.
+ */
+void OutputWriter::writeWorker(void *vp) {
+	OutputWriter *ow = (OutputWriter *)vp;
+	while(true) {
+		BTString *buf = NULL;
+		{
+			tthread::lock_guard<tthread::mutex> lg(ow->mutex_);
+			while(ow->full_.empty() && !ow->stop_) {
+				ow->cond_.wait(ow->mutex_);
+			}
+			if(ow->full_.empty()) return;
+			buf = ow->full_.front();
+			ow->full_.erase(0);
+			ow->writing_ = true;
+		}
+		bool ok = true;
+		try {
+			ow->obuf_.writeString(*buf);
+		} catch(...) {
+			ok = false;
+		}
+		buf->clear();
+		tthread::lock_guard<tthread::mutex> lg(ow->mutex_);
+		ow->writing_ = false;
+		ow->free_.push_back(buf);
+		if(!ok) {
+			ow->failed_ = true;
+			ow->cond_.notify_all();
+			return;
 		}
-		lines_.erase(0, nflush);
-		started_.erase(0, nflush);
-		finished_.erase(0, nflush);
-		cur_ += nflush;
-		nflushed_ += nflush;
+		ow->cond_.notify_all();
 	}
 }
+#endif
 
 #ifdef OUTQ_MAIN
 
@@ -26,17 +26,98 @@
 #include "read.h"
 #include "threading.h"
 #include "mem_ids.h"
+#include "filebuf.h"
 
 /**
- * Encapsulates a list of lines of output.  If the earliest as-yet-unreported
- * read has id N and Bowtie 2 wants to write a record for read with id N+1, we
- * resize the lines_ and committed_ lists to have at least 2 elements (1 for N,
- * 1 for N+1) and return the BTString * associated with the 2nd element.  When
- * the user calls commit() for the read with id N, 
+ * Writes buffers of output handed over by worker threads to an OutFileBuf
+ * from a dedicated thread, so workers neither wait on each other nor on
+ * the disk.  Buffers come from a fixed pool: each worker holds one, a few
+ * spares are kept for buffers being written, and a worker handing over a
+ * buffer only waits when no spare is left.  Without tinythread (i.e. with
+ * TBB), buffers are written right away by the thread handing them over.
+ */
+class OutputWriter {
+
+	// # buffers in the pool beyond one per worker
+	static const size_t NSPARE = 4;
+
+public:
+
+	OutputWriter(OutFileBuf& obuf, size_t nworkers);
+
+	~OutputWriter();
+
+	/**
+	 * Return an empty buffer for a worker to fill.  Only used to give each
+	 * worker its first buffer.
+	 */
+	BTString *take();
+
+	/**
+	 * Queue 'buf' to be written and return an empty buffer in its place.
+	 */
+	BTString *handOff(BTString *buf);
+
+	/**
+	 * Wait until all buffers handed over so far have been written.
+	 * Throws if a write failed.
+	 */
+	void drain();
+
+	/**
+	 * Return true iff a write failed.  Once one has, handOff() discards
+	 * what it's given rather than throwing in the worker's thread.
+	 */
+	bool failed() const { return failed_; }
+
+private:
+
+#ifndef WITH_TBB
+	/**
+	 * Body of the writer thread: write full buffers in the order they were
+	 * handed over until asked to stop.
+	 */
+	static void writeWorker(void *vp);
+#endif
+
+	OutFileBuf&       obuf_;
+	EList<BTString*>  all_;     // every buffer in the pool
+	EList<BTString*>  free_;    // empty buffers
+	EList<BTString*>  full_;    // buffers waiting to be written, oldest first
+	bool              writing_; // writer thread is writing a buffer
+	bool              stop_;    // writer thread should quit
+	volatile bool     failed_;  // a write failed
+#ifdef WITH_TBB
+	MUTEX_T           mutex_;
+#else
+	tthread::mutex    mutex_;
+	tthread::condition_variable cond_;
+	tthread::thread  *thread_;
+#endif
+};
+
+/**
+ * Encapsulates a list of lines of output.  If records need not be
+ * reordered, each thread collects its records in a buffer of its own
+ * (compressing them into BGZF blocks first, for BAM) and hands the buffer
+ * to an OutputWriter once it's grown to bufsz bytes.  With a bufsz of 0,
+ * each record is written as soon as it's finished instead.  Otherwise,
+ * records wait in a fixed-size ring of slots, where the record for read N
+ * goes in slot N % nslots_, until all the records for earlier reads have
+ * been written.  Each slot has a completion flag that's set atomically
+ * when its record is finished; whichever thread finishes a record and
+ * finds no other thread flushing takes over as the single flusher and
+ * writes out the run of finished slots starting from cur_.  A thread
+ * wanting to start a record more than nslots_ reads ahead of cur_ waits
+ * for the straggler holding up the window to finish.
  */
 class OutputQueue {
 
-	static const size_t NFLUSH_THRESH = 8;
+	// Minimum number of slots in the reordering ring
+	static const size_t MIN_SLOTS = 1024;
+
+	// The ring holds this many batches' worth of records per thread
+	static const size_t BATCHES_PER_THREAD = 4;
 
 public:
 
@@ -45,20 +126,63 @@ public:
 		bool reorder,
 		size_t nthreads,
 		bool threadSafe,
-		TReadId rdid = 0) :
+		TReadId rdid = 0,
+		bool bgzf = false,
+		size_t batchsz = 16,
+		size_t bufsz = 0) :
 		obuf_(obuf),
 		cur_(rdid),
 		nstarted_(0),
 		nfinished_(0),
 		nflushed_(0),
 		lines_(RES_CAT),
-		started_(RES_CAT),
-		finished_(RES_CAT),
+		done_(NULL),
+		nslots_(0),
+		flushing_(0),
 		reorder_(reorder),
 		threadSafe_(threadSafe),
+		bgzf_(bgzf),
+		raw_(RES_CAT),
+		bufsz_(reorder ? 0 : bufsz),
+		bufs_(RES_CAT),
+		writer_(NULL),
+		failed_(false),
         mutex_m()
 	{
 		assert(nthreads <= 1 || threadSafe);
+		if(reorder_) {
+			// Threads claim reads in batches of batchsz, so the window has
+			// to be several batches wide per thread to keep them all busy
+			nslots_ = nthreads * batchsz * BATCHES_PER_THREAD;
+			if(nslots_ < MIN_SLOTS) {
+				nslots_ = MIN_SLOTS;
+			}
+			lines_.resize(nslots_);
+			done_ = new volatile uint32_t[nslots_];
+			for(size_t i = 0; i < nslots_; i++) {
+				lines_[i].clear();
+				done_[i] = 0;
+			}
+		}
+		if(bgzf_) {
+			// Thread ids start at 1
+			raw_.resize(nthreads + 1);
+			for(size_t i = 0; i < raw_.size(); i++) {
+				raw_[i].clear();
+			}
+		}
+		if(bufsz_ > 0) {
+			writer_ = new OutputWriter(obuf_, nthreads + 1);
+			bufs_.resize(nthreads + 1);
+			for(size_t i = 0; i < bufs_.size(); i++) {
+				bufs_[i] = writer_->take();
+			}
+		}
+	}
+
+	~OutputQueue() {
+		delete[] done_;
+		delete writer_;
 	}
 
 	/**
@@ -73,10 +197,18 @@ public:
 	void finishRead(const BTString& rec, TReadId rdid, size_t threadId);
 	
 	/**
-	 * Return the number of records currently being buffered.
+	 * Return true iff records are written out in read-id order.
+	 */
+	bool reorder() const {
+		return reorder_;
+	}
+
+	/**
+	 * Return the number of slots in the reordering ring, or 0 if records
+	 * aren't reordered.
 	 */
 	size_t size() const {
-		return lines_.size();
+		return nslots_;
 	}
 	
 	/**
@@ -105,19 +237,56 @@ public:
 	 */
 	void flush(bool force = false, bool getLock = true);
 
+	/**
+	 * Return true iff some output failed to be written.  Workers should
+	 * stop aligning; flush(true) reports the error.
+	 */
+	bool failed() const {
+		return failed_ || (writer_ != NULL && writer_->failed());
+	}
+
 protected:
 
-	OutFileBuf&     obuf_;
-	TReadId         cur_;
-	TReadId         nstarted_;
-	TReadId         nfinished_;
-	TReadId         nflushed_;
-	EList<BTString> lines_;
-	EList<bool>     started_;
-	EList<bool>     finished_;
-	bool            reorder_;
-	bool            threadSafe_;
-	MUTEX_T         mutex_m;
+	/**
+	 * Become the flusher, unless another thread already is, and write out
+	 * the run of finished slots starting from cur_.
+	 */
+	void flushSlots();
+
+	/**
+	 * Compress whatever is buffered in raw_[i] into BGZF blocks and write
+	 * them out.  'getLock' says whether we must grab the lock before
+	 * writing.
+	 */
+	void flushBgzf(size_t i, bool getLock);
+
+	/**
+	 * Write 'rec' to obuf_, or drop it if an earlier write failed.
+	 */
+	void writeOut(const BTString& rec);
+
+	// Once a thread has buffered this many bytes of uncompressed BGZF
+	// output, it compresses and writes them
+	static const size_t BGZF_FLUSH_SZ = 4 * 0xff00;
+
+	OutFileBuf&        obuf_;
+	volatile TReadId   cur_;       // id of next read to write out, if reorder_
+	volatile TReadId   nstarted_;
+	volatile TReadId   nfinished_;
+	volatile TReadId   nflushed_;
+	EList<BTString>    lines_;     // ring of records waiting to be written
+	volatile uint32_t *done_;      // done_[i] != 0 -> lines_[i] is finished
+	size_t             nslots_;    // # slots in lines_ and done_
+	volatile int       flushing_;  // 1 -> some thread is writing out slots
+	bool               reorder_;
+	bool               threadSafe_;
+	bool               bgzf_;      // compress output into BGZF blocks (for BAM)
+	EList<BTString>    raw_;       // per-thread (or, if reorder_, in-order) data awaiting BGZF compression
+	size_t             bufsz_;     // hand a thread's buffer to writer_ once it's this big; 0 -> don't buffer
+	EList<BTString*>   bufs_;      // per-thread buffers, if bufsz_ > 0
+	OutputWriter      *writer_;    // writes full buffers, if bufsz_ > 0
+	volatile bool      failed_;    // a write to obuf_ failed
+	MUTEX_T            mutex_m;
 };
 
 class OutputQueueMark {
@@ -21,7 +21,13 @@
 #include <iostream>
 #include <string>
 #include <stdexcept>
+#ifdef BOWTIE_MM
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sched.h>
+#endif
 #include "sstring.h"
+#include "simd_seq.h"
 
 #include "pat.h"
 #include "filebuf.h"
@@ -42,7 +48,17 @@ PatternSource* PatternSource::patsrcFromStrings(
 		case FASTA:       return new FastaPatternSource(qs, p);
 		case FASTA_CONT:  return new FastaContinuousPatternSource(qs, p);
 		case RAW:         return new RawPatternSource(qs, p);
-		case FASTQ:       return new FastqPatternSource(qs, p);
+		case FASTQ: {
+#ifdef BOWTIE_MM
+			if(p.mmapReads) {
+				if(MmapFastqPatternSource::canMap(qs)) {
+					return new MmapFastqPatternSource(qs, p);
+				}
+				cerr << "Warning: --mm-reads only applies to uncompressed read files; reading normally" << endl;
+			}
+#endif
+			return new FastqPatternSource(qs, p);
+		}
 		case TAB_MATE5:   return new TabbedPatternSource(qs, p, false);
 		case TAB_MATE6:   return new TabbedPatternSource(qs, p, true);
 		case CMDLINE:     return new VectorPatternSource(qs, p);
@@ -104,6 +120,8 @@ bool PatternSource::nextRead(
 	// it is implemented in concrete subclasses
 	nextReadImpl(r, rdid, endid, success, done);
 	if(success) {
+		// Decode anything the light parse left in readOrigBuf
+		parse(r);
 		// Construct the reversed versions of the fw and rc seqs
 		// and quals
 		r.finalize();
@@ -115,9 +133,95 @@ bool PatternSource::nextRead(
 	return success;
 }
 
+/**
+ * Dispense a batch of up to 'max' unpaired reads.  Only the parsing
+ * done by nextBatchImpl happens in the critical section; the full
+ * parse, reversing and seeding done here happen outside of it.
+ */
+size_t PatternSource::nextBatch(EList<Read>& rs, size_t max) {
+	size_t n = nextBatchImpl(rs, max);
+	for(size_t i = 0; i < n; i++) {
+		finalize(rs[i]);
+	}
+	return n;
+}
+
+/**
+ * Dispense a batch of up to 'max' reads/pairs from a source where both
+ * mates appear in the same file.
+ */
+size_t PatternSource::nextBatchPair(
+	EList<Read>& ra,
+	EList<Read>& rb,
+	EList<bool>& paired,
+	size_t max)
+{
+	size_t n = nextBatchPairImpl(ra, rb, paired, max);
+	for(size_t i = 0; i < n; i++) {
+		finalize(ra[i]);
+		if(!rb[i].empty()) {
+			finalize(rb[i]);
+		}
+	}
+	return n;
+}
+
+/**
+ * Default batch implementation: obtain reads one at a time from
+ * nextReadImpl, entering the critical section once per read.
+ */
+size_t PatternSource::nextBatchImpl(EList<Read>& rs, size_t max) {
+	assert_leq(max, rs.size());
+	size_t n = 0;
+	bool done = false;
+	while(n < max && !done) {
+		TReadId rdid = 0, endid = 0;
+		bool success = false;
+		rs[n].reset();
+		nextReadImpl(rs[n], rdid, endid, success, done);
+		if(success) {
+			rs[n].rdid = rdid;
+			rs[n].endid = endid;
+			n++;
+		}
+	}
+	return n;
+}
+
+/**
+ * Default batch implementation: obtain reads/pairs one at a time from
+ * nextReadPairImpl, entering the critical section once per pair.
+ */
+size_t PatternSource::nextBatchPairImpl(
+	EList<Read>& ra,
+	EList<Read>& rb,
+	EList<bool>& paired,
+	size_t max)
+{
+	assert_leq(max, ra.size());
+	size_t n = 0;
+	bool done = false;
+	while(n < max && !done) {
+		TReadId rdid = 0, endid = 0;
+		bool success = false, pair = false;
+		ra[n].reset();
+		rb[n].reset();
+		nextReadPairImpl(ra[n], rb[n], rdid, endid, success, done, pair);
+		if(success) {
+			ra[n].rdid = rdid;
+			ra[n].endid = endid;
+			paired[n] = pair;
+			n++;
+		}
+	}
+	return n;
+}
+
 /**
  * Get the next paired or unpaired read from the wrapped
- * PairedPatternSource.
+ * PairedPatternSource.  Reads are handed out of the current batch; a
+ * new batch is requested from the PairedPatternSource only once the
+ * current one has been used up.
  */
 bool WrappedPatternSourcePerThread::nextReadPair(
 	bool& success,
@@ -127,10 +231,27 @@ bool WrappedPatternSourcePerThread::nextReadPair(
 {
 	PatternSourcePerThread::nextReadPair(success, done, paired, fixName);
 	ASSERT_ONLY(TReadId lastRdId = rdid_);
-	buf1_.reset();
-	buf2_.reset();
-	patsrc_.nextReadPair(buf1_, buf2_, rdid_, endid_, success, done, paired, fixName);
-	assert(!success || rdid_ != lastRdId);
+	if(cur_ + 1 < nbuf_) {
+		// Next read is already waiting in the batch
+		cur_++;
+	} else {
+		cur_ = 0;
+		nbuf_ = patsrc_.nextBatch(bufa_, bufb_, paired_, bufa_.size(), fixName);
+		if(nbuf_ == 0) {
+			// Input is exhausted
+			bufa_[0].reset();
+			bufb_[0].reset();
+			success = paired = false;
+			done = true;
+			return success;
+		}
+	}
+	success = true;
+	done = false;
+	paired = paired_[cur_];
+	rdid_ = bufa_[cur_].rdid;
+	endid_ = bufa_[cur_].endid;
+	assert(rdid_ != lastRdId);
 	return success;
 }
 
@@ -191,6 +312,46 @@ bool PairedSoloPatternSource::nextReadPair(
 	return false;
 }
 
+/**
+ * Dispense a batch of up to 'max' reads/pairs from the current
+ * PatternSource, moving on to the next one when it runs dry.
+ */
+size_t PairedSoloPatternSource::nextBatch(
+	EList<Read>& ra,
+	EList<Read>& rb,
+	EList<bool>& paired,
+	size_t max,
+	bool fixName)
+{
+	uint32_t cur = cur_;
+	while(cur < src_->size()) {
+		size_t n = (*src_)[cur]->nextBatchPair(ra, rb, paired, max);
+		if(n == 0) {
+			// PatternSource dried up
+			lock();
+			if(cur + 1 > cur_) cur_++;
+			cur = cur_;
+			unlock();
+			continue; // on to next pair of PatternSources
+		}
+		for(size_t i = 0; i < n; i++) {
+			if(!rb[i].empty()) {
+				if(fixName) {
+					ra[i].fixMateName(1);
+					rb[i].fixMateName(2);
+				}
+				rb[i].rdid = ra[i].rdid;
+				rb[i].endid = ra[i].endid+1;
+			}
+			ra[i].mate = 1;
+			rb[i].mate = 2;
+		}
+		return n;
+	}
+	assert_leq(cur, src_->size());
+	return 0;
+}
+
 /**
  * The main member function for dispensing pairs of reads or
  * singleton reads.  Returns true iff ra and rb contain a new
@@ -289,6 +450,81 @@ bool PairedDualPatternSource::nextReadPair(
 	return success;
 }
 
+/**
+ * Dispense a batch of up to 'max' reads/pairs.  When mates come from
+ * parallel files, the lock is held while the batch is drawn from both
+ * files so that this thread gets parallel reads in the two.
+ */
+size_t PairedDualPatternSource::nextBatch(
+	EList<Read>& ra,
+	EList<Read>& rb,
+	EList<bool>& paired,
+	size_t max,
+	bool fixName)
+{
+	// 'cur' indexes the current pair of PatternSources
+	uint32_t cur;
+	{
+		lock();
+		cur = cur_;
+		unlock();
+	}
+	while(cur < srca_->size()) {
+		if((*srcb_)[cur] == NULL) {
+			// Patterns from srca_ are unpaired
+			size_t n = (*srca_)[cur]->nextBatch(ra, max);
+			if(n == 0) {
+				lock();
+				if(cur + 1 > cur_) cur_++;
+				cur = cur_; // Move on to next PatternSource
+				unlock();
+				continue; // on to next pair of PatternSources
+			}
+			for(size_t i = 0; i < n; i++) {
+				rb[i].reset();
+				ra[i].mate = 0;
+				paired[i] = false;
+			}
+			return n;
+		} else {
+			// Patterns from srca_[cur_] and srcb_[cur_] are paired
+			lock();
+			size_t na = (*srca_)[cur]->nextBatchImpl(ra, max);
+			size_t nb = (*srcb_)[cur]->nextBatchImpl(rb, max);
+			if(na < nb) {
+				cerr << "Error, fewer reads in file specified with -1 than in file specified with -2" << endl;
+				throw 1;
+			} else if(na == 0) {
+				if(cur + 1 > cur_) cur_++;
+				cur = cur_; // Move on to next PatternSource
+				unlock();
+				continue; // on to next pair of PatternSources
+			} else if(nb < na) {
+				cerr << "Error, fewer reads in file specified with -2 than in file specified with -1" << endl;
+				throw 1;
+			}
+			unlock();
+			for(size_t i = 0; i < na; i++) {
+				assert_eq(ra[i].rdid, rb[i].rdid);
+				(*srca_)[cur]->finalize(ra[i]);
+				(*srcb_)[cur]->finalize(rb[i]);
+				if(fixName) {
+					ra[i].fixMateName(1);
+					rb[i].fixMateName(2);
+				}
+				if(!rb[i].empty()) {
+					rb[i].endid = ra[i].endid+1;
+				}
+				ra[i].mate = 1;
+				rb[i].mate = 2;
+				paired[i] = true;
+			}
+			return na;
+		}
+	}
+	return 0;
+}
+
 /**
  * Return the number of reads attempted.
  */
@@ -605,6 +841,139 @@ bool VectorPatternSource::nextReadPairImpl(
 	return true;
 }
 
+/**
+ * Claim the index of the next read or pair.  The reads themselves are
+ * immutable, so this is all that needs to happen under the lock.
+ */
+bool MemoryPatternSource::claim(size_t& i, TReadId& rdid, bool& done) {
+	lock();
+	if(cur_ >= m1_.size()) {
+		unlock();
+		done = true;
+		return false;
+	}
+	i = cur_++;
+	done = cur_ == m1_.size();
+	readCnt_++;
+	unlock();
+	// Read ids count from the start of the list, so skipped reads are
+	// accounted for just as they are for reads from files
+	rdid = (TReadId)i;
+	return true;
+}
+
+/**
+ * Check that every read has a sequence and, if it has qualities, one
+ * Phred+33 quality per character.  This happens up front, in the calling
+ * thread, so that the workers never have to report a malformed read.
+ */
+MemoryPatternSource::MemoryPatternSource(
+	const EList<MemoryRead>& m1,
+	const EList<MemoryRead>& m2,
+	const PatternParams& p) :
+	PatternSource(p),
+	cur_(p.skip),
+	skip_(p.skip),
+	m1_(m1),
+	m2_(m2)
+{
+	assert(m2_.empty() || m2_.size() == m1_.size());
+	for(size_t i = 0; i < m1_.size() + m2_.size(); i++) {
+		const MemoryRead& m = (i < m1_.size() ? m1_[i] : m2_[i - m1_.size()]);
+		BTString name(m.name == NULL ? "(unnamed)" : m.name);
+		if(m.seq == NULL) {
+			cerr << "Error: Read " << name << " has no sequence." << endl;
+			throw 1;
+		}
+		if(m.qual == NULL) {
+			continue;
+		}
+		size_t len = strlen(m.seq), qlen = strlen(m.qual);
+		if(qlen < len) {
+			tooFewQualities(name);
+		} else if(qlen > len) {
+			tooManyQualities(name);
+		}
+		for(size_t j = 0; j < qlen; j++) {
+			if(m.qual[j] < 33) {
+				wrongQualityFormat(name);
+			}
+		}
+	}
+}
+
+/**
+ * Copy the name, sequence and qualities of m into r, trimming as
+ * requested by -5/-3.  Characters that aren't nucleotides become Ns.
+ */
+void MemoryPatternSource::install(
+	Read& r,
+	const MemoryRead& m,
+	TReadId rdid) const
+{
+	if(m.name != NULL && m.name[0] != '\0') {
+		r.name.install(m.name);
+	} else {
+		char cbuf[20];
+		itoa10<TReadId>(rdid, cbuf);
+		r.name.install(cbuf);
+	}
+	size_t len = strlen(m.seq);
+	for(size_t i = (size_t)gTrim5; i < len; i++) {
+		int c = (unsigned char)m.seq[i];
+		r.patFw.append(asc2dnacat[c] > 0 ? asc2dna[c] : 4);
+		r.qual.append(m.qual == NULL ? 'I' : m.qual[i]);
+	}
+	r.patFw.trimEnd(gTrim3);
+	r.qual.trimEnd(gTrim3);
+	r.trimmed3 = gTrim3;
+	r.trimmed5 = gTrim5;
+}
+
+bool MemoryPatternSource::nextReadImpl(
+	Read& r,
+	TReadId& rdid,
+	TReadId& endid,
+	bool& success,
+	bool& done)
+{
+	r.reset();
+	size_t i = 0;
+	success = claim(i, rdid, done);
+	if(!success) {
+		return false;
+	}
+	endid = rdid;
+	install(r, m1_[i], rdid);
+	return true;
+}
+
+bool MemoryPatternSource::nextReadPairImpl(
+	Read& ra,
+	Read& rb,
+	TReadId& rdid,
+	TReadId& endid,
+	bool& success,
+	bool& done,
+	bool& paired)
+{
+	ra.reset();
+	rb.reset();
+	size_t i = 0;
+	paired = false;
+	success = claim(i, rdid, done);
+	if(!success) {
+		return false;
+	}
+	endid = rdid;
+	install(ra, m1_[i], rdid);
+	if(!m2_.empty()) {
+		install(rb, m2_[i], rdid);
+		paired = true;
+	}
+	return true;
+}
+
 /**
  * Parse a single quality string from fb and store qualities in r.
  * Assume the next character obtained via fb.get() is the first
@@ -813,7 +1182,25 @@ bool FastaPatternSource::read(
 	return success;
 }
 
-/// Read another pattern from a FASTQ input file
+/**
+ * Append the current run of newline characters to 'buf' and return the
+ * first character after them without consuming it, or -1 for EOF.
+ */
+static inline int copyOverNewline(FileBuf& in, SStringExpandable<char>& buf) {
+	while(true) {
+		int c = in.peek();
+		if(c != '\r' && c != '\n') {
+			return c;
+		}
+		buf.append((char)in.get());
+	}
+}
+
+/**
+ * Light parse: copy the text of the next FASTQ record into r.readOrigBuf
+ * without decoding any of it.  Only this boundary scan happens inside the
+ * critical section; parse() does the rest once the lock is released.
+ */
 bool FastqPatternSource::read(
 	Read& r,
 	TReadId& rdid,
@@ -822,12 +1209,9 @@ bool FastqPatternSource::read(
 	bool& done)
 {
 	int c;
-	int dstLen = 0;
 	success = true;
 	done = false;
 	r.reset();
-	r.color = gColor;
-	r.fuzzy = fuzzy_;
 	// Pick off the first at
 	if(first_) {
 		c = fb_.get();
@@ -844,28 +1228,69 @@ bool FastqPatternSource::read(
 		assert_eq('@', c);
 		first_ = false;
 	}
-
-	// Read to the end of the id line, sticking everything after the '@'
-	// into *name
-	while(true) {
-		c = fb_.get();
-		if(c < 0) {
+	SStringExpandable<char>& buf = r.readOrigBuf;
+	buf.append('@');
+	// Copy the id line
+	if(fb_.getUptoNewline(buf) < 0 || (c = copyOverNewline(fb_, buf)) < 0) {
+		bail(r); success = false; done = true; return success;
+	}
+	// Copy sequence line(s) up to the line beginning with '+'
+	bool sawSeq = false;
+	while(c != '+') {
+		sawSeq = true;
+		if(fb_.getUptoNewline(buf) < 0 || (c = copyOverNewline(fb_, buf)) < 0) {
 			bail(r); success = false; done = true; return success;
 		}
-		if(c == '\n' || c == '\r') {
-			// Break at end of line, after consuming all \r's, \n's
-			while(c == '\n' || c == '\r') {
-				c = fb_.get();
-				if(c < 0) {
-					bail(r); success = false; done = true; return success;
-				}
-			}
-			break;
+	}
+	// Copy the '+' line, which may repeat the read name
+	if(fb_.getUptoNewline(buf) >= 0) {
+		copyOverNewline(fb_, buf);
+		// A read with no sequence has no quality line
+		if(sawSeq && fb_.getUptoNewline(buf) >= 0) {
+			copyOverNewline(fb_, buf);
 		}
-		r.name.append(c);
 	}
-	// fb_ now points just past the first character of a
-	// sequence line, and c holds the first character
+	c = fb_.get();
+	// Should either be at end of file or at beginning of next record
+	assert(c == -1 || c == '@');
+	rdid = endid = readCnt_;
+	r.rdid = rdid; // parse() uses the id to name unnamed reads
+	readCnt_++;
+	return success;
+}
+
+/**
+ * Full parse: decode the name, sequence and qualities of a FASTQ record
+ * from its text in r.readOrigBuf.  This happens outside of any critical
+ * section, so it may only depend on the given (immutable) parameters.
+ */
+static void parseFastqRecord(
+	Read& r,
+	bool solQuals,
+	bool phred64Quals,
+	bool intQuals,
+	bool fuzzy)
+{
+	assert(!r.readOrigBuf.empty());
+	assert(r.patFw.empty());
+	r.color = gColor;
+	r.fuzzy = fuzzy;
+	const char *buf = r.readOrigBuf.buf();
+	const size_t buflen = r.readOrigBuf.length();
+	assert_eq('@', buf[0]);
+	size_t cur = 1;
+	int c;
+	int dstLen = 0;
+
+	// Read to the end of the id line, sticking everything after the '@'
+	// into *name
+	size_t nmlen = seqFindNewline(buf + cur, buflen - cur);
+	r.name.append(buf + cur, nmlen);
+	cur += nmlen;
+	while(cur < buflen && isnewline(buf[cur])) cur++;
+	assert_lt(cur, buflen);
+	c = (unsigned char)buf[cur++];
+	// c holds the first character of a sequence line
 	int charsRead = 0;
 	BTDnaString *sbuf = &r.patFw;
 	int dstLens[] = {0, 0, 0, 0};
@@ -879,7 +1304,7 @@ bool FastqPatternSource::read(
 		c = toupper(c);
 		if(asc2dnacat[c] > 0) {
 			// First char is a DNA char
-			int c2 = toupper(fb_.peek());
+			int c2 = toupper(cur < buflen ? (unsigned char)buf[cur] : -1);
 			// Second char is a color char
 			if(asc2colcat[c2] > 0) {
 				r.primer = c;
@@ -887,11 +1312,35 @@ bool FastqPatternSource::read(
 				mytrim5 += 2; // trim primer and first color
 			}
 		}
-		if(c < 0) {
-			bail(r); success = false; done = true; return success;
-		}
 	}
 	int trim5 = 0;
+	if(c != '+' && !gColor && !fuzzy) {
+		// Fast path for the usual case of a sequence on a single line
+		// consisting only of ACGTN: translate it in one go
+		const size_t sbeg = cur - 1;
+		const size_t slen = seqFindNewline(buf + sbeg, buflen - sbeg);
+		size_t send = sbeg + slen;
+		while(send < buflen && isnewline(buf[send])) send++;
+		if(send < buflen && buf[send] == '+') {
+			r.patFw.resize(slen);
+			if(seqAsciiToDna(r.patFw.wbuf(), buf + sbeg, slen)) {
+				if((int)slen > mytrim5) {
+					if(mytrim5 > 0) {
+						memmove(r.patFw.wbuf(), r.patFw.buf() + mytrim5, slen - mytrim5);
+						r.patFw.resize(slen - mytrim5);
+					}
+				} else {
+					r.patFw.clear();
+				}
+				dstLen = (int)r.patFw.length();
+				charsRead = dstLen + mytrim5;
+				cur = send + 1;
+				c = '+';
+			} else {
+				r.patFw.clear();
+			}
+		}
+	}
 	if(c != '+') {
 		trim5 = mytrim5;
 		while(c != '+') {
@@ -900,7 +1349,7 @@ bool FastqPatternSource::read(
 			if(gColor) {
 				if(c >= '0' && c <= '4') c = "ACGTN"[(int)c - '0'];
 			}
-			if(fuzzy_ && c == '-') c = 'A';
+			if(fuzzy && c == '-') c = 'A';
 			if(isalpha(c)) {
 				// If it's past the 5'-end trim point
 				if(charsRead >= trim5) {
@@ -908,10 +1357,10 @@ bool FastqPatternSource::read(
 					(*dstLenCur)++;
 				}
 				charsRead++;
-			} else if(fuzzy_ && c == ' ') {
+			} else if(fuzzy && c == ' ') {
 				trim5 = 0; // disable 5' trimming for now
 				if(charsRead == 0) {
-					c = fb_.get();
+					c = (unsigned char)buf[cur++];
 					continue;
 				}
 				charsRead = 0;
@@ -923,10 +1372,9 @@ bool FastqPatternSource::read(
 				sbuf = &r.altPatFw[altBufIdx++];
 				dstLenCur = &dstLens[altBufIdx];
 			}
-			c = fb_.get();
-			if(c < 0) {
-				bail(r); success = false; done = true; return success;
-			}
+			// read() guarantees that a '+' line follows
+			assert_lt(cur, buflen);
+			c = (unsigned char)buf[cur++];
 		}
 		dstLen = dstLens[0];
 		charsRead = dstLen + mytrim5;
@@ -948,30 +1396,26 @@ bool FastqPatternSource::read(
 	assert_eq('+', c);
 
 	// Chew up the optional name on the '+' line
-	ASSERT_ONLY(int pk =) peekToEndOfLine(fb_);
+	while(cur < buflen && !isnewline(buf[cur])) cur++;
+	while(cur < buflen && isnewline(buf[cur])) cur++;
 	if(charsRead == 0) {
-		assert(pk == '@' || pk == -1);
-		fb_.get();
-		r.readOrigBuf.install(fb_.lastN(), fb_.lastNLen());
-		fb_.resetLastN();
-		rdid = endid = readCnt_;
-		readCnt_++;
-		return success;
+		return;
 	}
 
 	// Now read the qualities
-	if (intQuals_) {
-		assert(!fuzzy_);
+	if (intQuals) {
+		assert(!fuzzy);
 		int qualsRead = 0;
-		char buf[4096];
 		if(gColor && r.primer != -1) {
 			// In case the original quality string is one shorter
 			mytrim5--;
 		}
-		qualToks_.clear();
-		tokenizeQualLine(fb_, buf, 4096, qualToks_);
-		for(unsigned int j = 0; j < qualToks_.size(); ++j) {
-			char c = intToPhred33(atoi(qualToks_[j].c_str()), solQuals_);
+		size_t qstart = cur;
+		while(cur < buflen && !isnewline(buf[cur])) cur++;
+		EList<string> qualToks;
+		tokenize(string(buf + qstart, cur - qstart), " ", qualToks);
+		for(unsigned int j = 0; j < qualToks.size(); ++j) {
+			char c = intToPhred33(atoi(qualToks[j].c_str()), solQuals);
 			assert_geq(c, 33);
 			if (qualsRead >= mytrim5) {
 				r.qual.append(c);
@@ -993,7 +1437,6 @@ bool FastqPatternSource::read(
 			r.qual.resize(r.patFw.length());
 			assert_eq((int)r.qual.length(), dstLen);
 		}
-		peekOverNewline(fb_);
 	} else {
 		// Non-integer qualities
 		altBufIdx = 0;
@@ -1005,9 +1448,25 @@ bool FastqPatternSource::read(
 			// In case the original quality string is one shorter
 			trim5--;
 		}
-		while(true) {
-			c = fb_.get();
-			if (!fuzzy_ && c == ' ') {
+		bool fastQuals = false;
+		if(!fuzzy && !solQuals && trim5 >= 0) {
+			// Fast path for a quality line with nothing odd in it
+			const size_t qlen = seqFindNewline(buf + cur, buflen - cur);
+			if((int)qlen > trim5 && memchr(buf + cur, ' ', trim5) == NULL) {
+				r.qual.resize(qlen - trim5);
+				if(seqPhredToPhred33(r.qual.wbuf(), buf + cur + trim5,
+				                     qlen - trim5, phred64Quals ? 64 : 33))
+				{
+					qualsRead[0] = (int)qlen;
+					fastQuals = true;
+				} else {
+					r.qual.clear();
+				}
+			}
+		}
+		while(!fastQuals) {
+			c = (cur < buflen ? (unsigned char)buf[cur++] : -1);
+			if (!fuzzy && c == ' ') {
 				wrongQualityFormat(r.name);
 			} else if(c == ' ') {
 				trim5 = 0; // disable 5' trimming for now
@@ -1027,7 +1486,7 @@ bool FastqPatternSource::read(
 			if (c != '\r' && c != '\n') {
 				if (*qualsReadCur >= trim5) {
 					try {
-						c = charToPhred33(c, solQuals_, phred64Quals_);
+						c = charToPhred33(c, solQuals, phred64Quals);
 					}
 					catch (...) {
 						cout << "Error encountered at sequence id: " << r.name << endl;
@@ -1052,7 +1511,7 @@ bool FastqPatternSource::read(
 			r.qual.remove(0);
 		}
 
-		if(fuzzy_) {
+		if(fuzzy) {
 			// Trim from 3' end of alternate basecall and quality strings
 			if(gTrim3 > 0) {
 				for(int i = 0; i < 3; i++) {
@@ -1100,33 +1559,321 @@ bool FastqPatternSource::read(
 				r.alts++;
 			}
 		}
-
-		if(c == '\r' || c == '\n') {
-			c = peekOverNewline(fb_);
-		} else {
-			c = peekToEndOfLine(fb_);
-		}
 	}
-	r.readOrigBuf.install(fb_.lastN(), fb_.lastNLen());
-	fb_.resetLastN();
-
-	c = fb_.get();
-	// Should either be at end of file or at beginning of next record
-	assert(c == -1 || c == '@');
-
 	// Set up a default name if one hasn't been set
 	if(r.name.empty()) {
 		char cbuf[20];
-		itoa10<TReadId>(readCnt_, cbuf);
+		itoa10<TReadId>(r.rdid, cbuf);
 		r.name.install(cbuf);
 	}
 	r.trimmed3 = gTrim3;
 	r.trimmed5 = mytrim5;
-	rdid = endid = readCnt_;
-	readCnt_++;
+}
+
+/**
+ * Decode the record that read() copied into r.readOrigBuf.
+ */
+void FastqPatternSource::parse(Read& r) const {
+	parseFastqRecord(r, solQuals_, phred64Quals_, intQuals_, fuzzy_);
+}
+
+#ifdef BOWTIE_MM
+/**
+ * Memory-map each of the given read files.
+ */
+MmapFastqPatternSource::MmapFastqPatternSource(
+	const EList<string>& infiles,
+	const PatternParams& p) :
+	PatternSource(p),
+	off_(0),
+	pub_(0),
+	solQuals_(p.solexa64),
+	phred64Quals_(p.phred64),
+	intQuals_(p.intQuals),
+	fuzzy_(p.fuzzy)
+{
+	assert_gt(infiles.size(), 0);
+	bool anyOpen = false;
+	uint64_t gbase = 0;
+	for(size_t i = 0; i < infiles.size(); i++) {
+		const char *buf = NULL;
+		uint64_t len = 0;
+		FILE *f = fopen(infiles[i].c_str(), "rb");
+		if(f == NULL) {
+			cerr << "Warning: Could not open read file \"" << infiles[i].c_str() << "\" for reading; skipping..." << endl;
+		} else {
+			anyOpen = true;
+			struct stat sbuf;
+			if(fstat(fileno(f), &sbuf) == -1) {
+				perror("stat");
+				cerr << "Error: Could not stat read file " << infiles[i].c_str() << " prior to memory-mapping" << endl;
+				throw 1;
+			}
+			len = (uint64_t)sbuf.st_size;
+			if(len > 0) {
+				buf = (const char*)mmap((void *)0, (size_t)len,
+				                        PROT_READ, MAP_PRIVATE, fileno(f), 0);
+				if(buf == (void *)(-1) || buf == NULL) {
+					perror("mmap");
+					cerr << "Error: Could not memory-map the read file " << infiles[i].c_str() << endl;
+					throw 1;
+				}
+				madvise((void*)buf, (size_t)len, MADV_SEQUENTIAL);
+			}
+			fclose(f);
+		}
+		// Skip leading whitespace; the first record must start with '@'
+		uint64_t start = 0;
+		while(start < len && isspace(buf[start])) start++;
+		if(start < len && buf[start] != '@') {
+			cerr << "Error: reads file does not look like a FASTQ file" << endl;
+			throw 1;
+		}
+		bufs_.push_back(buf);
+		lens_.push_back(len);
+		starts_.push_back(start);
+		gbase_.push_back(gbase);
+		gbase += len;
+	}
+	gbase_.push_back(gbase);
+	if(!anyOpen) {
+		cerr << "Error: No input read files were valid" << endl;
+		throw 1;
+	}
+	off_ = pub_ = nextStart(0);
+}
+
+MmapFastqPatternSource::~MmapFastqPatternSource() {
+	for(size_t i = 0; i < bufs_.size(); i++) {
+		if(bufs_[i] != NULL) {
+			munmap((void*)bufs_[i], (size_t)lens_[i]);
+		}
+	}
+}
+
+/**
+ * Return true iff every one of the given read files is a regular file
+ * that isn't compressed.  Files that can't be opened don't count against
+ * it; the constructor warns about those.
+ */
+bool MmapFastqPatternSource::canMap(const EList<string>& infiles) {
+	for(size_t i = 0; i < infiles.size(); i++) {
+		if(infiles[i] == "-") {
+			return false;
+		}
+		FILE *f = fopen(infiles[i].c_str(), "rb");
+		if(f == NULL) {
+			continue;
+		}
+		struct stat sbuf;
+		uint8_t magic[COMPRESS_MAGIC_LEN];
+		bool ok = fstat(fileno(f), &sbuf) == 0 && S_ISREG(sbuf.st_mode);
+		if(ok) {
+			size_t n = fread(magic, 1, COMPRESS_MAGIC_LEN, f);
+			ok = compressionFromMagic(magic, n) == COMPRESS_NONE;
+		}
+		fclose(f);
+		if(!ok) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Return the offset, in the concatenation of all files, of the first
+ * record in the first non-empty file at or after file 'f'.
+ */
+uint64_t MmapFastqPatternSource::nextStart(size_t f) const {
+	for(; f < lens_.size(); f++) {
+		if(starts_[f] < lens_[f]) {
+			return gbase_[f] + starts_[f];
+		}
+	}
+	return gbase_.back();
+}
+
+/**
+ * Return the offset of the first '\n' or '\r' at or after 'off' in 'b',
+ * or 'len' if there isn't one.
+ */
+static inline uint64_t mmLineEnd(const char *b, uint64_t off, uint64_t len) {
+	return off + seqFindNewline(b + off, (size_t)(len - off));
+}
+
+/**
+ * Return the offset of the first character at or after 'off' in 'b'
+ * that isn't '\n' or '\r', or 'len' if there isn't one.
+ */
+static inline uint64_t mmOverNewline(const char *b, uint64_t off, uint64_t len) {
+	while(off < len && (b[off] == '\n' || b[off] == '\r')) off++;
+	return off;
+}
+
+/**
+ * Find the end of the record starting at 'off' in file 'f'.  Follows the
+ * same grammar as FastqPatternSource::read: a record missing its name or
+ * sequence lines at the end of the file is incomplete and dropped, one
+ * missing its qualities is kept.
+ */
+uint64_t MmapFastqPatternSource::recordEnd(
+	size_t f,
+	uint64_t off,
+	bool& complete) const
+{
+	const char *b = bufs_[f];
+	const uint64_t len = lens_[f];
+	complete = false;
+	// Name line
+	off = mmLineEnd(b, off + 1, len);
+	off = mmOverNewline(b, off, len);
+	if(off == len) return len;
+	// Sequence line(s) up to the line beginning with '+'
+	bool sawSeq = false;
+	while(b[off] != '+') {
+		sawSeq = true;
+		off = mmLineEnd(b, off, len);
+		off = mmOverNewline(b, off, len);
+		if(off == len) return len;
+	}
+	complete = true;
+	// '+' line, then the quality line if there's a sequence
+	off = mmLineEnd(b, off, len);
+	if(off < len) {
+		off = mmOverNewline(b, off, len);
+		if(sawSeq && off < len) {
+			off = mmLineEnd(b, off, len);
+			off = mmOverNewline(b, off, len);
+		}
+	}
+	// Should either be at end of file or at beginning of next record
+	assert(off == len || b[off] == '@');
+	return off;
+}
+
+/**
+ * Claim up to 'max' records without taking the lock.  We scan for their
+ * boundaries first, then try to swing off_ past them; if another thread
+ * got there first we scan again from wherever it left off.  Read ids must
+ * still be handed out in file order, so once our range is ours we wait
+ * for the claim before it to publish its count to readCnt_ before we
+ * publish ours.  That wait only ever spans a few instructions of the
+ * thread ahead.
+ */
+size_t MmapFastqPatternSource::claim(
+	size_t max,
+	size_t& f,
+	uint64_t& beg,
+	TReadId& rdid)
+{
+	const size_t nfiles = lens_.size();
+	while(true) {
+		const uint64_t goff = off_;
+		if(goff == gbase_[nfiles]) {
+			return 0; // all files exhausted
+		}
+		f = 0;
+		while(goff >= gbase_[f+1]) f++;
+		const uint64_t len = lens_[f];
+		beg = goff - gbase_[f];
+		uint64_t end = beg;
+		size_t n = 0;
+		while(n < max && end < len) {
+			bool complete = false;
+			end = recordEnd(f, end, complete);
+			if(complete) n++;
+		}
+		const uint64_t gend = (end == len) ? nextStart(f+1) : gbase_[f] + end;
+		if(!__sync_bool_compare_and_swap(&off_, goff, gend)) {
+			continue;
+		}
+		while(pub_ != goff) {
+			sched_yield();
+		}
+		__sync_synchronize();
+		rdid = readCnt_;
+		readCnt_ += n;
+		__sync_synchronize();
+		pub_ = gend;
+		// Ask for the next stretch of the file ahead of time when we
+		// cross into a new one
+		const uint64_t win = (1 << 25);
+		if(end < len && (beg / win) != (end / win)) {
+			uint64_t wbeg = (end / win) * win;
+			uint64_t wlen = min<uint64_t>(win, len - wbeg);
+			madvise((void*)(bufs_[f] + wbeg), (size_t)wlen, MADV_WILLNEED);
+		}
+		if(n > 0) {
+			return n;
+		}
+	}
+}
+
+/**
+ * Copy a single record into r.readOrigBuf.
+ */
+bool MmapFastqPatternSource::nextReadImpl(
+	Read& r,
+	TReadId& rdid,
+	TReadId& endid,
+	bool& success,
+	bool& done)
+{
+	size_t f = 0;
+	uint64_t beg = 0;
+	r.reset();
+	success = claim(1, f, beg, rdid) > 0;
+	done = !success;
+	if(success) {
+		bool complete = false;
+		uint64_t end = recordEnd(f, beg, complete);
+		assert(complete);
+		r.readOrigBuf.install(bufs_[f] + beg, (size_t)(end - beg));
+		endid = rdid;
+		r.rdid = rdid; // parse() uses the id to name unnamed reads
+	}
 	return success;
 }
 
+/**
+ * Copy up to 'max' records into rs[0], rs[1], ...
+ */
+size_t MmapFastqPatternSource::nextBatchImpl(EList<Read>& rs, size_t max) {
+	assert_leq(max, rs.size());
+	size_t f = 0;
+	uint64_t off = 0;
+	TReadId rdid = 0;
+	size_t n = claim(max, f, off, rdid);
+	for(size_t i = 0; i < n; i++) {
+		bool complete = false;
+		uint64_t end = recordEnd(f, off, complete);
+		assert(complete);
+		rs[i].reset();
+		rs[i].readOrigBuf.install(bufs_[f] + off, (size_t)(end - off));
+		rs[i].rdid = rs[i].endid = rdid + i;
+		off = end;
+	}
+	return n;
+}
+
+/**
+ * Decode the record that nextReadImpl/nextBatchImpl copied into
+ * r.readOrigBuf.
+ */
+void MmapFastqPatternSource::parse(Read& r) const {
+	parseFastqRecord(r, solQuals_, phred64Quals_, intQuals_, fuzzy_);
+}
+
+/**
+ * Start over from the first record of the first file.  Should only be
+ * called by the master thread.
+ */
+void MmapFastqPatternSource::reset() {
+	PatternSource::reset();
+	off_ = pub_ = nextStart(0);
+}
+#endif
+
 /// Read another pattern from a FASTA input file
 bool TabbedPatternSource::read(
 	Read& r,
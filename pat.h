@@ -105,7 +105,9 @@ struct PatternParams {
 		bool fuzzy_,
 		int sampleLen_,
 		int sampleFreq_,
-		uint32_t skip_) :
+		uint32_t skip_,
+		int readsPerBatch_,
+		bool mmapReads_) :
 		format(format_),
 		fileParallel(fileParallel_),
 		seed(seed_),
@@ -116,7 +118,9 @@ struct PatternParams {
 		fuzzy(fuzzy_),
 		sampleLen(sampleLen_),
 		sampleFreq(sampleFreq_),
-		skip(skip_) { }
+		skip(skip_),
+		readsPerBatch(readsPerBatch_),
+		mmapReads(mmapReads_) { }
 
 	int format;           // file format
 	bool fileParallel;    // true -> wrap files with separate PairedPatternSources
@@ -129,6 +133,8 @@ struct PatternParams {
 	int sampleLen;        // length of sampled reads for FastaContinuous...
 	int sampleFreq;       // frequency of sampled reads for FastaContinuous...
 	uint32_t skip;        // skip the first 'skip' patterns
+	int readsPerBatch;    // # reads/pairs a thread claims per lock acquisition
+	bool mmapReads;       // true -> memory-map uncompressed FASTQ files
 };
 
 /**
@@ -220,6 +226,66 @@ public:
 		bool& success,
 		bool& done) = 0;
 
+	/**
+	 * Dispense a batch of up to 'max' unpaired reads into rs[0], rs[1],
+	 * ...  Reads are finalized and seeded outside of any critical
+	 * section.  Returns the number of reads dispensed; 0 means the
+	 * source is exhausted.
+	 */
+	virtual size_t nextBatch(EList<Read>& rs, size_t max);
+
+	/**
+	 * Dispense a batch of up to 'max' reads or pairs from a source where
+	 * both mates appear in the same file.  paired[i] is set to true iff
+	 * ra[i] and rb[i] make up a pair.  Returns the number of reads/pairs
+	 * dispensed; 0 means the source is exhausted.
+	 */
+	virtual size_t nextBatchPair(
+		EList<Read>& ra,
+		EList<Read>& rb,
+		EList<bool>& paired,
+		size_t max);
+
+	/**
+	 * Fill in the name, sequence and qualities of up to 'max' unpaired
+	 * reads, along with their read ids.  This default implementation
+	 * enters the critical section once per read; concrete subclasses
+	 * that can should override it to claim the whole batch under a
+	 * single acquisition of the lock.
+	 */
+	virtual size_t nextBatchImpl(EList<Read>& rs, size_t max);
+
+	/**
+	 * Batched counterpart to nextReadPairImpl.  Like nextBatchImpl, the
+	 * default implementation enters the critical section once per pair.
+	 */
+	virtual size_t nextBatchPairImpl(
+		EList<Read>& ra,
+		EList<Read>& rb,
+		EList<bool>& paired,
+		size_t max);
+
+	/**
+	 * Finish parsing a read whose raw text was copied into readOrigBuf
+	 * inside the critical section.  This is called outside of any
+	 * critical section, so it must not touch mutable state of the
+	 * source.  Formats that fully parse reads while holding the lock
+	 * leave this as a no-op.
+	 */
+	virtual void parse(Read& r) const { }
+
+	/**
+	 * Finish parsing the read, construct the reversed versions of the
+	 * fw and rc seqs and quals and fill in the random-seed field using a
+	 * combination of information from the user-specified seed and the
+	 * read sequence, qualities, and name.
+	 */
+	void finalize(Read& r) const {
+		parse(r);
+		r.finalize();
+		r.seed = genRandSeed(r.patFw, r.qual, r.name, seed_);
+	}
+
 	/// Reset state to start over again with the first read
 	virtual void reset() { readCnt_ = 0; }
 
@@ -277,7 +343,10 @@ protected:
  */
 class PairedPatternSource {
 public:
-	PairedPatternSource(const PatternParams& p) : mutex_m(), seed_(p.seed) {}
+	PairedPatternSource(const PatternParams& p) :
+		mutex_m(),
+		seed_(p.seed),
+		readsPerBatch_(max<int>(p.readsPerBatch, 1)) { }
 	virtual ~PairedPatternSource() { }
 
 	virtual void addWrapper() = 0;
@@ -293,8 +362,28 @@ public:
 		bool& paired,
 		bool fixName) = 0;
 	
+	/**
+	 * Dispense a batch of up to 'max' reads/pairs into ra[0..n) and
+	 * rb[0..n).  The whole batch is claimed from the underlying
+	 * PatternSource(s) with a single lock acquisition and read ids are
+	 * consecutive within it, so --reorder still works.  Returns n; 0
+	 * means the input is exhausted.
+	 */
+	virtual size_t nextBatch(
+		EList<Read>& ra,
+		EList<Read>& rb,
+		EList<bool>& paired,
+		size_t max,
+		bool fixName) = 0;
+
 	virtual pair<TReadId, TReadId> readCnt() const = 0;
 
+	/**
+	 * Return the number of reads/pairs each per-thread wrapper should
+	 * request at a time.
+	 */
+	size_t readsPerBatch() const { return readsPerBatch_; }
+
 	/**
 	 * Lock this PairedPatternSource, usually because one of its shared
 	 * fields is being updated.
@@ -331,6 +420,7 @@ protected:
 
 	MUTEX_T mutex_m; /// mutex for syncing over critical regions
 	uint32_t seed_;
+	size_t readsPerBatch_; /// # reads/pairs handed to a thread at once
 };
 
 /**
@@ -396,6 +486,17 @@ public:
 		bool& paired,
 		bool fixName);
 
+	/**
+	 * Dispense a batch of up to 'max' reads/pairs.  See
+	 * PairedPatternSource::nextBatch.
+	 */
+	virtual size_t nextBatch(
+		EList<Read>& ra,
+		EList<Read>& rb,
+		EList<bool>& paired,
+		size_t max,
+		bool fixName);
+
 	/**
 	 * Return the number of reads attempted.
 	 */
@@ -488,6 +589,17 @@ public:
 		bool& done,
 		bool& paired,
 		bool fixName);
+
+	/**
+	 * Dispense a batch of up to 'max' reads/pairs.  See
+	 * PairedPatternSource::nextBatch.
+	 */
+	virtual size_t nextBatch(
+		EList<Read>& ra,
+		EList<Read>& rb,
+		EList<bool>& paired,
+		size_t max,
+		bool fixName);
 	
 	/**
 	 * Return the number of reads attempted.
@@ -504,16 +616,31 @@ protected:
 /**
  * Encapsulates a single thread's interaction with the PatternSource.
  * Most notably, this class holds the buffers into which the
- * PatterSource will write sequences.  This class is *not* threadsafe
- * - it doesn't need to be since there's one per thread.  PatternSource
- * is thread-safe.
+ * PatterSource will write sequences.  Reads are obtained in batches so
+ * that the PatternSource's lock is taken once per batch rather than
+ * once per read; bufa() and bufb() refer to the current element of the
+ * batch.  This class is *not* threadsafe - it doesn't need to be since
+ * there's one per thread.  PatternSource is thread-safe.
  */
 class PatternSourcePerThread {
 
 public:
 
-	PatternSourcePerThread() :
-		buf1_(), buf2_(), rdid_(0xffffffff), endid_(0xffffffff) { }
+	PatternSourcePerThread(size_t batchSz = 1) :
+		bufa_(),
+		bufb_(),
+		paired_(),
+		cur_(0),
+		nbuf_(0),
+		rdid_(0xffffffff),
+		endid_(0xffffffff)
+	{
+		assert_gt(batchSz, 0);
+		bufa_.resizeExact(batchSz);
+		bufb_.resizeExact(batchSz);
+		paired_.resizeExact(batchSz);
+		paired_.fill(false);
+	}
 
 	virtual ~PatternSourcePerThread() { }
 
@@ -529,26 +656,32 @@ public:
 		return success;
 	}
 
-	Read& bufa()             { return buf1_;    }	
-	Read& bufb()             { return buf2_;    }
-	const Read& bufa() const { return buf1_;    }
-	const Read& bufb() const { return buf2_;    }
+	Read& bufa()             { return bufa_[cur_]; }
+	Read& bufb()             { return bufb_[cur_]; }
+	const Read& bufa() const { return bufa_[cur_]; }
+	const Read& bufb() const { return bufb_[cur_]; }
 
 	TReadId       rdid()  const { return rdid_;  }
 	TReadId       endid() const { return endid_; }
-	virtual void  reset()       { rdid_ = endid_ = 0xffffffff;  }
+	virtual void  reset()       {
+		rdid_ = endid_ = 0xffffffff;
+		cur_ = nbuf_ = 0;
+	}
 	
 	/**
 	 * Return the length of mate 1 or mate 2.
 	 */
 	size_t length(int mate) const {
-		return (mate == 1) ? buf1_.length() : buf2_.length();
+		return (mate == 1) ? bufa().length() : bufb().length();
 	}
 
 protected:
 
-	Read  buf1_;    // read buffer for mate a
-	Read  buf2_;    // read buffer for mate b
+	EList<Read> bufa_;   // batch of read buffers for mate a
+	EList<Read> bufb_;   // batch of read buffers for mate b
+	EList<bool> paired_; // whether each element of the batch is a pair
+	size_t  cur_;   // index of current read in the batch
+	size_t  nbuf_;  // # reads in the batch
 	TReadId rdid_;  // index of read just read
 	TReadId endid_; // index of read just read
 };
@@ -590,6 +723,7 @@ public:
 class WrappedPatternSourcePerThread : public PatternSourcePerThread {
 public:
 	WrappedPatternSourcePerThread(PairedPatternSource& __patsrc) :
+		PatternSourcePerThread(__patsrc.readsPerBatch()),
 		patsrc_(__patsrc)
 	{
 		patsrc_.addWrapper();
@@ -751,6 +885,73 @@ private:
 	EList<int> trimmed5_;   // names
 };
 
+/**
+ * A read handed to MemoryPatternSource by a program that links Bowtie 2
+ * as a library.  'qual' may be NULL, in which case all qualities are 'I'.
+ */
+struct MemoryRead {
+	const char *name; // read name
+	const char *seq;  // ASCII nucleotides
+	const char *qual; // Phred+33 qualities, or NULL
+};
+
+/**
+ * Encapsulates a source of patterns that the caller already holds in
+ * memory, either unpaired (m2 is empty) or as parallel lists of mates.
+ * The strings are not copied; they must outlive the source.  Only the
+ * claiming of the next read's index happens in the critical section.
+ */
+class MemoryPatternSource : public PatternSource {
+
+public:
+
+	MemoryPatternSource(
+		const EList<MemoryRead>& m1,
+		const EList<MemoryRead>& m2,
+		const PatternParams& p);
+
+	virtual ~MemoryPatternSource() { }
+
+	virtual bool nextReadImpl(
+		Read& r,
+		TReadId& rdid,
+		TReadId& endid,
+		bool& success,
+		bool& done);
+
+	virtual bool nextReadPairImpl(
+		Read& ra,
+		Read& rb,
+		TReadId& rdid,
+		TReadId& endid,
+		bool& success,
+		bool& done,
+		bool& paired);
+
+	virtual void reset() {
+		PatternSource::reset();
+		cur_ = skip_;
+	}
+
+private:
+
+	/**
+	 * Fill in r from m, applying the -5/-3 trimming.
+	 */
+	void install(Read& r, const MemoryRead& m, TReadId rdid) const;
+
+	/**
+	 * Claim the index of the next read, or return false if there are
+	 * none left.
+	 */
+	bool claim(size_t& i, TReadId& rdid, bool& done);
+
+	size_t                   cur_;
+	uint32_t                 skip_;
+	const EList<MemoryRead>& m1_;  // unpaired reads or mate 1s
+	const EList<MemoryRead>& m2_;  // mate 2s, or empty
+};
+
 /**
  *
  */
@@ -842,7 +1043,90 @@ public:
 		unlock();
 		return success;
 	}
-	
+
+	/**
+	 * Fill rs[0], rs[1], ... with up to 'max' reads from the list of read
+	 * files.  The file handle is only touched once per batch, so threads
+	 * contend for the lock far less often than they do with
+	 * nextReadImpl.
+	 */
+	virtual size_t nextBatchImpl(EList<Read>& rs, size_t max) {
+		assert_leq(max, rs.size());
+		size_t n = 0;
+		// We'll be manipulating our file handle/filecur_ state
+		lock();
+		while(n < max) {
+			TReadId rdid = 0, endid = 0;
+			bool success = false, done = false;
+			rs[n].reset();
+			do { read(rs[n], rdid, endid, success, done); }
+			while(!success && !done);
+			if(!success) {
+				assert(done);
+				if(filecur_ < infiles_.size()) {
+					open();
+					resetForNextFile(); // reset state to handle a fresh file
+					filecur_++;
+					continue;
+				}
+				break;
+			}
+			assert(rs[n].repOk());
+			rs[n].rdid = rdid;
+			rs[n].endid = endid;
+			n++;
+		}
+		// Leaving critical region
+		unlock();
+		return n;
+	}
+
+	/**
+	 * Fill ra[0], ra[1], ... and rb[0], rb[1], ... with up to 'max'
+	 * reads/pairs from the list of read files under a single
+	 * acquisition of the lock.
+	 */
+	virtual size_t nextBatchPairImpl(
+		EList<Read>& ra,
+		EList<Read>& rb,
+		EList<bool>& paired,
+		size_t max)
+	{
+		assert_leq(max, ra.size());
+		assert_leq(max, rb.size());
+		assert_leq(max, paired.size());
+		size_t n = 0;
+		// We'll be manipulating our file handle/filecur_ state
+		lock();
+		while(n < max) {
+			TReadId rdid = 0, endid = 0;
+			bool success = false, done = false, pair = false;
+			ra[n].reset();
+			rb[n].reset();
+			do { readPair(ra[n], rb[n], rdid, endid, success, done, pair); }
+			while(!success && !done);
+			if(!success) {
+				assert(done);
+				if(filecur_ < infiles_.size()) {
+					open();
+					resetForNextFile(); // reset state to handle a fresh file
+					filecur_++;
+					continue;
+				}
+				break;
+			}
+			assert(ra[n].repOk());
+			assert(rb[n].repOk());
+			ra[n].rdid = rdid;
+			ra[n].endid = endid;
+			paired[n] = pair;
+			n++;
+		}
+		// Leaving critical region
+		unlock();
+		return n;
+	}
+
 	/**
 	 * Reset state so that we read start reading again from the
 	 * beginning of the first file.  Should only be called by the
@@ -899,8 +1183,7 @@ protected:
 			return;
 		}
 		cerr << "Error: No input read files were valid" << endl;
-		exit(1);
-		return;
+		throw 1;
 	}
 	
 	EList<string> infiles_;  // filenames for read files
@@ -1420,13 +1703,16 @@ protected:
 		}
 	}
 
-	/// Read another pattern from a FASTQ input file
+	/// Copy the text of the next FASTQ record into readOrigBuf
 	virtual bool read(
 		Read& r,
 		TReadId& rdid,
 		TReadId& endid,
 		bool& success,
 		bool& done);
+
+	/// Decode name, sequence and qualities from readOrigBuf
+	virtual void parse(Read& r) const;
 	
 	/// Read another read pair from a FASTQ input file
 	virtual bool readPair(
@@ -1457,7 +1743,7 @@ private:
 	 */
 	void bail(Read& r) {
 		r.patFw.clear();
-		fb_.resetLastN();
+		r.readOrigBuf.clear();
 	}
 
 	bool first_;
@@ -1465,9 +1751,103 @@ private:
 	bool phred64Quals_;
 	bool intQuals_;
 	bool fuzzy_;
-	EList<string> qualToks_;
 };
 
+#ifdef BOWTIE_MM
+/**
+ * Synchronized concrete pattern source for a list of uncompressed FASTQ
+ * files that are memory-mapped rather than read through a FileBuf.
+ * Instead of taking the lock, a thread claims a batch of records by
+ * scanning for their boundaries in the mapping and then atomically
+ * advancing the offset of the first unclaimed byte past them.  The
+ * claimed records are copied straight from the mapping into readOrigBuf
+ * and decoded as by FastqPatternSource.
+ *
+ * Offsets are into the concatenation of all the input files, so a
+ * single word describes where the next claim starts.
+ */
+class MmapFastqPatternSource : public PatternSource {
+
+public:
+
+	MmapFastqPatternSource(
+		const EList<string>& infiles,
+		const PatternParams& p);
+
+	virtual ~MmapFastqPatternSource();
+
+	/**
+	 * Return true iff all the given read files are uncompressed regular
+	 * files that we can map.
+	 */
+	static bool canMap(const EList<string>& infiles);
+
+	virtual bool nextReadImpl(
+		Read& r,
+		TReadId& rdid,
+		TReadId& endid,
+		bool& success,
+		bool& done);
+
+	virtual bool nextReadPairImpl(
+		Read& ra,
+		Read& rb,
+		TReadId& rdid,
+		TReadId& endid,
+		bool& success,
+		bool& done,
+		bool& paired)
+	{
+		// (For now, we shouldn't ever be here)
+		cerr << "In MmapFastqPatternSource.nextReadPairImpl()" << endl;
+		throw 1;
+		return false;
+	}
+
+	virtual size_t nextBatchImpl(EList<Read>& rs, size_t max);
+
+	/// Decode name, sequence and qualities from readOrigBuf
+	virtual void parse(Read& r) const;
+
+	/// Start over from the first record of the first file
+	virtual void reset();
+
+protected:
+
+	/**
+	 * Claim up to 'max' records.  Sets 'f' to the index of the file they
+	 * came from, 'beg' to the offset of the first within that file and
+	 * 'rdid' to the read id of the first.  Returns the number claimed; 0
+	 * means all files are exhausted.
+	 */
+	size_t claim(size_t max, size_t& f, uint64_t& beg, TReadId& rdid);
+
+	/**
+	 * Given that a record starts at 'off' in file 'f', return the offset
+	 * just past it (and past any newlines following it), or the length of
+	 * the file if the record is cut short by the end of the file.
+	 */
+	uint64_t recordEnd(size_t f, uint64_t off, bool& complete) const;
+
+	/**
+	 * Return the offset, in the concatenation of all files, of the first
+	 * record in the first non-empty file at or after file 'f'.
+	 */
+	uint64_t nextStart(size_t f) const;
+
+	EList<const char*> bufs_;  // mapping of each file; NULL if empty
+	EList<uint64_t> lens_;     // length of each file
+	EList<uint64_t> starts_;   // offset of first record in each file
+	EList<uint64_t> gbase_;    // offset of each file in the concatenation
+	volatile uint64_t off_;    // first byte not yet claimed
+	volatile uint64_t pub_;    // readCnt_ counts all records before here
+	bool solQuals_;
+	bool phred64Quals_;
+	bool intQuals_;
+	bool fuzzy_;
+};
+#endif
+
 /**
  * Read a Raw-format file (one sequence per line).  No quality strings
  * allowed.  All qualities are assumed to be 'I' (40 on the Phred-33
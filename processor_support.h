@@ -1,12 +1,18 @@
 #ifndef PROCESSOR_SUPPORT_H_
 #define PROCESSOR_SUPPORT_H_
 
-// Utility class ProcessorSupport provides POPCNTenabled() to determine
-// processor support for POPCNT instruction. It uses CPUID to
-// retrieve the processor capabilities.
-// for Intel ICC compiler __cpuid() is an intrinsic 
+// Utility class ProcessorSupport determines which of the optional
+// instruction set extensions we use (POPCNT, AVX2) the processor
+// we're running on supports. It uses CPUID to retrieve the processor
+// capabilities and, for AVX2, XGETBV to check that the OS saves the YMM
+// register state on a context switch.
+// for Intel ICC compiler __cpuid() is an intrinsic
 // for Microsoft compiler __cpuid() is provided by #include <intrin.h>
 // for GCC compiler __get_cpuid() is provided by #include <cpuid.h>
+//
+// The probe is done once per process; ProcessorSupport::instance()
+// returns the result.  The popcount in bt2_idx.h and the read-parsing
+// routines in simd_seq.h pick their code path from it.
 
 // Intel compiler defines __GNUC__, so this is needed to disambiguate
 
@@ -17,54 +23,78 @@
 #   include <cpuid.h>
 #elif defined(_MSC_VER)
 // __MSC_VER defined by Microsoft compiler
-#define USING MSC_COMPILER
+#define USING_MSC_COMPILER
 #endif
 
 struct regs_t {unsigned int EAX, EBX, ECX, EDX;};
-#define BIT(n) ((1<<n))
+#define BIT(n) ((1u<<n))
 
 class ProcessorSupport {
 
-#ifdef POPCNT_CAPABILITY 
+public:
+	ProcessorSupport() : popcnt_(false), avx2_(false) {
+		probe();
+	}
 
-public: 
-    ProcessorSupport() { } 
-    bool POPCNTenabled()
-    {
-    // from: Intel® 64 and IA-32 Architectures Software Developer’s Manual, 325462-036US,March 2013
-    //Before an application attempts to use the POPCNT instruction, it must check that the
-    //processor supports SSE4.2
-    //“(if CPUID.01H:ECX.SSE4_2[bit 20] = 1) and POPCNT (if CPUID.01H:ECX.POPCNT[bit 23] = 1)”
-    //
-    // see p.272 of http://download.intel.com/products/processor/manual/253667.pdf available at
-    // http://www.intel.com/content/www/us/en/processors/architectures-software-developer-manuals.html
-    // Also http://en.wikipedia.org/wiki/SSE4 talks about available on Intel & AMD processors
+	/**
+	 * Return the result of probing the processor we're running on.
+	 * The probe happens the first time this is called.
+	 */
+	static const ProcessorSupport& instance() {
+		static const ProcessorSupport ps;
+		return ps;
+	}
 
-    regs_t regs;
+	/**
+	 * Return true iff the POPCNT instruction can be used.
+	 */
+	bool POPCNTenabled() const { return popcnt_; }
+
+	/**
+	 * Return true iff AVX2 instructions can be used.
+	 */
+	bool AVX2enabled() const { return avx2_; }
+
+protected:
+
+	void probe() {
+	// from: Intel 64 and IA-32 Architectures Software Developer's Manual, 325462-036US,March 2013
+	//Before an application attempts to use the POPCNT instruction, it must check that the
+	//processor supports SSE4.2
+	//"(if CPUID.01H:ECX.SSE4_2[bit 20] = 1) and POPCNT (if CPUID.01H:ECX.POPCNT[bit 23] = 1)"
+	//
+	// see p.272 of http://download.intel.com/products/processor/manual/253667.pdf available at
+	// http://www.intel.com/content/www/us/en/processors/architectures-software-developer-manuals.html
+	// Also http://en.wikipedia.org/wiki/SSE4 talks about available on Intel & AMD processors
+	//
+	// AVX2 is CPUID.(EAX=07H,ECX=0):EBX[bit 5].  It also needs
+	// CPUID.01H:ECX.OSXSAVE [bit 27] and, in XCR0, the XMM/YMM state bits
+	// (1, 2).
+
+	regs_t regs;
 
-    try {
 #if ( defined(USING_INTEL_COMPILER) || defined(USING_MSC_COMPILER) )
-        __cpuid((void *) &regs,0); // test if __cpuid() works, if not catch the exception
-        __cpuid((void *) &regs,0x1); // POPCNT bit is bit 23 in ECX
+		__cpuid((void *) &regs,0x1); // POPCNT bit is bit 23 in ECX
+		popcnt_ = (regs.ECX & BIT(20)) && (regs.ECX & BIT(23));
 #elif defined(USING_GCC_COMPILER)
-        __get_cpuid(0x1, &regs.EAX, &regs.EBX, &regs.ECX, &regs.EDX);
-#else
-        std::cerr << “ERROR: please define __cpuid() for this build.\n”; 
-        assert(0);
+		if(!__get_cpuid(0x1, &regs.EAX, &regs.EBX, &regs.ECX, &regs.EDX)) {
+			return;
+		}
+		popcnt_ = (regs.ECX & BIT(20)) && (regs.ECX & BIT(23));
+		if(!(regs.ECX & BIT(27)) || __get_cpuid_max(0, 0) < 7) {
+			return;
+		}
+		unsigned int xcr0, xcr0hi;
+		__asm__ ("xgetbv" : "=a" (xcr0), "=d" (xcr0hi) : "c" (0));
+		__cpuid_count(7, 0, regs.EAX, regs.EBX, regs.ECX, regs.EDX);
+		if((xcr0 & 0x06) == 0x06) {
+			avx2_ = (regs.EBX & BIT(5)) != 0;
+		}
 #endif
-        if( !( (regs.ECX & BIT(20)) && (regs.ECX & BIT(23)) ) ) return false;
-    }
-    catch (int e) {
-        return false;
-    }
-    return true;
-    }
+	}
 
-#endif // POPCNT_CAPABILITY
+	bool popcnt_;   // SSE4.2 and POPCNT
+	bool avx2_;     // AVX2, with OS support for YMM state
 };
 
 #endif /*PROCESSOR_SUPPORT_H_*/
-
-
-
-
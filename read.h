@@ -75,11 +75,7 @@ struct Read {
 	 * Finish initializing a new read.
 	 */
 	void finalize() {
-		for(size_t i = 0; i < patFw.length(); i++) {
-			if((int)patFw[i] > 3) {
-				ns_++;
-			}
-		}
+		ns_ += seqCountNs(patFw.buf(), patFw.length());
 		constructRevComps();
 		constructReverses();
 	}
@@ -36,6 +36,7 @@ BitPairReference::BitPairReference(
 	bool infilesSeq,
 	bool useMm,
 	bool useShmem,
+	bool useHugePages,
 	bool mmSweep,
 	bool verbose,
 	bool startVerbose) :
@@ -45,6 +46,8 @@ BitPairReference::BitPairReference(
 	sanity_(sanity),
 	useMm_(useMm),
 	useShmem_(useShmem),
+	useHugePages_(useHugePages),
+	hugeBuf_(false),
 	verbose_(verbose)
 {
 	string s3 = in + ".3." + gEbwt_ext;
@@ -84,6 +87,9 @@ BitPairReference::BitPairReference(
 			cerr << "Error: Could not memory-map the index file " << s4.c_str() << endl;
 			throw 1;
 		}
+		if(useHugePages_) {
+			adviseHugePages(mmFile, (size_t)sbuf.st_size);
+		}
 		if(mmSweep) {
 			TIndexOff sum = 0;
 			for(off_t i = 0; i < sbuf.st_size; i += 1024) {
@@ -200,7 +206,11 @@ BitPairReference::BitPairReference(
 		if(!useShmem_) {
 			// Allocate a buffer to hold the reference string
 			try {
-				buf_ = new uint8_t[cumsz >> 2];
+				if(useHugePages_) {
+					buf_ = (uint8_t*)allocHugePages(cumsz >> 2);
+					hugeBuf_ = (buf_ != NULL);
+				}
+				if(buf_ == NULL) buf_ = new uint8_t[cumsz >> 2];
 				if(buf_ == NULL) throw std::bad_alloc();
 			} catch(std::bad_alloc& e) {
 				cerr << "Error: Ran out of memory allocating space for the bitpacked reference.  Please" << endl
@@ -209,7 +219,7 @@ BitPairReference::BitPairReference(
 			}
 		} else {
 			shmemLeader = ALLOC_SHARED_U8(
-										  (s4 + "[ref]"), (cumsz >> 2), &buf_,
+										  s4, (cumsz >> 2), &buf_,
 										  "ref", (verbose_ || startVerbose));
 		}
 		if(shmemLeader) {
@@ -314,7 +324,16 @@ BitPairReference::BitPairReference(
 }
 
 BitPairReference::~BitPairReference() {
-	if(buf_ != NULL && !useMm_ && !useShmem_) delete[] buf_;
+	if(buf_ != NULL && useShmem_) {
+		FREE_SHARED(buf_);
+	}
+	if(buf_ != NULL && !useMm_ && !useShmem_) {
+		if(hugeBuf_) {
+			freeHugePages(buf_, bufAllocSz_);
+		} else {
+			delete[] buf_;
+		}
+	}
 	if(sanityBuf_ != NULL) delete[] sanityBuf_;
 }
 
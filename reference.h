@@ -33,6 +33,7 @@
 #include "sequence_io.h"
 #include "mm.h"
 #include "shmem.h"
+#include "hugepage.h"
 #include "timer.h"
 #include "sstring.h"
 #include "btypes.h"
@@ -71,6 +72,7 @@ public:
 		bool infilesSeq = false,
 		bool useMm = false,
 		bool useShmem = false,
+		bool useHugePages = false,
 		bool mmSweep = false,
 		bool verbose = false,
 		bool startVerbose = false);
@@ -182,6 +184,8 @@ protected:
 	bool     sanity_;   /// do sanity checking
 	bool     useMm_;    /// load the reference as a memory-mapped file
 	bool     useShmem_; /// load the reference into shared memory
+	bool     useHugePages_; /// back the reference with huge pages
+	bool     hugeBuf_;  /// buf_ came from allocHugePages()
 	bool     verbose_;
 	ASSERT_ONLY(SStringExpandable<uint32_t> tmp_destU32_);
 };
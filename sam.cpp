@@ -70,6 +70,105 @@ void SamConfig::printHeader(
 	if(printPg) printPgLine(o);
 }
 
+/**
+ * Print BAM header to given output buffer: magic string, SAM header text,
+ * then the name and length of each reference sequence, in the same order
+ * as the @SQ lines so that BAM records can refer to them by index.
+ */
+void SamConfig::printBamHeader(
+	BTString& o,
+	const string& rgid,
+	const string& rgs,
+	bool printHd,
+	bool printSq,
+	bool printPg) const
+{
+	BTString text, name;
+	printHeader(text, rgid, rgs, printHd, printSq, printPg);
+	o.append("BAM\1");
+	bamAppend32(o, (uint32_t)text.length());
+	o.append(text.buf(), text.length());
+	bamAppend32(o, (uint32_t)refnames_.size());
+	for(size_t i = 0; i < refnames_.size(); i++) {
+		name.clear();
+		printRefName(name, refnames_[i]);
+		bamAppend32(o, (uint32_t)(name.length() + 1));
+		o.append(name.buf(), name.length());
+		o.append('\0');
+		bamAppend32(o, (uint32_t)reflens_[i]);
+	}
+}
+
+/**
+ * Convert tab-separated SAM optional fields of the form TAG:TYPE:VALUE to
+ * BAM's binary encoding and append them to 'o'.  Integers are stored in
+ * the smallest type that holds them, as samtools does.
+ */
+void SamConfig::samOptFlagsToBam(BTString& o, const BTString& flags) {
+	const char *p = flags.buf();
+	const char *end = p + flags.length();
+	while(p < end) {
+		const char *fend = (const char *)memchr(p, '\t', end - p);
+		if(fend == NULL) fend = end;
+		if(fend - p < 5 || p[2] != ':' || p[4] != ':') {
+			cerr << "Error: malformed SAM optional field while writing BAM" << endl;
+			throw 1;
+		}
+		const char *val = p + 5;
+		size_t vlen = fend - val;
+		o.append(p[0]);
+		o.append(p[1]);
+		switch(p[3]) {
+			case 'i': {
+				string v(val, vlen);
+				int64_t n = strtoll(v.c_str(), NULL, 10);
+				if(n < 0) {
+					if(n >= -128) {
+						o.append('c'); o.append((char)n);
+					} else if(n >= -32768) {
+						o.append('s'); bamAppend16(o, (uint16_t)n);
+					} else {
+						o.append('i'); bamAppend32(o, (uint32_t)n);
+					}
+				} else {
+					if(n <= 255) {
+						o.append('C'); o.append((char)n);
+					} else if(n <= 65535) {
+						o.append('S'); bamAppend16(o, (uint16_t)n);
+					} else {
+						o.append('I'); bamAppend32(o, (uint32_t)n);
+					}
+				}
+				break;
+			}
+			case 'f': {
+				string v(val, vlen);
+				float f = (float)atof(v.c_str());
+				uint32_t u;
+				memcpy(&u, &f, sizeof(u));
+				o.append('f');
+				bamAppend32(o, u);
+				break;
+			}
+			case 'A':
+				o.append('A');
+				o.append(vlen > 0 ? val[0] : ' ');
+				break;
+			case 'Z':
+			case 'H':
+				o.append(p[3]);
+				o.append(val, vlen);
+				o.append('\0');
+				break;
+			default:
+				cerr << "Error: SAM optional field type '" << p[3]
+				     << "' not supported in BAM output" << endl;
+				throw 1;
+		}
+		p = fend + 1;
+	}
+}
+
 /**
  * Print the @HD header line to the given string.
  */
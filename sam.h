@@ -42,6 +42,21 @@ enum {
 	SAM_FLAG_DUPLICATE      = 1024 // PCR or optical duplicate
 };
 
+/**
+ * Append a 16- or 32-bit integer to 'o' in little-endian byte order, as
+ * BAM requires.
+ */
+static inline void bamAppend16(BTString& o, uint16_t v) {
+	o.append((char)(v & 0xff));
+	o.append((char)(v >> 8));
+}
+
+static inline void bamAppend32(BTString& o, uint32_t v) {
+	for(int i = 0; i < 4; i++) {
+		o.append((char)(v >> (8 * i)));
+	}
+}
+
 class AlnRes;
 class AlnFlags;
 class AlnSetSumm;
@@ -263,6 +278,25 @@ public:
 		bool printPg)
 		const;
 
+	/**
+	 * Print BAM header to given output buffer: the SAM header text
+	 * followed by the binary list of reference sequences.
+	 */
+	void printBamHeader(
+		BTString& o,
+		const std::string& rgid,
+		const std::string& rgs,
+		bool printHd,
+		bool printSq,
+		bool printPg)
+		const;
+
+	/**
+	 * Convert SAM optional fields, as printed by printAlignedOptFlags or
+	 * printEmptyOptFlags, to BAM's binary encoding and append them to 'o'.
+	 */
+	static void samOptFlagsToBam(BTString& o, const BTString& flags);
+
 	/**
 	 * Print the @HD header line to the given string.
 	 */
@@ -0,0 +1,143 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * bt2_lib_test.c:
+ *
+ * Align the reads in a FASTQ file (or a pair of them) through
+ * libbowtie2.a and print each record as SAM, minus the SEQ and QUAL
+ * columns, which bt2_record doesn't carry.  'make bt2-lib-test' compares
+ * the result with what bowtie2-align-s prints for the same reads.
+ *
+ * Usage: bt2_lib_test <index> <reads.fq> [<reads_2.fq>]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bt2_lib.h"
+
+/*
+ * Read the FASTQ file at 'path' into a newly allocated array of reads and
+ * return the number of reads, or exit with a message on failure.
+ */
+static size_t readFastq(const char *path, bt2_read **reads) {
+	FILE *f = fopen(path, "r");
+	size_t n = 0, cap = 1024;
+	char line[4][4096];
+	if(f == NULL) {
+		fprintf(stderr, "Error: Could not open %s\n", path);
+		exit(1);
+	}
+	*reads = (bt2_read *)malloc(cap * sizeof(bt2_read));
+	while(*reads != NULL && fgets(line[0], sizeof(line[0]), f) != NULL) {
+		int i;
+		for(i = 1; i < 4; i++) {
+			if(fgets(line[i], sizeof(line[i]), f) == NULL) {
+				fprintf(stderr, "Error: Truncated FASTQ record in %s\n", path);
+				exit(1);
+			}
+		}
+		for(i = 0; i < 4; i++) {
+			line[i][strcspn(line[i], "\r\n")] = '\0';
+		}
+		if(n == cap) {
+			cap *= 2;
+			*reads = (bt2_read *)realloc(*reads, cap * sizeof(bt2_read));
+			if(*reads == NULL) break;
+		}
+		/* Name stops at the first whitespace, as in bowtie2's output */
+		line[0][strcspn(line[0], " \t")] = '\0';
+		(*reads)[n].name = strdup(line[0] + 1);
+		(*reads)[n].seq = strdup(line[1]);
+		(*reads)[n].qual = strdup(line[3]);
+		n++;
+	}
+	if(*reads == NULL) {
+		fprintf(stderr, "Error: Out of memory\n");
+		exit(1);
+	}
+	fclose(f);
+	return n;
+}
+
+/*
+ * Print a tab and then the SAM RNAME for the given reference id, which
+ * like bowtie2's is the reference name up to the first whitespace.
+ */
+static void printRef(const bt2_index *idx, int64_t refid) {
+	const char *name = refid < 0 ? "*" : bt2_index_refname(idx, (size_t)refid);
+	printf("\t%.*s", (int)strcspn(name, " \t"), name);
+}
+
+int main(int argc, const char **argv) {
+	const char *loadArgs[] = { argv[0], "--quiet", "-x", NULL };
+	bt2_read *reads1 = NULL, *reads2 = NULL;
+	bt2_record *recs = NULL;
+	size_t n, n2, nrecs = 0, i;
+	bt2_index *idx;
+	int ret;
+	if(argc < 3 || argc > 4) {
+		fprintf(stderr, "Usage: %s <index> <reads.fq> [<reads_2.fq>]\n", argv[0]);
+		return 1;
+	}
+	n = readFastq(argv[2], &reads1);
+	if(argc == 4) {
+		n2 = readFastq(argv[3], &reads2);
+		if(n2 != n) {
+			fprintf(stderr, "Error: %s and %s hold different numbers of reads\n",
+			        argv[2], argv[3]);
+			return 1;
+		}
+	}
+	loadArgs[3] = argv[1];
+	idx = bt2_index_load(4, loadArgs);
+	if(idx == NULL) {
+		return 1;
+	}
+	ret = bt2_align(idx, 0, NULL, reads1, reads2, n, &recs, &nrecs);
+	if(ret != 0) {
+		bt2_index_free(idx);
+		return ret;
+	}
+	for(i = 0; i < nrecs; i++) {
+		const bt2_record *r = &recs[i];
+		printf("%s\t%d", (r->mate == 2 ? reads2 : reads1)[r->read].name, r->flag);
+		printRef(idx, r->refid);
+		printf("\t%lld\t%d\t%s",
+		       (long long)(r->pos + 1),
+		       r->mapq,
+		       r->cigar[0] == '\0' ? "*" : r->cigar);
+		if(r->next_refid >= 0 && r->next_refid == r->refid) {
+			printf("\t=");
+		} else {
+			printRef(idx, r->next_refid);
+		}
+		printf("\t%lld\t%lld",
+		       (long long)(r->next_pos + 1),
+		       (long long)r->isize);
+		if(r->opts[0] != '\0') {
+			printf("\t%s", r->opts);
+		}
+		printf("\n");
+	}
+	bt2_records_free(recs, nrecs);
+	bt2_index_free(idx);
+	return 0;
+}
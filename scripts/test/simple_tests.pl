@@ -33,6 +33,9 @@ use Data::Dumper;
 use DNA;
 use Clone qw(clone);
 use Test::Deep;
+use IO::Uncompress::Gunzip qw(gunzip $GunzipError);
+use POSIX qw(WNOHANG);
+use Cwd qw(getcwd);
 
 my $bowtie2 = "";
 my $bowtie2_build = "";
@@ -4013,6 +4016,57 @@ my @cases = (
 	},
 );
 
+##
+# Options that mustn't change what bowtie2 reports.  Each case aligns the
+# same simulated reads with and without 'args' and checks that the SAM
+# records (all but the @PG header line) come out identical.  Set 'paired'
+# to align the simulated pairs instead, and 'bam' if 'args' makes bowtie2
+# write BAM, which is decoded to SAM for the comparison.  Set 'server' to
+# run the second alignment as a --connect job on a bowtie2 --server started
+# for the case; both runs then use the bowtie2-align binary directly.  The
+# server runs in / so that the job's relative paths only work if they're
+# resolved against the client's working directory.
+#
+my @same_output_cases = (
+
+	{ name   => "--mm-reads matches plain run",
+	  args   => "--mm-reads" },
+
+	{ name   => "--mm-reads matches plain run (paired)",
+	  args   => "--mm-reads",
+	  paired => 1 },
+
+	{ name   => "--bam matches plain run",
+	  args   => "--bam",
+	  bam    => 1 },
+
+	{ name   => "--bam matches plain run (paired)",
+	  args   => "--bam",
+	  bam    => 1,
+	  paired => 1 },
+
+	{ name   => "--no-dp-filter matches plain run",
+	  args   => "--no-dp-filter" },
+
+	{ name   => "--no-dp-filter matches plain run (paired)",
+	  args   => "--no-dp-filter",
+	  paired => 1 },
+
+	{ name   => "--connect job matches plain run",
+	  server => 1 },
+
+	{ name   => "--connect job matches plain run (paired)",
+	  server => 1,
+	  paired => 1 },
+
+	{ name   => "--dup-cache-sz matches plain run",
+	  args   => "--dup-cache-sz 16" },
+
+	{ name   => "--dup-cache-sz matches plain run (paired)",
+	  args   => "--dup-cache-sz 16",
+	  paired => 1 },
+);
+
 ##
 # Take a list of reference sequences and write them to a temporary
 # FASTA file of the given name.
@@ -4254,6 +4308,305 @@ sub matchSamOptionalFlags($$) {
 	return 1;
 }
 
+##
+# Deterministic pseudo-random numbers in [0, n), so that the simulated
+# reads don't depend on Perl's rand().
+#
+my $lcgState = 1;
+sub lcgRand($) {
+	my $n = shift;
+	$lcgState = ($lcgState * 69069 + 1) % 4294967296;
+	return int($lcgState / 4294967296 * $n);
+}
+
+sub lcgSeq($) {
+	my $len = shift;
+	return join("", map { substr("ACGT", lcgRand(4), 1) } 1..$len);
+}
+
+##
+# Copy 'len' characters of 'ref' starting at 'off', then add 'nmm'
+# mismatches at or after read offset 'mmlo' and, if 'indel' is set, a
+# 1-char insertion or deletion.
+#
+sub simRead($$$$$$) {
+	my ($ref, $off, $len, $nmm, $indel, $mmlo) = @_;
+	my $rd = substr($ref, $off, $len + 1);
+	if($indel) {
+		my $i = 20 + lcgRand($len - 40);
+		if(lcgRand(2) == 0) {
+			substr($rd, $i, 1) = "";
+		} else {
+			substr($rd, $i, 0) = substr("ACGT", lcgRand(4), 1);
+		}
+	}
+	$rd = substr($rd, 0, $len);
+	for(1..$nmm) {
+		my $i = $mmlo + lcgRand($len - $mmlo);
+		my $c = substr($rd, $i, 1);
+		substr($rd, $i, 1) = substr("ACGT", (index("ACGT", $c) + 1 + lcgRand(3)) % 4, 1);
+	}
+	return $rd;
+}
+
+##
+# Simulate the reference, reads and pairs for @same_output_cases.  Some
+# reads and pairs are repeated under another name, and a few reads don't
+# align, either because they're random or because they have too many
+# mismatches.
+#
+sub simSameOutput() {
+	$lcgState = 1;
+	my @refs = (lcgSeq(1500), lcgSeq(1200));
+	my (@reads, @quals, @names, @m1s, @m2s, @q1s, @q2s, @pnames);
+	for my $i (0..29) {
+		my $ref = $refs[$i % 2];
+		my $rd = simRead($ref, lcgRand(length($ref) - 120), 100, $i % 5, $i % 7 == 3, 0);
+		$rd = DNA::revcomp($rd) if $i % 3 == 0;
+		my $qual = "I" x 100;
+		$qual = join("", map { chr(35 + lcgRand(40)) } 1..100) if $i % 4 == 1;
+		push @reads, $rd;
+		push @quals, $qual;
+		push @names, "r$i";
+	}
+	for my $i (0..2) {
+		push @reads, lcgSeq(100);
+		push @quals, "I" x 100;
+		push @names, "random$i";
+	}
+	for my $i (0..3) {
+		# Seeds from the first 40 characters hit, but there are too many
+		# mismatches after them for the extension to succeed
+		my $ref = $refs[$i % 2];
+		push @reads, simRead($ref, lcgRand(length($ref) - 120), 100, 24, 0, 40);
+		push @quals, "I" x 100;
+		push @names, "diverged$i";
+	}
+	for my $i (0..9) {
+		push @reads, $reads[$i];
+		push @quals, $quals[$i];
+		push @names, "r${i}_again";
+	}
+	for my $i (0..11) {
+		my $ref = $refs[$i % 2];
+		my $off = lcgRand(length($ref) - 320);
+		my $frag = 250 + lcgRand(50);
+		push @m1s, simRead($ref, $off, 100, $i % 4, $i % 5 == 2, 0);
+		push @m2s, DNA::revcomp(simRead($ref, $off + $frag - 100, 100, ($i + 2) % 4, 0, 0));
+		push @q1s, "I" x 100;
+		push @q2s, "I" x 100;
+		push @pnames, "p$i";
+	}
+	for my $i (0..3) {
+		push @m1s, $m1s[$i];
+		push @m2s, $m2s[$i];
+		push @q1s, $q1s[$i];
+		push @q2s, $q2s[$i];
+		push @pnames, "p${i}_again";
+	}
+	return (\@refs, \@reads, \@quals, \@names, \@m1s, \@q1s, \@m2s, \@q2s, \@pnames);
+}
+
+##
+# Return the lines of a SAM file, minus the @PG line, which holds the
+# command line.
+#
+sub readSam($) {
+	my $fn = shift;
+	my @ls = ();
+	open(SAM, $fn) || die "Could not open '$fn' for reading";
+	while(<SAM>) {
+		chomp;
+		push @ls, $_ unless substr($_, 0, 3) eq "\@PG";
+	}
+	close(SAM);
+	return @ls;
+}
+
+##
+# Decode a BAM file into SAM lines, minus the @PG line.  Integer tags of
+# every width are printed as SAM's 'i' type.
+#
+sub readBam($) {
+	my $fn = shift;
+	my $raw;
+	gunzip($fn => \$raw, MultiStream => 1) ||
+		die "Could not decompress BAM file '$fn': $GunzipError";
+	my $p = 0;
+	my $take = sub { my $n = shift; $p += $n; return substr($raw, $p - $n, $n); };
+	$take->(4) eq "BAM\1" || die "Bad magic in BAM file '$fn'";
+	my @ls = grep { substr($_, 0, 3) ne "\@PG" }
+		split(/\n/, $take->(unpack("l<", $take->(4))));
+	my @refs = ();
+	for (1..unpack("l<", $take->(4))) {
+		my $nm = $take->(unpack("l<", $take->(4)));
+		$nm =~ s/\0$//;
+		push @refs, $nm;
+		$take->(4); # length
+	}
+	my %ints = ("c" => ["c", 1], "C" => ["C", 1], "s" => ["s<", 2],
+	            "S" => ["S<", 2], "i" => ["l<", 4], "I" => ["L<", 4]);
+	while($p < length($raw)) {
+		my $rec = $take->(unpack("l<", $take->(4)));
+		my ($refid, $pos, $lname, $mapq, $bin, $ncig, $flag, $lseq,
+		    $nrefid, $npos, $tlen) = unpack("l< l< C C S< S< S< l< l< l< l<", $rec);
+		my $q = 32;
+		my $name = substr($rec, $q, $lname - 1);
+		$q += $lname;
+		my $cigar = join("", map { ($_ >> 4).substr("MIDNSHP=X", $_ & 15, 1) }
+			unpack("L<$ncig", substr($rec, $q, 4 * $ncig)));
+		$cigar = "*" if $cigar eq "";
+		$q += 4 * $ncig;
+		my @nybs = unpack("C*", substr($rec, $q, ($lseq + 1) >> 1));
+		my $seq = join("", map {
+			substr("=ACMGRSVTWYHKDBN", ($nybs[$_ >> 1] >> (($_ & 1) ? 0 : 4)) & 15, 1)
+		} 0..$lseq-1);
+		$q += ($lseq + 1) >> 1;
+		my @qs = unpack("C*", substr($rec, $q, $lseq));
+		my $qual = join("", map { chr($_ + 33) } @qs);
+		$q += $lseq;
+		$seq = "*" if $lseq == 0;
+		$qual = "*" if $lseq == 0 || $qs[0] == 255;
+		my @tags = ();
+		while($q < length($rec)) {
+			my ($tag, $ty) = (substr($rec, $q, 2), substr($rec, $q + 2, 1));
+			$q += 3;
+			my $v;
+			if(defined($ints{$ty})) {
+				my ($fmt, $sz) = @{$ints{$ty}};
+				$v = unpack($fmt, substr($rec, $q, $sz));
+				$q += $sz;
+				$ty = "i";
+			} elsif($ty eq "A") {
+				$v = substr($rec, $q++, 1);
+			} elsif($ty eq "f") {
+				$v = unpack("f<", substr($rec, $q, 4));
+				$q += 4;
+			} elsif($ty eq "Z" || $ty eq "H") {
+				my $end = index($rec, "\0", $q);
+				$v = substr($rec, $q, $end - $q);
+				$q = $end + 1;
+			} else {
+				die "Unexpected type '$ty' for tag $tag in BAM file '$fn'";
+			}
+			push @tags, "$tag:$ty:$v";
+		}
+		my $rnext = "*";
+		$rnext = ($nrefid == $refid ? "=" : $refs[$nrefid]) if $nrefid >= 0;
+		push @ls, join("\t", $name, $flag, ($refid >= 0 ? $refs[$refid] : "*"),
+			$pos + 1, $mapq, $cigar, $rnext, $npos + 1, $tlen, $seq, $qual, @tags);
+	}
+	return @ls;
+}
+
+##
+# Die unless the two lists of SAM lines are identical.
+#
+sub sameSamLines($$$) {
+	my ($name, $ex, $got) = @_;
+	for(my $i = 0; $i < max(scalar(@$ex), scalar(@$got)); $i++) {
+		my $e = $ex->[$i];
+		my $g = $got->[$i];
+		$e = "(no line)" unless defined($e);
+		$g = "(no line)" unless defined($g);
+		$e eq $g ||
+			die "$name: output differs from plain run at line ".($i+1).
+			    ":\nexpected: $e\n     got: $g\n";
+	}
+}
+
+##
+# Align the simulated reads with and without the case's arguments and
+# compare the output.
+#
+##
+# Start a bowtie2 server with the given command line in the given
+# directory and wait for it to create its socket.  Returns the server's
+# pid.
+#
+sub startServer($$$) {
+	my ($cmd, $sock, $dir) = @_;
+	unlink($sock);
+	print "(cd $dir && $cmd)\n";
+	my $pid = fork();
+	defined($pid) || die "Could not fork: $!";
+	if($pid == 0) {
+		chdir($dir) || die "Could not change to $dir: $!";
+		exec(split(/\s+/, $cmd)) || die "Could not run '$cmd': $!";
+	}
+	for(my $i = 0; $i < 300 && ! -S $sock; $i++) {
+		waitpid($pid, WNOHANG) == 0 || die "bowtie2 server exited early ($?)\n";
+		select(undef, undef, undef, 0.1);
+	}
+	if(! -S $sock) {
+		kill('TERM', $pid);
+		waitpid($pid, 0);
+		die "bowtie2 server didn't create $sock\n";
+	}
+	my $mode = (stat($sock))[2] & 07777;
+	if($mode != 0600) {
+		kill('TERM', $pid);
+		waitpid($pid, 0);
+		die sprintf("bowtie2 server socket has mode %04o, not 0600\n", $mode);
+	}
+	return $pid;
+}
+
+sub runSameOutput($$$$) {
+	my ($c, $large_idx, $debug_mode, $sim) = @_;
+	my ($refs, $reads, $quals, $names, $m1s, $q1s, $m2s, $q2s, $pnames) = @$sim;
+	my $readarg;
+	if($c->{paired}) {
+		writeReads(undef, undef, $m1s, $q1s, $m2s, $q2s, $pnames,
+		           ".simple_tests.1.fq", ".simple_tests.2.fq");
+		$readarg = "-1 .simple_tests.1.fq -2 .simple_tests.2.fq";
+	} else {
+		writeReads($reads, $quals, undef, undef, undef, undef, $names,
+		           ".simple_tests.1.fq", ".simple_tests.2.fq");
+		$readarg = "-U .simple_tests.1.fq";
+	}
+	my $opts = "--quiet -x .simple_tests.tmp";
+	my ($base, $cmd2, $pid);
+	my $out = ".simple_tests.out.".($c->{bam} ? "bam" : "sam");
+	my $sock = ".simple_tests.sock";
+	print "$c->{name}\n";
+	if($c->{server}) {
+		# The wrapper can't start a server, so use the binary behind it
+		my $bin = $bowtie2;
+		$bin =~ s/[^\/]*$//;
+		$bin .= "bowtie2-align-".($large_idx ? "l" : "s");
+		$bin .= "-debug" if $debug_mode;
+		my $cwd = getcwd();
+		$bin = "$cwd/$bin" if $bin =~ /\// && $bin !~ /^\//;
+		$pid = startServer("$bin --server $cwd/$sock --quiet -x $cwd/.simple_tests.tmp",
+		                   "$cwd/$sock", "/");
+		$base = "$bin $opts -q $readarg";
+		$cmd2 = "$bin --connect $sock $opts -q $readarg -S $out";
+	} else {
+		$base = "$bowtie2 --quiet";
+		$base .= " --debug" if $debug_mode;
+		$base .= " --large-index" if $large_idx;
+		$base .= " -x .simple_tests.tmp -q $readarg";
+		$cmd2 = "$base $c->{args} -S $out";
+	}
+	my $ok = eval {
+		for my $cmd ("$base -S .simple_tests.plain.sam", $cmd2) {
+			print "$cmd\n";
+			system($cmd) == 0 || die "bowtie2 aborted with exitlevel $?\n";
+		}
+		1;
+	};
+	if(defined($pid)) {
+		kill('TERM', $pid);
+		waitpid($pid, 0);
+		unlink($sock);
+	}
+	$ok || die $@;
+	my @ex = readSam(".simple_tests.plain.sam");
+	my @got = $c->{bam} ? readBam($out) : readSam($out);
+	sameSamLines($c->{name}, \@ex, \@got);
+}
+
 my $tmpfafn = ".simple_tests.pl.fa";
 my $last_ref = undef;
 foreach my $large_idx (undef,1) {
@@ -4817,4 +5170,18 @@ foreach my $large_idx (undef,1) {
 		}
     }
 }
+my @sim = simSameOutput();
+foreach my $large_idx (undef,1) {
+	my $idx_type = ($large_idx ? "--large-index" : "");
+	writeFasta($sim[0], $tmpfafn);
+	my $cmd = "$bowtie2_build $idx_type --quiet $tmpfafn .simple_tests.tmp";
+	print "$cmd\n";
+	system($cmd);
+	($? == 0) || die "Bad exitlevel from bowtie2-build: $?";
+	foreach my $debug_mode (undef,1) {
+		for my $c (@same_output_cases) {
+			runSameOutput($c, $large_idx, $debug_mode, \@sim);
+		}
+	}
+}
 print "PASSED\n";
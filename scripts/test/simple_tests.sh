@@ -28,7 +28,8 @@ make $* bowtie2-align-s \
 		bowtie2-build-s \
 		bowtie2-build-l \
 		bowtie2-build-s-debug \
-		bowtie2-build-l-debug && \
+		bowtie2-build-l-debug \
+		bt2-lib-test && \
 perl scripts/test/simple_tests.pl \
 	--bowtie2=./bowtie2 \
 	--bowtie2-build=./bowtie2-build
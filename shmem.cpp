@@ -21,29 +21,295 @@
 
 #include <iostream>
 #include <string>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
 #include <unistd.h>
-#include <sys/shm.h>
+#include <fcntl.h>
 #include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "assert_helpers.h"
 #include "shmem.h"
 
 using namespace std;
 
+#define SHMEM_MAGIC 0x62743273 // "bt2s"
+
+// Bytes of the shared object used as fcntl() lock targets
+#define SHMEM_LOCK_INIT  0
+#define SHMEM_LOCK_USERS 1
+
+/**
+ * Manifest stored at the start of every shared-memory object, ahead of
+ * the payload.
+ */
+struct SharedMemManifest {
+	uint32_t magic;
+	volatile uint32_t state; // SHMEM_UNINIT or SHMEM_INIT
+	uint64_t len;            // payload length in bytes
+	uint64_t srcSize;        // size of index file payload was read from
+	int64_t  srcMtime;       // mtime of that file
+	uint64_t srcIno;         // inode of that file
+	char     name[64];       // name passed to shm_open
+	char     path[3968];     // absolute path of the index file
+};
+
+// Payload starts one page in, so that it stays page-aligned
+static const size_t SHMEM_HDR_SZ = 4096;
+
+/**
+ * Per-process record of a shared-memory object we're attached to.  The
+ * descriptor has to stay open for as long as we want to hold its locks.
+ */
+struct SharedMemAttachment {
+	void *base;
+	int   fd;
+};
+
+static const size_t SHMEM_MAX_ATTACH = 32;
+static SharedMemAttachment attached[SHMEM_MAX_ATTACH];
+
+static SharedMemAttachment* findAttachment(void *mem) {
+	void *base = (char*)mem - SHMEM_HDR_SZ;
+	for(size_t i = 0; i < SHMEM_MAX_ATTACH; i++) {
+		if(attached[i].base == base) {
+			return &attached[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Set, clear or test a lock on one byte of the given shared-memory
+ * object.  Returns 0 on success and -1 if a non-blocking request
+ * couldn't be granted.
+ */
+static int lockSharedByte(int fd, off_t byte, short type, bool wait) {
+	struct flock fl;
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = type;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = byte;
+	fl.l_len = 1;
+	int ret;
+	do {
+		ret = fcntl(fd, wait ? F_SETLKW : F_SETLK, &fl);
+	} while(ret == -1 && errno == EINTR);
+	return ret;
+}
+
+/**
+ * Return true iff the manifest describes a payload of len bytes read
+ * from the file at path with the given attributes.
+ */
+static bool manifestMatches(
+	const SharedMemManifest *m,
+	const char *path,
+	const struct stat& sbuf,
+	size_t len)
+{
+	return m->magic == SHMEM_MAGIC &&
+	       m->len == (uint64_t)len &&
+	       m->srcSize == (uint64_t)sbuf.st_size &&
+	       m->srcMtime == (int64_t)sbuf.st_mtime &&
+	       m->srcIno == (uint64_t)sbuf.st_ino &&
+	       strcmp(m->path, path) == 0;
+}
+
+/**
+ * Attach to the shared-memory object holding the array memName read
+ * from index file fname, creating it if it doesn't exist yet.  Returns
+ * true iff the caller must fill in the payload.
+ */
+bool allocSharedMemRaw(
+	const string& fname,
+	const char *memName,
+	size_t len,
+	void **dst,
+	bool verbose)
+{
+	char path[PATH_MAX];
+	if(realpath(fname.c_str(), path) == NULL) {
+		perror("realpath");
+		cerr << "Error: Could not resolve index file " << fname.c_str()
+		     << " for shared memory" << endl;
+		throw 1;
+	}
+	if(strlen(path) >= sizeof(((SharedMemManifest*)0)->path)) {
+		cerr << "Error: Index path " << path << " is too long for shared memory" << endl;
+		throw 1;
+	}
+	struct stat sbuf;
+	if(stat(path, &sbuf) == -1) {
+		perror("stat");
+		cerr << "Error: Could not stat index file " << path << endl;
+		throw 1;
+	}
+	// Name the object after a hash of the path and array name
+	uint64_t h = 14695981039346656037ull;
+	for(const char *c = path; *c != '\0'; c++) {
+		h = (h ^ (uint8_t)*c) * 1099511628211ull;
+	}
+	for(const char *c = memName; *c != '\0'; c++) {
+		h = (h ^ (uint8_t)*c) * 1099511628211ull;
+	}
+	// Different --offrate settings yield different offs[] payloads
+	h = (h ^ (uint64_t)len) * 1099511628211ull;
+	char name[64];
+	snprintf(name, sizeof(name), "/bowtie2-%016llx", (unsigned long long)h);
+	size_t totLen = SHMEM_HDR_SZ + len;
+	if(verbose) {
+		cerr << "Reading " << len << " bytes into shared memory " << name
+		     << " for " << memName << endl;
+	}
+	SharedMemAttachment *slot = NULL;
+	for(size_t i = 0; i < SHMEM_MAX_ATTACH; i++) {
+		if(attached[i].base == NULL) {
+			slot = &attached[i];
+			break;
+		}
+	}
+	if(slot == NULL) {
+		cerr << "Error: Too many shared-memory chunks attached" << endl;
+		throw 1;
+	}
+	while(true) {
+		int fd = shm_open(name, O_RDWR | O_CREAT, 0666);
+		if(fd < 0) {
+			perror("shm_open");
+			cerr << "Error: Could not open shared memory for " << memName << endl;
+			throw 1;
+		}
+		if(lockSharedByte(fd, SHMEM_LOCK_INIT, F_WRLCK, true) != 0) {
+			perror("fcntl");
+			cerr << "Error: Could not lock shared memory for " << memName << endl;
+			close(fd);
+			throw 1;
+		}
+		struct stat ss;
+		if(fstat(fd, &ss) == -1) {
+			perror("fstat");
+			cerr << "Error: Could not stat shared memory for " << memName << endl;
+			close(fd);
+			throw 1;
+		}
+		if(ss.st_nlink == 0) {
+			// The last user unlinked it while we were waiting; start over
+			close(fd);
+			continue;
+		}
+		bool fresh = (ss.st_size == 0);
+		if(!fresh && (size_t)ss.st_size != totLen) {
+			if(verbose) {
+				cerr << "  Discarding stale shared memory " << name << endl;
+			}
+			shm_unlink(name);
+			close(fd);
+			continue;
+		}
+		if(fresh && ftruncate(fd, (off_t)totLen) != 0) {
+			perror("ftruncate");
+			cerr << "Out of memory allocating shared area " << memName << endl;
+			shm_unlink(name);
+			close(fd);
+			throw 1;
+		}
+		void *base = mmap(NULL, totLen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if(base == MAP_FAILED) {
+			perror("mmap");
+			cerr << "Error: Could not map shared memory for " << memName << endl;
+			if(fresh) shm_unlink(name);
+			close(fd);
+			throw 1;
+		}
+		SharedMemManifest *m = (SharedMemManifest*)base;
+		if(!fresh && !manifestMatches(m, path, sbuf, len)) {
+			if(verbose) {
+				cerr << "  Discarding stale shared memory " << name << endl;
+			}
+			munmap(base, totLen);
+			shm_unlink(name);
+			close(fd);
+			continue;
+		}
+		// We hold the init lock, so an uninitialized payload means any
+		// earlier leader died before finishing; take over from it
+		bool leader = fresh || m->state != SHMEM_INIT;
+		if(leader) {
+			memset(m, 0, sizeof(SharedMemManifest));
+			m->magic = SHMEM_MAGIC;
+			m->state = SHMEM_UNINIT;
+			m->len = len;
+			m->srcSize = (uint64_t)sbuf.st_size;
+			m->srcMtime = (int64_t)sbuf.st_mtime;
+			m->srcIno = (uint64_t)sbuf.st_ino;
+			strcpy(m->name, name);
+			strcpy(m->path, path);
+		}
+		lockSharedByte(fd, SHMEM_LOCK_USERS, F_RDLCK, true);
+		if(!leader) {
+			// Nothing to do but read; let the next process in
+			lockSharedByte(fd, SHMEM_LOCK_INIT, F_UNLCK, false);
+		}
+		if(verbose) {
+			cerr << "  I (pid = " << getpid() << ") am the "
+			     << (leader ? "leader" : "follower") << " for "
+			     << memName << endl;
+		}
+		slot->base = base;
+		slot->fd = fd;
+		*dst = (char*)base + SHMEM_HDR_SZ;
+		return leader;
+	}
+}
+
 /**
  * Notify other users of a shared-memory chunk that the leader has
  * finished initializing it.
  */
 void notifySharedMem(void *mem, size_t len) {
-	((volatile uint32_t*)((char*)mem + len))[0] = SHMEM_INIT;
+	SharedMemManifest *m = (SharedMemManifest*)((char*)mem - SHMEM_HDR_SZ);
+	assert_eq((uint64_t)len, m->len);
+	__sync_synchronize();
+	m->state = SHMEM_INIT;
+	SharedMemAttachment *a = findAttachment(mem);
+	assert(a != NULL);
+	lockSharedByte(a->fd, SHMEM_LOCK_INIT, F_UNLCK, false);
 }
 
 /**
  * Wait until the leader of a shared-memory chunk has finished
- * initializing it.
+ * initializing it.  Followers are only handed the chunk once the leader
+ * has released the init lock, so this rarely has to wait at all.
  */
 void waitSharedMem(void *mem, size_t len) {
-	while(((volatile uint32_t*)((char*)mem + len))[0] != SHMEM_INIT) {
+	SharedMemManifest *m = (SharedMemManifest*)((char*)mem - SHMEM_HDR_SZ);
+	while(m->state != SHMEM_INIT) {
 		sleep(1);
 	}
 }
 
+/**
+ * Detach from a shared-memory chunk, removing it if we were the last
+ * process using it.
+ */
+void freeSharedMem(void *mem) {
+	if(mem == NULL) return;
+	SharedMemAttachment *a = findAttachment(mem);
+	if(a == NULL) return;
+	SharedMemManifest *m = (SharedMemManifest*)a->base;
+	size_t totLen = SHMEM_HDR_SZ + (size_t)m->len;
+	// Hold the init lock so that nobody attaches while we decide
+	lockSharedByte(a->fd, SHMEM_LOCK_INIT, F_WRLCK, true);
+	if(lockSharedByte(a->fd, SHMEM_LOCK_USERS, F_WRLCK, false) == 0) {
+		shm_unlink(m->name);
+	}
+	munmap(a->base, totLen);
+	close(a->fd); // releases our locks
+	a->base = NULL;
+	a->fd = -1;
+}
+
 #endif
@@ -22,24 +22,52 @@
 
 #ifdef BOWTIE_SHARED_MEM
 
+/**
+ * shmem.h:
+ *
+ * Lets concurrent bowtie2 processes on one machine share a single copy
+ * of the big index arrays and the reference.  Each array lives in a
+ * POSIX shared-memory object (shm_open) named after the absolute path
+ * of the index file it was read from.  The object starts with a small
+ * manifest identifying that file (path, size, mtime, inode), so a
+ * segment left over from an older build of the index is discarded
+ * rather than reused.
+ *
+ * Coordination uses fcntl() record locks on the object, which the
+ * kernel drops when a process exits, so a job that dies never leaves a
+ * segment that looks busy:
+ *
+ *  - The "init" lock is held exclusively by the process filling the
+ *    segment (the leader); followers block on it until the leader calls
+ *    NOTIFY_SHARED.  If the leader dies first, the next process to get
+ *    the lock finds the manifest uninitialized and becomes the leader.
+ *  - Every attached process holds a shared "users" lock.  FREE_SHARED
+ *    unlinks the object when it can upgrade that lock, i.e. when the
+ *    caller was the last process using it.
+ */
+
 #include <string>
-#include <sys/shm.h>
-#include <unistd.h>
-#include <sys/shm.h>
-#include <errno.h>
 #include <stdint.h>
-#include <stdexcept>
-#include "str_util.h"
+#include <stddef.h>
 #include "btypes.h"
 
+extern bool allocSharedMemRaw(
+	const std::string& fname,
+	const char *memName,
+	size_t len,
+	void **dst,
+	bool verbose);
+
 extern void notifySharedMem(void *mem, size_t len);
 
 extern void waitSharedMem(void *mem, size_t len);
 
+extern void freeSharedMem(void *mem);
+
 #define ALLOC_SHARED_U allocSharedMem<TIndexOffU>
 #define ALLOC_SHARED_U8 allocSharedMem<uint8_t>
 #define ALLOC_SHARED_U32 allocSharedMem<uint32_t>
-#define FREE_SHARED shmdt
+#define FREE_SHARED freeSharedMem
 #define NOTIFY_SHARED notifySharedMem
 #define WAIT_SHARED waitSharedMem
 
@@ -47,7 +75,10 @@ extern void waitSharedMem(void *mem, size_t len);
 #define SHMEM_INIT    0xffaa6161
 
 /**
- * Tries to allocate a shared-memory chunk for a given file of a given size.
+ * Attach to (creating if necessary) the shared-memory chunk holding the
+ * array named memName that is read from index file fname.  Returns true
+ * iff the caller is the leader and must fill the chunk and then call
+ * NOTIFY_SHARED; otherwise the chunk is already filled.
  */
 template <typename T>
 bool allocSharedMem(std::string fname,
@@ -56,95 +87,10 @@ bool allocSharedMem(std::string fname,
                     const char *memName,
                     bool verbose)
 {
-	using namespace std;
-	int shmid = -1;
-	// Calculate key given string
-	key_t key = (key_t)hash_string(fname);
-	shmid_ds ds;
-	int ret;
-	// Reserve 4 bytes at the end for silly synchronization
-	size_t shmemLen = len + 4;
-	if(verbose) {
-		cerr << "Reading " << len << "+4 bytes into shared memory for " << memName << endl;
-	}
-	T *ptr = NULL;
-	while(true) {
-		// Create the shrared-memory block
-		if((shmid = shmget(key, shmemLen, IPC_CREAT | 0666)) < 0) {
-			if(errno == ENOMEM) {
-				cerr << "Out of memory allocating shared area " << memName << endl;
-			} else if(errno == EACCES) {
-				cerr << "EACCES" << endl;
-			} else if(errno == EEXIST) {
-				cerr << "EEXIST" << endl;
-			} else if(errno == EINVAL) {
-				cerr << "Warning: shared-memory chunk's segment size doesn't match expected size (" << (shmemLen) << ")" << endl
-					 << "Deleteing old shared memory block and trying again." << endl;
-				shmid = shmget(key, 0, 0);
-				if((ret = shmctl(shmid, IPC_RMID, &ds)) < 0) {
-					cerr << "shmctl returned " << ret
-						 << " for IPC_RMID, errno is " << errno
-						 << ", shmid is " << shmid << endl;
-					throw 1;
-				} else {
-					cerr << "Deleted shared mem chunk with shmid " << shmid << endl;
-				}
-				continue;
-			} else if(errno == ENOENT) {
-				cerr << "ENOENT" << endl;
-			} else if(errno == ENOSPC) {
-				cerr << "ENOSPC" << endl;
-			} else {
-				cerr << "shmget returned " << shmid << " for and errno is " << errno << endl;
-			}
-			throw 1;
-		}
-		ptr = (T*)shmat(shmid, 0, 0);
-		if(ptr == (void*)-1) {
-			cerr << "Failed to attach " << memName << " to shared memory with shmat()." << endl;
-			throw 1;
-		}
-		if(ptr == NULL) {
-			cerr << memName << " pointer returned by shmat() was NULL." << endl;
-			throw 1;
-		}
-		// Did I create it, or did I just attach to one created by
-		// another process?
-		if((ret = shmctl(shmid, IPC_STAT, &ds)) < 0) {
-			cerr << "shmctl returned " << ret << " for IPC_STAT and errno is " << errno << endl;
-			throw 1;
-		}
-		if(ds.shm_segsz != shmemLen) {
-			cerr << "Warning: shared-memory chunk's segment size (" << ds.shm_segsz
-				 << ") doesn't match expected size (" << shmemLen << ")" << endl
-				 << "Deleteing old shared memory block and trying again." << endl;
-			if((ret = shmctl(shmid, IPC_RMID, &ds)) < 0) {
-				cerr << "shmctl returned " << ret << " for IPC_RMID and errno is " << errno << endl;
-				throw 1;
-			}
-		} else {
-			break;
-		}
-	} // while(true)
-	*dst = ptr;
-	bool initid = (((volatile uint32_t*)((char*)ptr + len))[0] == SHMEM_INIT);
-	if(ds.shm_cpid == getpid() && !initid) {
-		if(verbose) {
-			cerr << "  I (pid = " << getpid() << ") created the "
-			     << "shared memory for " << memName << endl;
-		}
-		// Set this value just off the end of the chunk to
-		// indicate that the data hasn't been read yet.
-		((volatile uint32_t*)((char*)ptr + len))[0] = SHMEM_UNINIT;
-		return true;
-	} else {
-		if(verbose) {
-			cerr << "  I (pid = " << getpid()
-			     << ") did not create the shared memory for "
-			     << memName << ".  Pid " << ds.shm_cpid << " did." << endl;
-		}
-		return false;
-	}
+	void *mem = NULL;
+	bool leader = allocSharedMemRaw(fname, memName, len, &mem, verbose);
+	*dst = (T*)mem;
+	return leader;
 }
 
 #else
@@ -0,0 +1,380 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * simd_seq.h
+ *
+ * Vectorized routines for scanning and translating read text and for
+ * the byte-wise string manipulations done on every read: finding line
+ * ends, translating ASCII nucleotides and qualities, counting Ns, and
+ * reversing and reverse-complementing.  Each routine has an SSE2
+ * version, which is always available, and an AVX2 version, which is
+ * used when the compiler can generate it and the processor we're
+ * running on supports it.
+ *
+ * Nucleotides are encoded 0=A, 1=C, 2=G, 3=T, 4=N throughout.
+ */
+
+#ifndef SIMD_SEQ_H_
+#define SIMD_SEQ_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <emmintrin.h>
+#include "assert_helpers.h"
+#include "processor_support.h"
+
+#if (defined(__clang__) && __clang_major__ >= 4) || \
+    (defined(__GNUC__) && !defined(__clang__) && !defined(__INTEL_COMPILER) && \
+     (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+#define SIMD_SEQ_AVX2
+#include <immintrin.h>
+#define SIMD_SEQ_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+/**
+ * Return true iff the processor we're running on supports AVX2.
+ */
+static inline bool seqHasAvx2() {
+#ifdef SIMD_SEQ_AVX2
+	static const bool has = ProcessorSupport::instance().AVX2enabled();
+	return has;
+#else
+	return false;
+#endif
+}
+
+/**
+ * Reverse the 16 bytes of x using only SSE2 shuffles.
+ */
+static inline __m128i seqRev16(__m128i x) {
+	x = _mm_shuffle_epi32(x, _MM_SHUFFLE(0, 1, 2, 3));
+	x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+	x = _mm_shufflehi_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+	return _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+}
+
+/**
+ * Translate 16 ASCII nucleotides into 0-4 codes.  Sets 'ok' to a mask
+ * with a bit set for each byte that is one of ACGTNacgtn or '.'.
+ */
+static inline __m128i seqDna16(__m128i x, int& ok) {
+	const __m128i lc = _mm_or_si128(x, _mm_set1_epi8(0x20));
+	const __m128i c = _mm_cmpeq_epi8(lc, _mm_set1_epi8('c'));
+	const __m128i g = _mm_cmpeq_epi8(lc, _mm_set1_epi8('g'));
+	const __m128i t = _mm_cmpeq_epi8(lc, _mm_set1_epi8('t'));
+	const __m128i n = _mm_or_si128(
+		_mm_cmpeq_epi8(lc, _mm_set1_epi8('n')),
+		_mm_cmpeq_epi8(x,  _mm_set1_epi8('.')));
+	const __m128i a = _mm_cmpeq_epi8(lc, _mm_set1_epi8('a'));
+	ok = _mm_movemask_epi8(
+		_mm_or_si128(_mm_or_si128(a, c), _mm_or_si128(_mm_or_si128(g, t), n)));
+	return _mm_or_si128(
+		_mm_or_si128(_mm_and_si128(c, _mm_set1_epi8(1)),
+		             _mm_and_si128(g, _mm_set1_epi8(2))),
+		_mm_or_si128(_mm_and_si128(t, _mm_set1_epi8(3)),
+		             _mm_and_si128(n, _mm_set1_epi8(4))));
+}
+
+/**
+ * Scalar counterpart of seqDna16: return the code for c, or -1 if c
+ * isn't one of ACGTNacgtn or '.'.
+ */
+static inline int seqDna1(char c) {
+	switch(c) {
+		case 'A': case 'a': return 0;
+		case 'C': case 'c': return 1;
+		case 'G': case 'g': return 2;
+		case 'T': case 't': return 3;
+		case 'N': case 'n': case '.': return 4;
+		default: return -1;
+	}
+}
+
+#ifdef SIMD_SEQ_AVX2
+
+SIMD_SEQ_TARGET_AVX2
+static inline __m256i seqRev32(__m256i x) {
+	const __m256i rev = _mm256_setr_epi8(
+		15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+		15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+	x = _mm256_shuffle_epi8(x, rev);
+	return _mm256_permute4x64_epi64(x, _MM_SHUFFLE(1, 0, 3, 2));
+}
+
+SIMD_SEQ_TARGET_AVX2
+static inline __m256i seqDna32(__m256i x, uint32_t& ok) {
+	// Look each byte up by its low nibble, then check that the byte is
+	// exactly the letter (either case) the nibble suggested
+	const __m256i lc = _mm256_or_si256(x, _mm256_set1_epi8(0x20));
+	const __m256i lo = _mm256_and_si256(lc, _mm256_set1_epi8(0x0f));
+	const __m256i letter = _mm256_setr_epi8(
+		0, 'a', 0, 'c', 0, 0, 0, 'g', 0, 0, 0, 0, 0, 0, 'n', 0,
+		0, 'a', 0, 'c', 0, 0, 0, 'g', 0, 0, 0, 0, 0, 0, 'n', 0);
+	const __m256i code = _mm256_setr_epi8(
+		0, 0, 0, 1, 3, 0, 0, 2, 0, 0, 0, 0, 0, 0, 4, 0,
+		0, 0, 0, 1, 3, 0, 0, 2, 0, 0, 0, 0, 0, 0, 4, 0);
+	const __m256i isAcgn = _mm256_cmpeq_epi8(lc, _mm256_shuffle_epi8(letter, lo));
+	const __m256i isT    = _mm256_cmpeq_epi8(lc, _mm256_set1_epi8('t'));
+	const __m256i isDot  = _mm256_cmpeq_epi8(x,  _mm256_set1_epi8('.'));
+	const __m256i valid = _mm256_or_si256(_mm256_or_si256(isAcgn, isT), isDot);
+	ok = (uint32_t)_mm256_movemask_epi8(valid);
+	return _mm256_or_si256(
+		_mm256_and_si256(_mm256_or_si256(isAcgn, isT), _mm256_shuffle_epi8(code, lo)),
+		_mm256_and_si256(isDot, _mm256_set1_epi8(4)));
+}
+
+SIMD_SEQ_TARGET_AVX2
+static size_t seqFindNewlineAvx2(const char *s, size_t n) {
+	const __m256i nl = _mm256_set1_epi8('\n');
+	const __m256i cr = _mm256_set1_epi8('\r');
+	size_t i = 0;
+	for(; i + 32 <= n; i += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i*)(s + i));
+		uint32_t m = (uint32_t)_mm256_movemask_epi8(
+			_mm256_or_si256(_mm256_cmpeq_epi8(x, nl), _mm256_cmpeq_epi8(x, cr)));
+		if(m != 0) return i + __builtin_ctz(m);
+	}
+	for(; i < n; i++) {
+		if(s[i] == '\n' || s[i] == '\r') return i;
+	}
+	return n;
+}
+
+SIMD_SEQ_TARGET_AVX2
+static bool seqAsciiToDnaAvx2(char *dst, const char *src, size_t n) {
+	size_t i = 0;
+	for(; i + 32 <= n; i += 32) {
+		uint32_t ok;
+		__m256i x = seqDna32(_mm256_loadu_si256((const __m256i*)(src + i)), ok);
+		if(ok != 0xffffffffu) return false;
+		_mm256_storeu_si256((__m256i*)(dst + i), x);
+	}
+	for(; i < n; i++) {
+		int c = seqDna1(src[i]);
+		if(c < 0) return false;
+		dst[i] = (char)c;
+	}
+	return true;
+}
+
+SIMD_SEQ_TARGET_AVX2
+static bool seqPhredToPhred33Avx2(char *dst, const char *src, size_t n, int base) {
+	const __m256i lim = _mm256_set1_epi8((char)(base - 1));
+	const __m256i off = _mm256_set1_epi8((char)(base - 33));
+	size_t i = 0;
+	for(; i + 32 <= n; i += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i*)(src + i));
+		if(_mm256_movemask_epi8(_mm256_cmpgt_epi8(x, lim)) != -1) return false;
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_sub_epi8(x, off));
+	}
+	for(; i < n; i++) {
+		if(src[i] < base) return false;
+		dst[i] = src[i] - (base - 33);
+	}
+	return true;
+}
+
+SIMD_SEQ_TARGET_AVX2
+static size_t seqCountNsAvx2(const char *s, size_t n) {
+	const __m256i three = _mm256_set1_epi8(3);
+	size_t ns = 0, i = 0;
+	for(; i + 32 <= n; i += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i*)(s + i));
+		ns += __builtin_popcount((uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(x, three)));
+	}
+	for(; i < n; i++) {
+		if(s[i] > 3) ns++;
+	}
+	return ns;
+}
+
+SIMD_SEQ_TARGET_AVX2
+static void seqReverseAvx2(char *dst, const char *src, size_t n) {
+	size_t i = 0;
+	for(; i + 32 <= n; i += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i*)(src + n - i - 32));
+		_mm256_storeu_si256((__m256i*)(dst + i), seqRev32(x));
+	}
+	for(; i < n; i++) {
+		dst[i] = src[n - i - 1];
+	}
+}
+
+SIMD_SEQ_TARGET_AVX2
+static void seqRevCompAvx2(char *dst, const char *src, size_t n) {
+	const __m256i four = _mm256_set1_epi8(4);
+	const __m256i three = _mm256_set1_epi8(3);
+	size_t i = 0;
+	for(; i + 32 <= n; i += 32) {
+		__m256i x = seqRev32(_mm256_loadu_si256((const __m256i*)(src + n - i - 32)));
+		x = _mm256_xor_si256(x, _mm256_andnot_si256(_mm256_cmpeq_epi8(x, four), three));
+		_mm256_storeu_si256((__m256i*)(dst + i), x);
+	}
+	for(; i < n; i++) {
+		char c = src[n - i - 1];
+		dst[i] = (c == 4 ? 4 : c ^ 3);
+	}
+}
+
+#endif /* SIMD_SEQ_AVX2 */
+
+/**
+ * Return the offset of the first '\n' or '\r' in s[0..n), or n if there
+ * isn't one.
+ */
+static inline size_t seqFindNewline(const char *s, size_t n) {
+#ifdef SIMD_SEQ_AVX2
+	if(n >= 64 && seqHasAvx2()) return seqFindNewlineAvx2(s, n);
+#endif
+	const __m128i nl = _mm_set1_epi8('\n');
+	const __m128i cr = _mm_set1_epi8('\r');
+	size_t i = 0;
+	for(; i + 16 <= n; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(s + i));
+		int m = _mm_movemask_epi8(
+			_mm_or_si128(_mm_cmpeq_epi8(x, nl), _mm_cmpeq_epi8(x, cr)));
+		if(m != 0) return i + __builtin_ctz(m);
+	}
+	for(; i < n; i++) {
+		if(s[i] == '\n' || s[i] == '\r') return i;
+	}
+	return n;
+}
+
+/**
+ * Translate the n ASCII nucleotides in src into 0-4 codes in dst.  Only
+ * ACGTNacgtn and '.' (taken to be N) are translated; if src contains
+ * anything else, return false and leave dst partially filled so that
+ * the caller can fall back on a scalar loop that handles the oddities.
+ */
+static inline bool seqAsciiToDna(char *dst, const char *src, size_t n) {
+#ifdef SIMD_SEQ_AVX2
+	if(n >= 32 && seqHasAvx2()) return seqAsciiToDnaAvx2(dst, src, n);
+#endif
+	size_t i = 0;
+	for(; i + 16 <= n; i += 16) {
+		int ok;
+		__m128i x = seqDna16(_mm_loadu_si128((const __m128i*)(src + i)), ok);
+		if(ok != 0xffff) return false;
+		_mm_storeu_si128((__m128i*)(dst + i), x);
+	}
+	for(; i < n; i++) {
+		int c = seqDna1(src[i]);
+		if(c < 0) return false;
+		dst[i] = (char)c;
+	}
+	return true;
+}
+
+/**
+ * Translate the n ASCII qualities in src, which are Phred qualities
+ * offset by 'base' (33 or 64), into Phred+33 qualities in dst.  If any
+ * character is out of range (including spaces and newlines), return
+ * false; the caller should then use charToPhred33, which reports the
+ * offending character.
+ */
+static inline bool seqPhredToPhred33(char *dst, const char *src, size_t n, int base) {
+	assert(base == 33 || base == 64);
+#ifdef SIMD_SEQ_AVX2
+	if(n >= 32 && seqHasAvx2()) return seqPhredToPhred33Avx2(dst, src, n, base);
+#endif
+	const __m128i lim = _mm_set1_epi8((char)(base - 1));
+	const __m128i off = _mm_set1_epi8((char)(base - 33));
+	size_t i = 0;
+	for(; i + 16 <= n; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(src + i));
+		if(_mm_movemask_epi8(_mm_cmpgt_epi8(x, lim)) != 0xffff) return false;
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_sub_epi8(x, off));
+	}
+	for(; i < n; i++) {
+		if(src[i] < base) return false;
+		dst[i] = src[i] - (base - 33);
+	}
+	return true;
+}
+
+/**
+ * Return the number of Ns (codes greater than 3) in s[0..n).
+ */
+static inline size_t seqCountNs(const char *s, size_t n) {
+#ifdef SIMD_SEQ_AVX2
+	if(n >= 32 && seqHasAvx2()) return seqCountNsAvx2(s, n);
+#endif
+	const __m128i three = _mm_set1_epi8(3);
+	size_t ns = 0, i = 0;
+	for(; i + 16 <= n; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(s + i));
+		ns += __builtin_popcount(_mm_movemask_epi8(_mm_cmpgt_epi8(x, three)));
+	}
+	for(; i < n; i++) {
+		if(s[i] > 3) ns++;
+	}
+	return ns;
+}
+
+/**
+ * Set dst[0..n) to the reverse of src[0..n).  The buffers must not
+ * overlap.
+ */
+static inline void seqReverse(char *dst, const char *src, size_t n) {
+	assert(dst + n <= src || src + n <= dst);
+#ifdef SIMD_SEQ_AVX2
+	if(n >= 32 && seqHasAvx2()) {
+		seqReverseAvx2(dst, src, n);
+		return;
+	}
+#endif
+	size_t i = 0;
+	for(; i + 16 <= n; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(src + n - i - 16));
+		_mm_storeu_si128((__m128i*)(dst + i), seqRev16(x));
+	}
+	for(; i < n; i++) {
+		dst[i] = src[n - i - 1];
+	}
+}
+
+/**
+ * Set dst[0..n) to the reverse complement of the nucleotide codes in
+ * src[0..n).  Ns stay Ns.  The buffers must not overlap.
+ */
+static inline void seqRevComp(char *dst, const char *src, size_t n) {
+	assert(dst + n <= src || src + n <= dst);
+#ifdef SIMD_SEQ_AVX2
+	if(n >= 32 && seqHasAvx2()) {
+		seqRevCompAvx2(dst, src, n);
+		return;
+	}
+#endif
+	const __m128i four = _mm_set1_epi8(4);
+	const __m128i three = _mm_set1_epi8(3);
+	size_t i = 0;
+	for(; i + 16 <= n; i += 16) {
+		__m128i x = seqRev16(_mm_loadu_si128((const __m128i*)(src + n - i - 16)));
+		x = _mm_xor_si128(x, _mm_andnot_si128(_mm_cmpeq_epi8(x, four), three));
+		_mm_storeu_si128((__m128i*)(dst + i), x);
+	}
+	for(; i < n; i++) {
+		char c = src[n - i - 1];
+		dst[i] = (c == 4 ? 4 : c ^ 3);
+	}
+}
+
+#endif /*SIMD_SEQ_H_*/
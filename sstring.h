@@ -25,6 +25,7 @@
 #include "assert_helpers.h"
 #include "alphabet.h"
 #include "random_source.h"
+#include "simd_seq.h"
 
 /**
  * Four kinds of strings defined here:
@@ -1841,8 +1842,12 @@ public:
 	 */
 	void installReverse(const char* b, size_t sz) {
 		if(sz_ < sz) expandNoCopy((sz + S) * M);
-		for(size_t i = 0; i < sz; i++) {
-			cs_[i] = b[sz-i-1];
+		if(sizeof(T) == 1) {
+			seqReverse((char*)cs_, b, sz);
+		} else {
+			for(size_t i = 0; i < sz; i++) {
+				cs_[i] = b[sz-i-1];
+			}
 		}
 		len_ = sz;
 	}
@@ -1853,8 +1858,12 @@ public:
 	 */
 	void installReverse(const SStringExpandable<T, S>& b) {
 		if(sz_ < b.len_) expandNoCopy((b.len_ + S) * M);
-		for(size_t i = 0; i < b.len_; i++) {
-			cs_[i] = b.cs_[b.len_ - i - 1];
+		if(sizeof(T) == 1) {
+			seqReverse((char*)cs_, (const char*)b.cs_, b.len_);
+		} else {
+			for(size_t i = 0; i < b.len_; i++) {
+				cs_[i] = b.cs_[b.len_ - i - 1];
+			}
 		}
 		len_ = b.len_;
 	}
@@ -2901,9 +2910,7 @@ public:
 	 */
 	void installReverseComp(const char* b, size_t sz) {
 		if(this->sz_ < sz) this->expandCopy((sz + S) * M);
-		for(size_t i = 0; i < sz; i++) {
-			this->cs_[i] = (b[sz-i-1] == 4 ? 4 : b[sz-i-1] ^ 3);
-		}
+		seqRevComp(this->cs_, b, sz);
 		this->len_ = sz;
 	}
 
@@ -2914,9 +2921,7 @@ public:
 	 */
 	void installReverseComp(const SDnaStringExpandable<S, M>& b) {
 		if(this->sz_ < b.len_) this->expandCopy((b.len_ + S) * M);
-		for(size_t i = 0; i < b.len_; i++) {
-			this->cs_[i] = (b.cs_[b.len_-i-1] == 4 ? 4 : b.cs_[b.len_-i-1] ^ 3);
-		}
+		seqRevComp(this->cs_, b.cs_, b.len_);
 		this->len_ = b.len_;
 	}
 